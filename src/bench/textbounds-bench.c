@@ -0,0 +1,901 @@
+/*
+ * Filename: textbounds-bench.c
+ * Brief: Throughput of the scan engines, over a synthetic corpus
+ *
+ * Description:
+ *   Generate text of several shapes, the same every time for the same
+ *   seed and size, and measure each shape, in memory, with every engine
+ *   that this CPU supports.  Each measurement is repeated until enough
+ *   time has gone by, and the fastest run is the one reported:
+ *   as GB/s, ns per line, and bytes per cycle of the time-stamp counter,
+ *   where there is one.
+ *
+ *   Where perf_event_open() is allowed, the fastest run also comes
+ *   with hardware counters: cycles, instructions, and so IPC, branch
+ *   misses, and L1 data and last-level cache misses, counted in user
+ *   space only.  Any counter that cannot be had is null; if none can,
+ *   as in many containers, or with kernel.perf_event_paranoid set
+ *   high, the reason is shown, and all else goes on as before.
+ *
+ *   Results are written as JSON, with one result to a line,
+ *   in a fixed order, so that the results of different builds,
+ *   and different machines, can be compared with diff, or read
+ *   by a program.  Every engine must give the same results
+ *   for the same text; if not, that is reported, and the exit
+ *   status is 1.
+ *
+ * Copyright (C) 2019 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE 1
+
+#include <cscript.h>
+#include <textbounds.h>
+
+#include <errno.h>
+    // Import errno
+#include <getopt.h>
+    // Import getopt_long()
+#include <stdint.h>
+    // Import type uint64_t
+#include <stdio.h>
+    // Import printf(), fopen()
+#include <stdlib.h>
+    // Import malloc(), strtoull()
+#include <string.h>
+    // Import strcmp(), strerror(), memcpy()
+#include <time.h>
+    // Import clock_gettime()
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+    // Import __rdtsc()
+#define HAVE_TSC 1
+#endif
+#ifdef __linux__
+#include <linux/perf_event.h>
+    // Import struct perf_event_attr, PERF_*
+#include <sys/ioctl.h>
+    // Import ioctl()
+#include <sys/syscall.h>
+    // Import SYS_perf_event_open
+#include <unistd.h>
+    // Import syscall(), read(), close()
+#define HAVE_PERF 1
+#endif
+
+const char *program_path;
+const char *program_name;
+
+/*
+ * Deterministic pseudo-random numbers (splitmix64),
+ * so that the corpus is the same from build to build.
+ */
+static uint64_t rng_state;
+
+static uint64_t
+rng_next(void)
+{
+    uint64_t z;
+
+    rng_state += 0x9e3779b97f4a7c15ULL;
+    z = rng_state;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return (z ^ (z >> 31));
+}
+
+static size_t
+rng_below(size_t n)
+{
+    return ((size_t)(rng_next() % n));
+}
+
+/*
+ * Append to a buffer of fixed size; whatever does not fit is dropped.
+ */
+struct gen {
+    char   *buf;
+    size_t size;
+    size_t len;
+};
+
+static void
+gen_put(struct gen *g, const char *str, size_t len)
+{
+    if (len > g->size - g->len) {
+        len = g->size - g->len;
+    }
+    memcpy(g->buf + g->len, str, len);
+    g->len += len;
+}
+
+static void
+gen_putc(struct gen *g, char c)
+{
+    if (g->len < g->size) {
+        g->buf[g->len++] = c;
+    }
+}
+
+static void
+gen_word(struct gen *g, size_t maxlen)
+{
+    size_t n;
+
+    for (n = 1 + rng_below(maxlen); n > 0; --n) {
+        gen_putc(g, 'a' + rng_below(26));
+    }
+}
+
+/*
+ * Short lines, of words, as in prose or source code.
+ */
+static void
+gen_short(struct gen *g)
+{
+    size_t width;
+
+    while (g->len < g->size) {
+        width = rng_below(40);
+        while (width > 0) {
+            gen_word(g, 8);
+            gen_putc(g, ' ');
+            width = (width > 9) ? width - 9 : 0;
+        }
+        gen_putc(g, '\n');
+    }
+}
+
+/*
+ * Very long lines: minified JSON, a few megabytes to a line.
+ */
+static void
+gen_long(struct gen *g)
+{
+    char num[32];
+    size_t end;
+    size_t n;
+
+    while (g->len < g->size) {
+        end = g->len + (1 << 20) + rng_below(3 << 20);
+        gen_putc(g, '[');
+        while (g->len < end && g->len < g->size) {
+            gen_put(g, "{\"id\":", 6);
+            n = snprintf(num, sizeof (num), "%zu", rng_below(1000000));
+            gen_put(g, num, n);
+            gen_put(g, ",\"name\":\"", 9);
+            gen_word(g, 12);
+            gen_put(g, "\",\"tags\":[\"", 11);
+            gen_word(g, 6);
+            gen_put(g, "\",\"", 3);
+            gen_word(g, 6);
+            gen_put(g, "\"],\"ok\":true},", 14);
+        }
+        gen_put(g, "{}]\n", 4);
+    }
+}
+
+/*
+ * Makefiles: recipes indented with tabs, and assignments
+ * lined up with tabs.
+ */
+static void
+gen_makefile(struct gen *g)
+{
+    size_t n;
+
+    while (g->len < g->size) {
+        gen_word(g, 10);
+        gen_put(g, ".o:\t", 4);
+        for (n = 1 + rng_below(4); n > 0; --n) {
+            gen_word(g, 10);
+            gen_put(g, ".c\t", 3);
+        }
+        gen_putc(g, '\n');
+        for (n = 1 + rng_below(3); n > 0; --n) {
+            gen_put(g, "\t$(CC)\t$(CFLAGS)\t-c\t", 20);
+            gen_word(g, 12);
+            gen_put(g, "\t\t# ", 4);
+            gen_word(g, 8);
+            gen_putc(g, '\n');
+        }
+        gen_word(g, 8);
+        gen_put(g, "\t\t:=\t", 5);
+        gen_word(g, 20);
+        gen_put(g, "\n\n", 2);
+    }
+}
+
+/*
+ * Lines with lots of trailing white space, which does not count.
+ */
+static void
+gen_tws(struct gen *g)
+{
+    size_t n;
+
+    while (g->len < g->size) {
+        for (n = rng_below(5); n > 0; --n) {
+            gen_word(g, 8);
+            gen_putc(g, ' ');
+        }
+        for (n = rng_below(60); n > 0; --n) {
+            gen_putc(g, rng_below(4) == 0 ? '\t' : ' ');
+        }
+        gen_putc(g, '\n');
+    }
+}
+
+/*
+ * UTF-8: mostly ASCII, with Latin accents, CJK, emoji,
+ * and combining marks.
+ */
+static void
+gen_utf8(struct gen *g)
+{
+    static const char *const pieces[] = {
+        "\xc3\xa9", "\xc3\xbc", "\xc3\x9f",                 // é ü ß
+        "\xe6\x96\x87", "\xe5\xad\x97", "\xe3\x81\x82",     // 文 字 あ
+        "\xf0\x9f\x98\x80", "\xf0\x9f\x9a\x80",             // emoji
+        "\xcc\x81", "\xcc\x88",                             // combining
+    };
+    size_t width;
+    size_t r;
+
+    while (g->len < g->size) {
+        for (width = rng_below(60); width > 0; --width) {
+            r = rng_below(20);
+            if (r < 10) {
+                gen_putc(g, 'a' + rng_below(26));
+            }
+            else if (r < 12) {
+                gen_putc(g, ' ');
+            }
+            else {
+                r = rng_below(sizeof (pieces) / sizeof (pieces[0]));
+                gen_put(g, pieces[r], strlen(pieces[r]));
+            }
+        }
+        gen_putc(g, '\n');
+    }
+}
+
+/*
+ * Short lines that end in CRLF.
+ */
+static void
+gen_crlf(struct gen *g)
+{
+    size_t n;
+
+    while (g->len < g->size) {
+        for (n = rng_below(8); n > 0; --n) {
+            gen_word(g, 8);
+            gen_putc(g, ' ');
+        }
+        gen_put(g, "\r\n", 2);
+    }
+}
+
+/*
+ * Binary junk: every byte value, equally likely.
+ */
+static void
+gen_binary(struct gen *g)
+{
+    uint64_t r;
+    size_t n;
+
+    while (g->len < g->size) {
+        // A byte at a time, to be the same on any byte order
+        for (r = rng_next(), n = 0; n < 8; ++n, r >>= 8) {
+            gen_putc(g, (char)(r & 0xff));
+        }
+    }
+}
+
+struct shape {
+    const char *name;
+    void (*gen)(struct gen *);
+    bool   utf8;
+    uint_t eol;
+};
+
+static const struct shape shapes[] = {
+    { "short",    gen_short,    false, TB_EOL_LF },
+    { "long",     gen_long,     false, TB_EOL_LF },
+    { "makefile", gen_makefile, false, TB_EOL_LF },
+    { "tws",      gen_tws,      false, TB_EOL_LF },
+    { "utf8",     gen_utf8,     true,  TB_EOL_LF },
+    { "crlf",     gen_crlf,     false, TB_EOL_CRLF },
+    { "binary",   gen_binary,   false, TB_EOL_LF },
+};
+
+#define NR_SHAPES (sizeof (shapes) / sizeof (shapes[0]))
+
+static uint64_t opt_seed = 1;
+static size_t opt_size = 16 << 20;
+static double opt_min_time = 0.5;
+static const char *opt_shape = NULL;
+static const char *opt_engine = NULL;
+static const char *opt_corpus = NULL;
+static bool opt_counters = true;
+
+static const char usage_text[] =
+    "Usage: textbounds-bench [options]\n"
+    "  --size=N[KMG]     Bytes of text of each shape (default 16M)\n"
+    "  --seed=N          Seed of the corpus generator (default 1)\n"
+    "  --time=SECS       Repeat each measurement for at least SECS (default 0.5)\n"
+    "  --shape=NAME      Only this shape\n"
+    "  --engine=NAME     Only this engine\n"
+    "  --corpus=DIR      Also write the text of each shape to DIR/NAME.txt\n"
+    "  --no-counters     Do not use hardware performance counters\n"
+    "Shapes: short long makefile tws utf8 crlf binary\n"
+    ;
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+static uint64_t
+cycles(void)
+{
+#ifdef HAVE_TSC
+    return (__rdtsc());
+#else
+    return (0);
+#endif
+}
+
+/*
+ * Hardware performance counters, each opened on its own, so that
+ * any that the CPU, or the kernel, will not give are just left out.
+ */
+enum {
+    CTR_CYCLES = 0,
+    CTR_INSTRUCTIONS,
+    CTR_BRANCH_MISSES,
+    CTR_L1D_MISSES,
+    CTR_LLC_MISSES,
+    NR_CTRS
+};
+
+#ifdef HAVE_PERF
+#define HW_CACHE(cache, op, result) \
+    ((cache) | ((op) << 8) | ((result) << 16))
+
+static const struct {
+    uint32_t type;
+    uint64_t config;
+} ctr_defs[NR_CTRS] = {
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    { PERF_TYPE_HW_CACHE, HW_CACHE(PERF_COUNT_HW_CACHE_L1D,
+        PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS) },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+};
+#endif
+
+static const char *const ctr_names[NR_CTRS] = {
+    "cycles", "instructions", "branch_misses", "l1d_misses", "llc_misses"
+};
+
+static int ctr_fd[NR_CTRS];
+static int ctr_errno;           // Why the first counter could not be had
+
+struct counters {
+    bool   valid[NR_CTRS];
+    uint64_t value[NR_CTRS];
+};
+
+static void
+counters_open(void)
+{
+#ifdef HAVE_PERF
+    struct perf_event_attr attr;
+#endif
+    size_t i;
+
+    ctr_errno = 0;
+    for (i = 0; i < NR_CTRS; ++i) {
+        ctr_fd[i] = -1;
+    }
+    if (!opt_counters) {
+        return;
+    }
+#ifdef HAVE_PERF
+    for (i = 0; i < NR_CTRS; ++i) {
+        memset(&attr, 0, sizeof (attr));
+        attr.size = sizeof (attr);
+        attr.type = ctr_defs[i].type;
+        attr.config = ctr_defs[i].config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        ctr_fd[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (ctr_fd[i] < 0 && ctr_errno == 0) {
+            ctr_errno = errno;
+        }
+    }
+#else
+    ctr_errno = ENOSYS;
+#endif
+}
+
+static bool
+counters_any(void)
+{
+    size_t i;
+
+    for (i = 0; i < NR_CTRS; ++i) {
+        if (ctr_fd[i] >= 0) {
+            return (true);
+        }
+    }
+    return (false);
+}
+
+/*
+ * Why there are no counters, in words.
+ */
+static const char *
+counters_why(void)
+{
+    if (!opt_counters) {
+        return ("not asked for");
+    }
+    switch (ctr_errno) {
+    case EACCES:
+    case EPERM:
+        return ("not permitted; see kernel.perf_event_paranoid");
+    case ENOENT:
+    case EOPNOTSUPP:
+        return ("this CPU, or virtual machine, has none");
+    case ENOSYS:
+        return ("perf_event_open() is not supported");
+    default:
+        return (strerror(ctr_errno));
+    }
+}
+
+static void
+counters_start(void)
+{
+#ifdef HAVE_PERF
+    size_t i;
+
+    for (i = 0; i < NR_CTRS; ++i) {
+        if (ctr_fd[i] >= 0) {
+            ioctl(ctr_fd[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(ctr_fd[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+#endif
+}
+
+/*
+ * Stop counting, and read the counters.  A counter that had to share
+ * the hardware with others is scaled up to the whole time;
+ * one that never got to count at all is not valid.
+ */
+static void
+counters_stop(struct counters *cp)
+{
+#ifdef HAVE_PERF
+    uint64_t rd[3];     // value, time enabled, time running
+#endif
+    size_t i;
+
+    for (i = 0; i < NR_CTRS; ++i) {
+        cp->valid[i] = false;
+        cp->value[i] = 0;
+    }
+#ifdef HAVE_PERF
+    for (i = 0; i < NR_CTRS; ++i) {
+        if (ctr_fd[i] >= 0) {
+            ioctl(ctr_fd[i], PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+    for (i = 0; i < NR_CTRS; ++i) {
+        if (ctr_fd[i] < 0 || read(ctr_fd[i], rd, sizeof (rd)) != sizeof (rd) || rd[2] == 0) {
+            continue;
+        }
+        cp->valid[i] = true;
+        cp->value[i] = (rd[2] < rd[1]) ? (uint64_t)((double)rd[0] * rd[1] / rd[2]) : rd[0];
+    }
+#endif
+}
+
+static void
+counters_close(void)
+{
+    size_t i;
+
+    for (i = 0; i < NR_CTRS; ++i) {
+        if (ctr_fd[i] >= 0) {
+            close(ctr_fd[i]);
+            ctr_fd[i] = -1;
+        }
+    }
+}
+
+/*
+ * A string, as JSON, for the few strings that are shown.
+ */
+static void
+json_str(const char *str)
+{
+    const char *p;
+
+    putchar('"');
+    for (p = str; *p; ++p) {
+        if (*p == '"' || *p == '\\') {
+            putchar('\\');
+        }
+        if ((unsigned char)*p >= 0x20) {
+            putchar(*p);
+        }
+    }
+    putchar('"');
+}
+
+static void
+show_machine(void)
+{
+    char line[256];
+    char *model;
+    const char *engine;
+    size_t eidx;
+    size_t i;
+    bool first;
+    FILE *f;
+
+    model = NULL;
+    f = fopen("/proc/cpuinfo", "r");
+    while (f != NULL && fgets(line, sizeof (line), f) != NULL) {
+        if (strncmp(line, "model name", 10) == 0 && strchr(line, ':') != NULL) {
+            model = strchr(line, ':') + 1;
+            model += strspn(model, " \t");
+            model[strcspn(model, "\n")] = '\0';
+            break;
+        }
+    }
+    if (f != NULL) {
+        fclose(f);
+    }
+
+    printf("{\"schema\":\"textbounds-bench/1\",\n");
+    printf(" \"cpu\":");
+    json_str(model != NULL ? model : "unknown");
+    printf(",\n \"compiler\":");
+    json_str(__VERSION__);
+    printf(",\n \"cycle_counter\":%s,\n",
+        ctr_fd[CTR_CYCLES] >= 0 ? "\"perf\"" : cycles() != 0 ? "\"tsc\"" : "null");
+    printf(" \"engines\":[");
+    for (eidx = 0; (engine = text_bounds_engine_list(eidx)) != NULL; ++eidx) {
+        printf("%s", eidx > 0 ? "," : "");
+        json_str(engine);
+    }
+    printf("],\n \"default_engine\":");
+    json_str(text_bounds_get_engine());
+    printf(",\n \"counters\":");
+    if (counters_any()) {
+        first = true;
+        printf("[");
+        for (i = 0; i < NR_CTRS; ++i) {
+            if (ctr_fd[i] >= 0) {
+                printf("%s", first ? "" : ",");
+                json_str(ctr_names[i]);
+                first = false;
+            }
+        }
+        printf("]");
+    }
+    else {
+        printf("null,\n \"counters_error\":");
+        json_str(counters_why());
+    }
+    printf(",\n \"seed\":%llu,\n \"size\":%zu,\n \"results\":[\n",
+        (unsigned long long)opt_seed, opt_size);
+}
+
+/*
+ * The fastest of the runs of one shape, with one engine.
+ */
+struct bench {
+    textbox_t box;
+    size_t runs;
+    double secs;
+    uint64_t tsc;
+    struct counters ctrs;
+};
+
+/*
+ * Measure one shape with one engine, as many times as it takes.
+ */
+static void
+bench_one(const struct shape *sh, const char *buf, size_t sz, struct bench *bp)
+{
+    struct counters ctrs;
+    textbox_t box;
+    double start;
+    double t0;
+    double t1;
+    uint64_t c0;
+    uint64_t c1;
+    size_t runs;
+
+    memset(bp, 0, sizeof (*bp));
+    start = now();
+    for (runs = 0; runs < 3 || now() - start < opt_min_time; ++runs) {
+        box = (textbox_t) { 0 };
+        box.utf8 = sh->utf8;
+        box.eol = sh->eol;
+        t0 = now();
+        c0 = cycles();
+        counters_start();
+        text_bounds_buf(buf, sz, &box);
+        counters_stop(&ctrs);
+        c1 = cycles();
+        t1 = now();
+        if (runs == 0 || t1 - t0 < bp->secs) {
+            bp->secs = t1 - t0;
+            bp->tsc = c1 - c0;
+            bp->ctrs = ctrs;
+        }
+    }
+    bp->box = box;
+    bp->runs = runs;
+}
+
+static void
+show_counter(const struct counters *cp, uint_t ctr)
+{
+    printf(",\"%s\":", ctr_names[ctr]);
+    if (cp->valid[ctr]) {
+        printf("%llu", (unsigned long long)cp->value[ctr]);
+    }
+    else {
+        printf("null");
+    }
+}
+
+static void
+show_bench(const struct shape *sh, const char *engine, size_t sz,
+    const struct bench *bp, bool first)
+{
+    const struct counters *cp = &bp->ctrs;
+    const textbox_t *box = &bp->box;
+    double secs;
+    uint64_t ncycles;
+    uint_t ctr;
+
+    secs = (bp->secs > 0) ? bp->secs : 1e-9;
+    // Core cycles, if they can be counted; else, ticks of the TSC
+    ncycles = cp->valid[CTR_CYCLES] ? cp->value[CTR_CYCLES] : bp->tsc;
+    printf("%s  {\"shape\":\"%s\",\"engine\":\"%s\",\"bytes\":%zu,\"lines\":%zu,"
+        "\"columns\":%zu,\"runs\":%zu,\"seconds\":%.6f,\"gb_per_s\":%.3f,"
+        "\"ns_per_line\":%.3f,\"bytes_per_cycle\":",
+        first ? "" : ",\n", sh->name, engine, sz, box->lines, box->columns,
+        bp->runs, secs, sz / secs / 1e9, box->lines > 0 ? secs * 1e9 / box->lines : 0.0);
+    if (ncycles != 0) {
+        printf("%.3f", (double)sz / ncycles);
+    }
+    else {
+        printf("null");
+    }
+    printf(",\"counters\":");
+    if (!counters_any()) {
+        printf("null}");
+        return;
+    }
+    printf("{\"ipc\":");
+    if (cp->valid[CTR_CYCLES] && cp->valid[CTR_INSTRUCTIONS] && cp->value[CTR_CYCLES] != 0) {
+        printf("%.3f", (double)cp->value[CTR_INSTRUCTIONS] / cp->value[CTR_CYCLES]);
+    }
+    else {
+        printf("null");
+    }
+    for (ctr = 0; ctr < NR_CTRS; ++ctr) {
+        show_counter(cp, ctr);
+    }
+    printf("}}");
+}
+
+static int
+bench_shape(const struct shape *sh, const char *buf, size_t sz, bool *firstp)
+{
+    struct bench b;
+    textbox_t ref;
+    const char *engine;
+    size_t eidx;
+    bool have_ref;
+    int err;
+
+    err = 0;
+    ref = (textbox_t) { 0 };
+    have_ref = false;
+    for (eidx = 0; (engine = text_bounds_engine_list(eidx)) != NULL; ++eidx) {
+        if (opt_engine != NULL && strcmp(engine, opt_engine) != 0) {
+            continue;
+        }
+        text_bounds_set_engine(engine);
+        bench_one(sh, buf, sz, &b);
+        if (!have_ref) {
+            ref = b.box;
+            have_ref = true;
+        }
+        else if (b.box.lines != ref.lines || b.box.columns != ref.columns) {
+            fprintf(stderr, "%s: %s, %s: %zux%zu, but %zux%zu with %s\n",
+                program_name, sh->name, engine, b.box.columns, b.box.lines,
+                ref.columns, ref.lines, text_bounds_engine_list(0));
+            ++err;
+        }
+        show_bench(sh, engine, sz, &b, *firstp);
+        fflush(stdout);
+        *firstp = false;
+    }
+    return (err);
+}
+
+/*
+ * --size: a number of bytes, with K, M or G for binary multiples.
+ */
+static int
+parse_size(const char *str, size_t *sizep)
+{
+    unsigned long long v;
+    char *end;
+
+    errno = 0;
+    v = strtoull(str, &end, 10);
+    switch (*end) {
+    case 'G':
+        v <<= 10;
+        // fall through
+    case 'M':
+        v <<= 10;
+        // fall through
+    case 'K':
+        v <<= 10;
+        ++end;
+        break;
+    }
+    if (errno != 0 || end == str || *end != '\0' || v == 0) {
+        fprintf(stderr, "%s: Invalid --size, '%s'\n", program_name, str);
+        return (1);
+    }
+    *sizep = (size_t)v;
+    return (0);
+}
+
+static int
+write_corpus(const struct shape *sh, const char *buf, size_t sz)
+{
+    char path[4096];
+    FILE *f;
+
+    snprintf(path, sizeof (path), "%s/%s.txt", opt_corpus, sh->name);
+    f = fopen(path, "w");
+    if (f == NULL || fwrite(buf, 1, sz, f) != sz || fclose(f) != 0) {
+        fprintf(stderr, "%s: '%s': %s\n", program_name, path, strerror(errno));
+        return (1);
+    }
+    return (0);
+}
+
+static struct option long_options[] = {
+    {"help",    no_argument,       0, 'h'},
+    {"size",    required_argument, 0, 's'},
+    {"seed",    required_argument, 0, 'S'},
+    {"time",    required_argument, 0, 't'},
+    {"shape",   required_argument, 0, 'p'},
+    {"engine",  required_argument, 0, 'e'},
+    {"corpus",  required_argument, 0, 'c'},
+    {"no-counters", no_argument,   0, 'C'},
+    {0, 0, 0, 0}
+};
+
+int
+main(int argc, char **argv)
+{
+    const struct shape *sh;
+    struct gen g;
+    size_t i;
+    bool first;
+    int optc;
+    int rv;
+
+    program_path = *argv;
+    program_name = sname(program_path);
+
+    rv = 0;
+    while ((optc = getopt_long(argc, argv, "h", long_options, NULL)) != -1) {
+        switch (optc) {
+        case 'h':
+            fputs(usage_text, stdout);
+            exit(0);
+        case 's':
+            rv |= parse_size(optarg, &opt_size);
+            break;
+        case 'S':
+            opt_seed = strtoull(optarg, NULL, 10);
+            break;
+        case 't':
+            opt_min_time = atof(optarg);
+            break;
+        case 'p':
+            opt_shape = optarg;
+            break;
+        case 'e':
+            opt_engine = optarg;
+            break;
+        case 'c':
+            opt_corpus = optarg;
+            break;
+        case 'C':
+            opt_counters = false;
+            break;
+        default:
+            rv = 1;
+            break;
+        }
+    }
+    if (rv != 0 || optind != argc) {
+        fputs(usage_text, stderr);
+        exit(2);
+    }
+
+    g.size = opt_size;
+    g.buf = malloc(g.size);
+    if (g.buf == NULL) {
+        fprintf(stderr, "%s: Out of memory.\n", program_name);
+        exit(2);
+    }
+
+    counters_open();
+    show_machine();
+    first = true;
+    for (i = 0; i < NR_SHAPES; ++i) {
+        sh = &shapes[i];
+        if (opt_shape != NULL && strcmp(sh->name, opt_shape) != 0) {
+            continue;
+        }
+        // Each shape has its own sequence, whatever other shapes are run
+        rng_state = opt_seed * 0x100000001b3ULL + i;
+        g.len = 0;
+        sh->gen(&g);
+        if (opt_corpus != NULL && write_corpus(sh, g.buf, g.len) != 0) {
+            rv = 2;
+            break;
+        }
+        if (bench_shape(sh, g.buf, g.len, &first) != 0) {
+            rv = 1;
+        }
+    }
+    printf("\n]}\n");
+    counters_close();
+    free(g.buf);
+    return (rv);
+}
@@ -0,0 +1,43 @@
+# Filename: src/config.mk
+# Project: textbounds
+# Brief: Optional libraries, found by looking for their headers
+#
+# Included by the Makefiles of libtextbounds, and of the programs
+# that link with it.  Any of these can be set on the command line,
+# to 1 or to nothing, to build with or without a library regardless.
+#
+# Copyright (C) 2019 Guy Shaw
+# Written by Guy Shaw <gshaw@acm.org>
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as
+# published by the Free Software Foundation; either version 3 of the
+# License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+hash := \#
+have-header = $(shell echo '$(hash)include <$(1)>' | $(CC) -E -x c - >/dev/null 2>&1 && echo 1)
+
+HAVE_ZLIB ?= $(call have-header,zlib.h)
+HAVE_LZMA ?= $(call have-header,lzma.h)
+HAVE_ZSTD ?= $(call have-header,zstd.h)
+
+ifeq ($(HAVE_ZLIB),1)
+CONFIG_CPPFLAGS += -DHAVE_ZLIB
+CONFIG_LDLIBS += -lz
+endif
+ifeq ($(HAVE_LZMA),1)
+CONFIG_CPPFLAGS += -DHAVE_LZMA
+CONFIG_LDLIBS += -llzma
+endif
+ifeq ($(HAVE_ZSTD),1)
+CONFIG_CPPFLAGS += -DHAVE_ZSTD
+CONFIG_LDLIBS += -lzstd
+endif
@@ -30,6 +30,12 @@ extern "C" {
     // Import type bool
 #include <unistd.h>
     // Import type size_t
+#include <sys/types.h>
+    // Import type off_t
+#include <stdint.h>
+    // Import type uint64_t
+#include <stdio.h>
+    // Import type FILE
 
 typedef unsigned int uint_t;
 
@@ -40,12 +46,58 @@ typedef unsigned int uint_t;
  * .getchr_arg
  *   Argument passed to .getchr().  Optional.  Can be NULL
  *
+ * .getbuf
+ *   Iterator: provides the next span of the text box.
+ *   Sets *bufp to point to the span and returns its size in bytes.
+ *   Returns 0 at end of text.  The span need only remain valid
+ *   until the next call to .getbuf().
+ *   Optional.  If not NULL, it is used instead of .getchr(),
+ *   and text_bounds() runs over whole spans at a time, rather than
+ *   making one indirect call per character.
+ *
+ * .getbuf_arg
+ *   Argument passed to .getbuf().  Optional.  Can be NULL
+ *
+ * .measure:
+ *   Which results are wanted: TB_MEASURE_LINES, TB_MEASURE_COLUMNS,
+ *   or both.  Zero means both.  The less that is wanted, the less
+ *   work there is to do: counting lines alone is just counting newlines,
+ *   and TB_MEASURE_NONE does not even read the text.
+ *   Results that are not wanted are left as they are.
+ *   TB_MEASURE_DIST asks for the distribution of line widths, too;
+ *   see .hist, below.
+ *
+ * .max_lines, .max_columns:
+ *   Limits of the box that the text has to fit in; zero means no limit.
+ *   Measurement stops as soon as the text is known not to fit,
+ *   so the results are then only as far as measurement got.
+ *
  * .tws:
  *   Does trailing whitespace count
  *   for purposes of measuring text bounds?
  *   If not, then only the last non-white space character
  *   is used to compute the length of every line.
  *
+ * .tabs:
+ *   Tab stops, made by text_bounds_tabs(), below.
+ *   NULL means a tab stop every 8 columns.
+ *
+ * .eol:
+ *   What ends a line: TB_EOL_LF (the default), TB_EOL_CRLF, TB_EOL_CR,
+ *   TB_EOL_NUL, or TB_EOL_AUTO, to choose between LF, CRLF and CR
+ *   from the first block of text.  With CRLF, a LF by itself
+ *   also ends a line, and a CR that is not followed by LF is just
+ *   another character.  With CR or NUL, a LF is just another character.
+ *
+ * .utf8:
+ *   The text is UTF-8, and columns are terminal display cells:
+ *   zero for combining marks and format controls, two for East Asian
+ *   wide and fullwidth characters and most emoji, one for the rest.
+ *   Bytes that are not valid UTF-8 take one cell each; that includes
+ *   every byte of an overlong, out-of-range, surrogate or cut-short
+ *   sequence.
+ *   ASCII is measured exactly as it is without .utf8.
+ *
  * .lines:
  *   Update the number of lines,
  *   AKA the height of the text box area
@@ -55,10 +107,75 @@ typedef unsigned int uint_t;
  *   AKA the maximum line length,
  *   AKA the width of the text box area
  *
+ * .overflow:
+ *   Result: the text does not fit within .max_lines and .max_columns
+ *
+ * .widest_line, .widest_offset:
+ *   Result, with .columns: the line number, counting from 1,
+ *   and the byte offset of the start of the widest line.
+ *   If more than one line is that wide, the first of them.
+ *   Offsets count from the start of the text measured by this call.
+ *   Left as they were, if no line is any wider than .columns
+ *   was to begin with.
+ *
+ * .hist:
+ *   If not NULL, the width of every line is added to this histogram
+ *   (see text_bounds_hist_new(), below), and .dist summarizes it,
+ *   once the text ends.  The last line, if it is not terminated,
+ *   is added by text_bounds_finish(); so, with a histogram,
+ *   call text_bounds_finish() just once.
+ *
+ *   text_bounds_file(), and the functions that measure lists of files,
+ *   work a little differently.  With TB_MEASURE_DIST, each file
+ *   is measured with a histogram of its own, so that .dist describes
+ *   just that file; then, that histogram is merged into .hist, if given.
+ *   So, one histogram can be shared by files measured at the same time,
+ *   to get the distribution over all of them.
+ *
+ * .dist:
+ *   Result: the distribution of line widths; see struct tbdist, below.
+ *
+ * .index:
+ *   If not NULL, a directory of sidecar indexes, used by text_bounds_fd()
+ *   for regular files: the results so far are saved, and the next time,
+ *   only text appended since then is measured.  The results are then
+ *   for the file alone, not added to what is in the textbox.
+ *   Not used with limits, or with TB_MEASURE_DIST.
+ *   See textbounds-index.c.
+ *
+ * .cache:
+ *   If not NULL, text_bounds_file() takes the results for a regular file
+ *   from this cache, if they are there, and puts them there, if not.
+ *   See text_bounds_cache_open(), below.  Not used with TB_MEASURE_DIST.
+ *
+ * .decompress:
+ *   If true, text_bounds_fd() tells text compressed with gzip, xz
+ *   or zstd by its magic number, and measures the text it decodes to.
+ *   Decoding is done on a thread of its own, while measuring
+ *   goes on in the calling thread; any other threads are not used.
+ *   Compressed text is not indexed.
+ *
+ * .zstat:
+ *   Result, for compressed text: the format, the size of the text,
+ *   compressed and decoded, and the time it took.  Left as it was,
+ *   for text that is not compressed.
+ *
+ * .stats, .fstat:
+ *   With .stats, text_bounds_file(), and the functions that measure
+ *   lists of files, time the work on each file, and count its system
+ *   calls and the bytes read; see struct tbfstat.  Time that I/O
+ *   overlaps with measuring -- with threads, with a decoder,
+ *   or for mapped files, faulted in as they are scanned --
+ *   counts as measuring.  With io_uring, time waiting for the ring
+ *   counts as reading, and opening is not told apart from it.
+ *   Without .stats, none of this costs anything.
+ *
  * Measuring text bounds can be done incrementally.
  * That is, multiple calls to textbounds() can be used to continue
  * measuring text in parts.  The fields, .lines and .columns
  * do not get zeroed out when textboounds() is called.
+ * Each call ends at a line boundary; to split text anywhere,
+ * including in the middle of a line, use text_bounds_feed(), below.
  *
  * It is the responsibility of the caller to provide initial
  * values for  .lines and .columns.  It is assumed that the most
@@ -73,19 +190,122 @@ typedef unsigned int uint_t;
  *
  * .fmt_options:
  *   Options --name , --lines , --columns
+ *
+ * Fields that are not used should be zero.
+ * That way, new fields can be added without disturbing old callers.
+ */
+
+/*
+ * Histogram of line widths.
+ *
+ * Widths up to a few thousand columns are counted exactly;
+ * wider lines are counted in buckets no wider than 1/64th
+ * of the widths they hold.  So, memory is bounded, whatever the text,
+ * and quantiles of wide lines are within 1/64th of the exact answer.
+ * Histograms are merged by adding counts, so the histograms
+ * of parts of a text, or of several texts, merge into exactly
+ * the histogram of the whole.
+ *
+ * text_bounds_hist_merge() adds src into dst.  It is safe to merge
+ * into the same histogram from several threads at once.
+ *
+ * text_bounds_hist_quantile() returns the smallest width, w, such that
+ * at least a fraction q of all lines are no wider than w.
+ *
+ * text_bounds_hist_bin() iterates over the bins that are not empty:
+ * starting with *idxp == 0, each call returns the range of widths
+ * and the count of one bin, until it returns false.
+ */
+typedef struct tbhist tbhist_t;
+
+struct tbdist {
+    size_t lines;       // Lines counted
+    size_t max;         // Widest line
+    double mean;        // Mean width
+    size_t p50;         // Median width
+    size_t p90;
+    size_t p99;
+    size_t p999;
+};
+
+typedef struct tbdist tbdist_t;
+
+extern tbhist_t *text_bounds_hist_new(void);
+extern void text_bounds_hist_free(tbhist_t *hist);
+extern void text_bounds_hist_clear(tbhist_t *hist);
+extern void text_bounds_hist_merge(tbhist_t *dst, const tbhist_t *src);
+extern size_t text_bounds_hist_quantile(const tbhist_t *hist, double q);
+extern void text_bounds_hist_dist(const tbhist_t *hist, tbdist_t *dist);
+extern bool text_bounds_hist_bin(const tbhist_t *hist, size_t *idxp,
+                size_t *lop, size_t *hip, size_t *countp);
+
+/*
+ * Cache of results, kept in a file from one run to the next,
+ * keyed by the identity of each file (device and inode), its size,
+ * mtime and ctime, and the options that the results depend on.
+ * text_bounds_file() looks a file up by stat() alone, and does not
+ * open it if the results are there.  One cache can be shared
+ * by any number of threads, and processes.
+ *
+ * text_bounds_cache_open() creates the file if need be; it returns
+ * NULL, with errno set, on failure.  See textbounds-cache.c.
  */
+typedef struct tbcache tbcache_t;
+
+extern tbcache_t *text_bounds_cache_open(const char *path);
+extern void text_bounds_cache_close(tbcache_t *cache);
+
+/*
+ * What it took to measure a compressed text.
+ */
+struct tbzstat {
+    const char *format; // "gzip", "xz" or "zstd"; NULL if not compressed
+    off_t  in;          // Bytes of compressed text read
+    off_t  out;         // Bytes of text it decoded to
+    double seconds;     // Time taken, decoding and measuring
+};
+
+/*
+ * Where the time went, for one file; see .stats.
+ */
+struct tbfstat {
+    uint64_t open_ns;   // Opening, looking in the cache, closing
+    uint64_t read_ns;   // Waiting for read()
+    uint64_t measure_ns;    // Everything else: scanning the text
+    uint64_t bytes;     // Bytes of text read, or mapped
+    uint_t   syscalls;  // System calls, or io_uring requests
+};
 
 struct textbox {
     // input stream
     int (*getchr)(void *);
     void *getchr_arg;
+    size_t (*getbuf)(void *, const char **bufp);
+    void *getbuf_arg;
 
     // Options governing how measuremnet is done
     bool   tws;         // trailing white space counts
+    bool   utf8;        // columns are display cells of UTF-8 text
+    const struct tbtabs *tabs;  // tab stops; NULL for every 8 columns
+    uint_t eol;         // TB_EOL_*; what ends a line
+    uint_t measure;     // TB_MEASURE_*; 0 means everything
+    size_t max_lines;   // Stop if the text is taller than this; 0 for no limit
+    size_t max_columns; // Stop if the text is wider than this; 0 for no limit
+    const char *index;  // Directory of sidecar indexes, if not NULL
+    tbcache_t *cache;   // Results of earlier runs, if not NULL
+    bool   decompress;  // Decode gzip, xz and zstd text; see .zstat
+    bool   stats;       // Time and count the work; see .fstat
 
     // Results
     size_t lines;       // Result: how many lines
     size_t columns;     // Result: how many columns
+    bool   overflow;    // Result: does not fit within the limits
+    size_t widest_line; // Result: line number of the widest line
+    off_t  widest_offset;   // Result: where the widest line starts
+    tbhist_t *hist;     // Add the width of every line to this, if not NULL
+    tbdist_t dist;      // Result: distribution of line widths
+    struct tbzstat zstat;   // Result: for compressed text
+    struct tbfstat fstat;   // Result: with .stats, where the time went
 
     // Options for formatting results
     char *fmt;
@@ -94,6 +314,312 @@ struct textbox {
 
 typedef struct textbox  textbox_t;
 
+/*
+ * Tab stops.
+ *
+ * text_bounds_tabs() makes tab stops from a specification,
+ * like that of expand -t: either a single number, for a tab stop
+ * every that many columns, or a list of columns, in increasing order,
+ * separated by commas.  Past the last tab stop in a list,
+ * a tab advances just one column.
+ * Return NULL, with errno set, if the specification is not valid.
+ *
+ * A tbtabs_t can be shared by any number of textboxes, and threads,
+ * until it is freed with text_bounds_tabs_free().
+ */
+typedef struct tbtabs tbtabs_t;
+
+extern tbtabs_t *text_bounds_tabs(const char *spec);
+extern void text_bounds_tabs_free(tbtabs_t *tabs);
+
+#define TB_EOL_LF           0
+#define TB_EOL_CRLF         1
+#define TB_EOL_CR           2
+#define TB_EOL_NUL          3
+#define TB_EOL_AUTO         4
+
+#define TB_MEASURE_LINES    0x0001
+#define TB_MEASURE_COLUMNS  0x0002
+#define TB_MEASURE_ALL      (TB_MEASURE_LINES | TB_MEASURE_COLUMNS)
+#define TB_MEASURE_DIST     0x0004
+#define TB_MEASURE_NONE     0x0100
+
+/*
+ * Streaming measurement.
+ *
+ * A tbscan_t carries the state of a measurement from one call
+ * to the next, including the state of the line still in progress.
+ * So, text can be fed in chunks of any size, split anywhere,
+ * even in the middle of a line or right after a tab.
+ *
+ * text_bounds_start()
+ *   Begin a measurement.  Options and the initial values
+ *   of .lines and .columns are taken from the given textbox.
+ *
+ * text_bounds_feed()
+ *   Measure the next chunk of text.
+ *   Return false if the text is already known not to fit within
+ *   the limits, .max_lines and .max_columns; there is then no point
+ *   in feeding any more.
+ *
+ * text_bounds_finish()
+ *   Store results in the given textbox, as if the text ended here.
+ *   The stream itself is not changed, so more text can be fed,
+ *   and text_bounds_finish() can be called again, later.
+ *
+ * The fields of a tbscan_t are private to libtextbounds.
+ */
+
+struct tbscan {
+    size_t lnr;
+    size_t col;       /* last column - even if just whitespace */
+    size_t inkcol;    /* last non-whitespace column */
+    size_t maxcol;
+    size_t maxlnr;    /* line number of the widest line */
+    off_t  maxoff;    /* where the widest line starts */
+    off_t  off;       /* offset of the text being scanned */
+    off_t  linestart; /* where the line in progress starts */
+    bool   tws;
+    bool   utf8;
+    const struct tbtabs *tabs;
+    uint_t eol;       /* TB_EOL_*; AUTO until there is text to look at */
+    bool   cr;        /* CRLF: a CR at the end of the last span, pending */
+    uint_t u8need;    /* continuation bytes still to come */
+    uint_t u8cp;      /* code point, so far */
+    uint_t u8min;     /* smallest code point for this length */
+    uint_t measure;
+    struct tbhist *hist;
+    size_t max_lines;
+    size_t max_columns;
+    bool   overflow;
+};
+
+typedef struct tbscan tbscan_t;
+
+extern void text_bounds(textbox_t *ctxp);
+extern void text_bounds_buf(const char *buf, size_t sz, textbox_t *ctxp);
+extern void text_bounds_start(tbscan_t *sp, const textbox_t *ctxp);
+extern bool text_bounds_feed(tbscan_t *sp, const char *buf, size_t sz);
+extern void text_bounds_finish(const tbscan_t *sp, textbox_t *ctxp);
+
+/*
+ * Measure one buffer, or one file, on up to nthreads threads.
+ * Results are exactly the same as measuring serially.
+ * text_bounds_fd_parallel() returns 0 on success, or an errno value.
+ */
+extern void text_bounds_buf_parallel(const char *buf, size_t sz, textbox_t *ctxp, uint_t nthreads);
+extern int  text_bounds_fd_parallel(int fd, size_t sz, textbox_t *ctxp, uint_t nthreads);
+
+/*
+ * Measure an open file, from its current position.
+ * Regular files are mapped into memory, or, with .index, measured
+ * only past where the index ends; anything else is read().
+ * Return 0 on success, or an errno value.
+ */
+extern int  text_bounds_fd(int fd, textbox_t *ctxp, uint_t nthreads);
+
+/*
+ * Does the text of an open file fit in a box, columns wide
+ * and lines high?  Zero means no limit.  Reading stops as soon
+ * as the answer is known.
+ * Return 0 if it fits, 1 if it does not, or -1, with errno set, on error.
+ */
+extern int  text_bounds_fits(int fd, size_t columns, size_t lines);
+
+/*
+ * One file in a list of files to be measured.
+ *
+ * .fname   Name of the file; "-" means stdin
+ * .box     Options in, results out
+ * .size    Size, if a regular file; used for scheduling
+ * .err     errno value, if measuring the file failed
+ * .errop   The operation that failed, "fopen" or "read";
+ *          see also text_bounds_walk()
+ * .done    Measurement is finished
+ */
+struct tbfile {
+    const char *fname;
+    textbox_t  box;
+    off_t      size;
+    int        err;
+    const char *errop;
+    bool       done;
+};
+
+typedef struct tbfile tbfile_t;
+
+typedef void (*tbfile_report_fn)(tbfile_t *fp, void *arg);
+
+extern int  text_bounds_file(tbfile_t *fp, uint_t nthreads);
+extern int  text_bounds_filev_jobs(size_t filec, tbfile_t *files,
+                uint_t njobs, uint_t nthreads, bool ordered,
+                tbfile_report_fn report, void *report_arg);
+extern int  text_bounds_filev_uring(size_t filec, tbfile_t *files, bool ordered,
+                tbfile_report_fn report, void *report_arg);
+
+/*
+ * Measure every regular file in the directory trees under paths,
+ * using njobs threads, each of which both lists directories
+ * and measures the files in them; see textbounds-walk.c.
+ * Paths that are not directories are measured as they are.
+ * Each file is measured with the options in proto->box,
+ * and reported as soon as it is done, one at a time,
+ * in no particular order; .fname is good only until report returns.
+ * A directory that cannot be listed is reported, too,
+ * with .errop "opendir" or "readdir".
+ *
+ * Symbolic links are not followed, unless flags has TB_WALK_FOLLOW;
+ * with TB_WALK_XDEV, a tree is not followed onto another file system.
+ * Return 0 on success, or 2 if any file or directory failed.
+ */
+#define TB_WALK_FOLLOW  0x0001
+#define TB_WALK_XDEV    0x0002
+
+extern int  text_bounds_walk(size_t pathc, char **paths, const tbfile_t *proto,
+                uint_t njobs, uint_t flags, tbfile_report_fn report, void *report_arg);
+
+/*
+ * Follow a list of files as they grow, like tail -F.
+ *
+ * text_bounds_follow_new() opens and measures each file, and keeps it
+ * open, with the scan state at its end.  text_bounds_follow_poll()
+ * waits up to timeout_ms (forever, if negative) for any of them
+ * to change; then, only the text appended since is measured.
+ * A file that is truncated, or replaced by a new file of the same name,
+ * is measured again from the start.  Each file that changed is reported,
+ * if report is not NULL; text_bounds_follow_poll() returns how many
+ * there were, or -1 on error.  .box of each file is always up to date.
+ * The width distribution, and .index, are not used.
+ * See textbounds-follow.c.
+ */
+typedef struct tbfollow tbfollow_t;
+
+extern tbfollow_t *text_bounds_follow_new(size_t filec, tbfile_t *files);
+extern int  text_bounds_follow_poll(tbfollow_t *fw, int timeout_ms,
+                tbfile_report_fn report, void *report_arg);
+extern void text_bounds_follow_free(tbfollow_t *fw);
+
+/*
+ * Showing results; see textbounds-out.c.
+ *
+ * text_bounds_format_compile() compiles a format, as for --format,
+ * once, for any number of results: %f is the file name, %l the lines,
+ * %c the columns, %L and %o the line number and offset of the widest
+ * line, and %{mean}, %{p50}, %{p90}, %{p99}, %{p999} describe
+ * the distribution of line widths.  Each result ends with a newline.
+ * Return NULL, with errno set, on failure.
+ * text_bounds_format_measure() tells what the format shows (TB_MEASURE_*),
+ * so that nothing else need be measured.
+ *
+ * A tbout_t collects output for a file descriptor in a large buffer.
+ * If the file descriptor is a terminal, each result is written out
+ * as soon as it is shown; otherwise, only when the buffer is full,
+ * or by text_bounds_out_flush().  Both that and text_bounds_out_free()
+ * return -1, with errno set, if any write has failed.
+ * text_bounds_out_writes() tells how many system calls writing took.
+ * Nothing else should write to the same file descriptor,
+ * except just after text_bounds_out_flush().
+ */
+typedef struct tbformat tbformat_t;
+typedef struct tbout tbout_t;
+
+extern tbformat_t *text_bounds_format_compile(const char *str);
+extern void text_bounds_format_free(tbformat_t *fmt);
+extern uint_t text_bounds_format_measure(const tbformat_t *fmt);
+
+extern tbout_t *text_bounds_out_new(int fd);
+extern void text_bounds_out_format(tbout_t *out, const tbformat_t *fmt,
+                const char *fname, const textbox_t *txt);
+extern void text_bounds_out_write(tbout_t *out, const char *str, size_t len);
+extern void text_bounds_out_uint(tbout_t *out, uint64_t v);
+extern int  text_bounds_out_flush(tbout_t *out);
+extern int  text_bounds_out_free(tbout_t *out);
+extern uint64_t text_bounds_out_writes(const tbout_t *out);
+
+/*
+ * Results for programs to read, rather than people.
+ *
+ * TB_OUTPUT_JSONL: a JSON object on a line of its own for each file:
+ *   "file", "lines", "columns", "widest_line", "widest_offset";
+ *   "mean", "p50", "p90", "p99", "p999", if the distribution
+ *   of line widths was measured; and "error", if measuring failed.
+ *   A name that is not UTF-8 has U+FFFD for each byte that is not,
+ *   and "file_hex", the name exactly, in hex.  With fname NULL,
+ *   the results are for all files: "total" is true, and there is no "file".
+ *
+ * TB_OUTPUT_CSV: a header line, then the same fields for each file,
+ *   in that order, always all of them, some of them empty.
+ *
+ * TB_OUTPUT_BINARY: a header of TB_REC_HEADER bytes, the magic number,
+ *   then the record size and TB_REC_VERSION, as 32-bit numbers;
+ *   then a record of TB_REC_SIZE bytes for each file.  Names go
+ *   in a path table, written to paths, each one ending in NUL.
+ *   Every number is little-endian:
+ *
+ *      0  u64  Offset of the name in the path table
+ *      8  u32  Length of the name
+ *     12  u32  Flags: TB_REC_ERROR, TB_REC_DIST
+ *     16  u64  Lines
+ *     24  u64  Columns
+ *     32  u64  Line number of the widest line
+ *     40  i64  Offset of the widest line
+ *     48  u32  errno value, with TB_REC_ERROR
+ *     52  u32  Zero
+ *     56  f64  Mean width, with TB_REC_DIST
+ *     64  u64  p50, p90, p99, p999, with TB_REC_DIST
+ *
+ * text_bounds_out_begin() writes the header, if there is one;
+ * text_bounds_out_record() writes the results for one file.
+ * err is the errno value, if measuring failed, or 0.
+ */
+#define TB_OUTPUT_TEXT      0
+#define TB_OUTPUT_JSONL     1
+#define TB_OUTPUT_CSV       2
+#define TB_OUTPUT_BINARY    3
+
+#define TB_REC_MAGIC        "TBOUNDS\0"
+#define TB_REC_HEADER       16
+#define TB_REC_SIZE         96
+#define TB_REC_VERSION      1
+
+#define TB_REC_ERROR        0x0001
+#define TB_REC_DIST         0x0002
+
+extern void text_bounds_out_begin(tbout_t *out, uint_t kind);
+extern void text_bounds_out_record(tbout_t *out, uint_t kind, tbout_t *paths,
+                const char *fname, const textbox_t *txt, int err);
+
+/*
+ * Where the time went, over all files; see textbounds-stats.c.
+ *
+ * text_bounds_stats_add() adds the .fstat of one file, measured
+ * with .stats; its latency is the sum of its phases.
+ * text_bounds_stats_format() adds time spent showing results.
+ * text_bounds_stats_show() writes a summary, each line starting
+ * with prefix: time in each phase, summed over files, which may
+ * overlap, with threads or io_uring; files, bytes
+ * and throughput, over wall_ns; system calls, with the writes
+ * that output took; peak RSS; latency p50, p99 and max;
+ * and the nslowest slowest files, given to text_bounds_stats_new().
+ */
+typedef struct tbstats tbstats_t;
+
+extern tbstats_t *text_bounds_stats_new(size_t nslowest);
+extern void text_bounds_stats_add(tbstats_t *stats, const char *fname,
+                const struct tbfstat *fs, int err);
+extern void text_bounds_stats_format(tbstats_t *stats, uint64_t ns);
+extern void text_bounds_stats_show(const tbstats_t *stats, FILE *f, const char *prefix,
+                uint64_t wall_ns, uint64_t writes);
+extern void text_bounds_stats_free(tbstats_t *stats);
+
+/*
+ * Scan engines: "scalar", "sse2", "avx2", "avx512".
+ * The best one supported by the CPU is chosen automatically.
+ */
+extern int  text_bounds_set_engine(const char *name);
+extern const char *text_bounds_get_engine(void);
+extern const char *text_bounds_engine_list(size_t idx);
+
 #ifdef  __cplusplus
 }
 #endif
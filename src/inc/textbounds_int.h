@@ -0,0 +1,375 @@
+/*
+ * Filename: textbounds_int.h
+ * Brief: Internal definitions shared by the parts of libtextbounds
+ *
+ * Copyright (C) 2019 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _TEXTBOUNDS_INT_H
+#define _TEXTBOUNDS_INT_H
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+#include <textbounds.h>
+    // Import type tbscan_t, textbox_t
+#include <pthread.h>
+    // Import type pthread_mutex_t
+#include <stdint.h>
+    // Import type uint64_t
+#include <time.h>
+    // Import clock_gettime()
+
+/*
+ * Tab stops.  Every 8 columns is the default, and the fast path.
+ * Other regular widths are specialized for powers of 2.
+ * A list of tab stops is looked up: .next[col] is the first tab stop
+ * after col, for every col before the last tab stop.
+ */
+enum {
+    TB_TABS_8 = 0,
+    TB_TABS_POW2,
+    TB_TABS_REGULAR,
+    TB_TABS_LIST
+};
+
+struct tbtabs {
+    uint_t kind;
+    size_t width;       // Regular: a tab stop every width columns
+    size_t last;        // List: the last tab stop
+    size_t *next;       // List: lookup table
+};
+
+static inline uint_t
+tbtabs_kind(const struct tbtabs *tabs)
+{
+    return (tabs == NULL ? TB_TABS_8 : tabs->kind);
+}
+
+/*
+ * Width of regular tab stops, or 0 for a list.
+ */
+static inline size_t
+tbtabs_width(const struct tbtabs *tabs)
+{
+    if (tabs == NULL) {
+        return (8);
+    }
+    return (tabs->kind == TB_TABS_LIST ? 0 : tabs->width);
+}
+
+/*
+ * The column that a tab at col advances to.
+ * When kind is a constant, this boils down to just one case.
+ */
+static inline size_t
+tbtabs_next(const struct tbtabs *tabs, uint_t kind, size_t width, size_t col)
+{
+    switch (kind) {
+    case TB_TABS_8:
+        return ((col + 8) & ~(size_t)7);
+    case TB_TABS_POW2:
+        return ((col + width) & ~(width - 1));
+    case TB_TABS_REGULAR:
+        return (col + width - col % width);
+    default:
+        return (col < tabs->last ? tabs->next[col] : col + 1);
+    }
+}
+
+/*
+ * The byte that ends a line.
+ */
+static inline unsigned char
+tb_eol_byte(uint_t eol)
+{
+    switch (eol) {
+    case TB_EOL_CR:
+        return ('\r');
+    case TB_EOL_NUL:
+        return ('\0');
+    default:
+        return ('\n');
+    }
+}
+
+/*
+ * CRLF: a CR that ended the last span is followed by c.
+ * Unless c is the LF that makes it a line ending, it is one more column.
+ */
+static inline void
+tbscan_cr_resolve(struct tbscan *sp, unsigned char c)
+{
+    if (sp->cr) {
+        sp->cr = false;
+        if (c != '\n') {
+            ++sp->col;
+            sp->inkcol = sp->col;
+        }
+    }
+}
+
+/*
+ * Is a line in progress?  Any byte since the last line ending makes one,
+ * even if it takes no columns, as a UTF-8 zero-width character does.
+ * Count engines keep only .col, which is then non-zero for any byte.
+ */
+static inline bool
+tbscan_in_line(const struct tbscan *sp)
+{
+    if (sp->col > 0) {
+        return (true);
+    }
+    return (sp->measure != TB_MEASURE_LINES && sp->off > sp->linestart);
+}
+
+/*
+ * Histogram of line widths.  Widths below TB_HIST_EXACT
+ * have a counter each.  Wider lines are counted by their highest bit,
+ * and the TB_HIST_SUB_BITS bits below it.
+ */
+#define TB_HIST_EXACT_BITS  12
+#define TB_HIST_EXACT       (1 << TB_HIST_EXACT_BITS)
+#define TB_HIST_SUB_BITS    6
+#define TB_HIST_SUB         (1 << TB_HIST_SUB_BITS)
+#define TB_HIST_LOG         ((64 - TB_HIST_EXACT_BITS) * TB_HIST_SUB)
+
+struct tbhist {
+    pthread_mutex_t lock;   // Held while merging into this histogram
+    size_t lines;
+    size_t max;
+    uint64_t sum;
+    size_t exact[TB_HIST_EXACT];
+    size_t log[TB_HIST_LOG];
+};
+
+static inline void
+tbhist_add(struct tbhist *h, size_t width)
+{
+    uint_t msb;
+
+    ++h->lines;
+    h->sum += width;
+    if (width > h->max) {
+        h->max = width;
+    }
+    if (width < TB_HIST_EXACT) {
+        ++h->exact[width];
+        return;
+    }
+    msb = 63 - __builtin_clzll(width);
+    ++h->log[(msb - TB_HIST_EXACT_BITS) * TB_HIST_SUB
+        + ((width >> (msb - TB_HIST_SUB_BITS)) & (TB_HIST_SUB - 1))];
+}
+
+/*
+ * .stats: a monotonic clock, in nanoseconds; and one read(),
+ * that started at t0, and returned rsz.
+ */
+static inline uint64_t
+tb_clock_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+static inline void
+tbfstat_read(struct tbfstat *fs, uint64_t t0, ssize_t rsz)
+{
+    fs->read_ns += tb_clock_ns() - t0;
+    ++fs->syscalls;
+    if (rsz > 0) {
+        fs->bytes += rsz;
+    }
+}
+
+/*
+ * TB_EOL_AUTO: decide, from the first this much of the text,
+ * what ends a line.
+ */
+#define TB_EOL_PEEK  (64 * 1024)
+
+extern void tbscan_eol_detect(struct tbscan *sp, const char *buf, size_t sz);
+
+/*
+ * A scan engine measures one contiguous span of text,
+ * continuing from the state left behind by any previous span.
+ * Every engine must give exactly the same results.
+ */
+typedef void (*tbscan_fn)(struct tbscan *, const unsigned char *, size_t, bool);
+
+extern tbscan_fn tbscan_span;
+
+extern void tbscan_scalar(struct tbscan *sp, const unsigned char *buf, size_t sz, bool tws);
+
+/*
+ * A count engine only counts lines.  Of the rest of the scan state,
+ * it keeps only whether the line in progress is empty (.col == 0).
+ */
+extern tbscan_fn tbcount_span;
+
+extern void tbcount_scalar(struct tbscan *sp, const unsigned char *buf, size_t sz, bool tws);
+
+/*
+ * UTF-8.  Runs of ASCII go to the current scan engine, which
+ * measures ASCII exactly as it does in byte mode; everything else
+ * is decoded, and measured in terminal cells.
+ *
+ * tbascii_span() returns the length of the leading run of ASCII in buf.
+ * tbscan_u8flush() ends any incomplete sequence; each of its bytes takes one cell.
+ * tb_u8_complete() returns how much of buf can be measured without
+ * splitting a sequence that might be completed by the text that follows.
+ */
+typedef size_t (*tbascii_fn)(const unsigned char *, size_t);
+
+extern tbascii_fn tbascii_span;
+
+extern size_t tbascii_scalar(const unsigned char *buf, size_t sz);
+extern void tbscan_utf8(struct tbscan *sp, const unsigned char *buf, size_t sz, bool tws);
+extern void tbscan_u8flush(struct tbscan *sp);
+extern size_t tb_u8_complete(const unsigned char *buf, size_t sz);
+
+static inline tbscan_fn
+tbscan_engine(bool utf8)
+{
+    return (utf8 ? tbscan_utf8 : tbscan_span);
+}
+
+/*
+ * Width classes of Unicode code points, from the generated
+ * two-stage table in textbounds-width.c.
+ */
+#define TBW_INVISIBLE  0    // zero width, not ink: format controls
+#define TBW_MARK       1    // zero width, ink: combining marks
+#define TBW_NARROW     2    // one cell
+#define TBW_WIDE       3    // two cells
+
+extern const unsigned char tbw_stage1[0x110000 >> 8];
+extern const unsigned char tbw_stage2[][256 / 4];
+
+static inline uint_t
+tbw_class(uint_t cp)
+{
+    const unsigned char *blk = tbw_stage2[tbw_stage1[cp >> 8]];
+
+    return ((blk[(cp & 0xff) >> 2] >> (2 * (cp & 3))) & 3);
+}
+
+/*
+ * What a textbox asks to be measured, with zero meaning everything.
+ * With a histogram, the distribution of line widths is wanted, too.
+ */
+static inline uint_t
+tb_measure(const textbox_t *ctxp)
+{
+    uint_t measure = ctxp->measure & TB_MEASURE_ALL;
+
+    if (measure == 0 && (ctxp->measure & (TB_MEASURE_NONE | TB_MEASURE_DIST)) == 0) {
+        measure = TB_MEASURE_ALL;
+    }
+    if ((ctxp->measure & TB_MEASURE_DIST) != 0 || ctxp->hist != NULL) {
+        measure |= TB_MEASURE_DIST;
+    }
+    return (measure != 0 ? measure : TB_MEASURE_NONE);
+}
+
+/*
+ * FNV-1a, for checksums, and for keys of results kept from one run
+ * to the next.
+ */
+#define TB_FNV_BASIS  0xcbf29ce484222325ULL
+#define TB_FNV_PRIME  0x100000001b3ULL
+
+static inline uint64_t
+tb_fnv1a(uint64_t h, const void *buf, size_t sz)
+{
+    const unsigned char *p = (const unsigned char *)buf;
+    size_t i;
+
+    for (i = 0; i < sz; ++i) {
+        h = (h ^ p[i]) * TB_FNV_PRIME;
+    }
+    return (h);
+}
+
+static inline uint64_t
+tb_fnv1a_u64(uint64_t h, uint64_t v)
+{
+    return (tb_fnv1a(h, &v, sizeof (v)));
+}
+
+/*
+ * The options that results depend on (.tws, .utf8, .tabs, .eol),
+ * but not which results there are; see textbounds-cache.c.
+ */
+extern uint64_t tb_options_sig(const tbscan_t *sp);
+
+/*
+ * Results of earlier runs, kept in a file; see textbounds-cache.c.
+ * tbcache_lookup() fills in the results, and returns true, if there
+ * are any for a file with these stat() results.
+ */
+struct stat;
+
+extern bool tbcache_lookup(tbcache_t *cache, const struct stat *st, textbox_t *ctxp);
+extern void tbcache_store(tbcache_t *cache, const struct stat *st, const textbox_t *ctxp);
+
+/*
+ * Measure a regular file, open at offset 0, keeping an index
+ * in ctxp->index; see textbounds-index.c.
+ */
+
+extern int tbindex_fd(int fd, const struct stat *st, textbox_t *ctxp, uint_t nthreads);
+
+/*
+ * Compressed text; see textbounds-decompress.c.
+ * tbdecomp_kind() tells, from the first TB_DECOMP_PEEK bytes of a text,
+ * what it is compressed with.  tbdecomp_fd() measures the text
+ * as it is decoded, starting with the headsz bytes in head,
+ * which have already been read from fd.
+ */
+#define TB_DECOMP_NONE  0
+#define TB_DECOMP_GZIP  1
+#define TB_DECOMP_XZ    2
+#define TB_DECOMP_ZSTD  3
+
+#define TB_DECOMP_PEEK  6
+
+extern int tbdecomp_kind(const char *buf, size_t sz);
+extern int tbdecomp_fd(int fd, int kind, const char *head, size_t headsz, textbox_t *ctxp);
+
+/*
+ * text_bounds_file(), for the file name in the directory dirfd,
+ * as for openat(); dirfd is AT_FDCWD for text_bounds_file() itself.
+ */
+extern int  tbfile_at(int dirfd, const char *name, tbfile_t *fp, uint_t nthreads);
+
+/*
+ * text_bounds_file() and the io_uring loop measure each file
+ * with a histogram of its own; see textbounds-hist.c.
+ */
+extern int  tbfile_hist_begin(tbfile_t *fp, tbhist_t **sharedp);
+extern void tbfile_hist_end(tbfile_t *fp, tbhist_t *shared, bool ok);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif  /* _TEXTBOUNDS_INT_H */
@@ -28,6 +28,8 @@
 #include <string.h>
 #include <getopt.h>
 #include <ctype.h>          // Import isprint()
+#include <errno.h>          // Import errno, EINTR
+#include <time.h>           // Import clock_gettime()
 // #include <sys/wait.h>
 
 #include <textbounds.h>
@@ -37,12 +39,12 @@
 
 #include <getopt_int.h>
 
-#include <unistd.h>         // Import isatty()
+#include <unistd.h>         // Import isatty(), read(), close()
+#include <fcntl.h>          // Import open()
+#include <poll.h>           // Import poll()
 
 typedef unsigned int uit_t;
 
-extern void text_bounds(textbox_t *);
-
 struct cmd {
     // Specifications
     int argc;
@@ -80,10 +82,163 @@ extern char *program_name;
 #define OPT_COLUMNS    0x0004
 #define OPT_FORMAT     0x0100
 #define OPT_SHOW_ARGV  0x0200
+#define OPT_THREADS    0x0400
+#define OPT_JOBS       0x0401
+#define OPT_UNORDERED  0x0402
+#define OPT_IO         0x0403
+#define OPT_FITS       0x0404
+#define OPT_UTF8       0x0405
+#define OPT_TABS       0x0406
+#define OPT_EOL        0x0407
+#define OPT_TOTAL      0x0408
+#define OPT_HISTOGRAM  0x0409
+#define OPT_INDEX      0x040a
+#define OPT_FOLLOW     0x040b
+#define OPT_INTERVAL   0x040c
+#define OPT_CACHE      0x040d
+#define OPT_DECOMPRESS 0x040e
+#define OPT_FILES0_FROM 0x040f
+#define OPT_FILES_FROM 0x0410
+#define OPT_OUTPUT     0x0411
+#define OPT_PATH_TABLE 0x0412
+#define OPT_STATS      0x0413
+#define OPT_SLOWEST    0x0414
 
 static char *result_format = NULL;
 static uint_t fmt_options = 0;
 
+/*
+ * The format, compiled, and where results go.
+ */
+static tbformat_t *result_fmt = NULL;
+static tbout_t *result_out = NULL;
+
+/*
+ * --output=text|jsonl|csv|binary: TB_OUTPUT_*.
+ * --path-table=FILE: with binary records, the names of the files.
+ */
+static uint_t opt_output = TB_OUTPUT_TEXT;
+static const char *opt_path_table = NULL;
+static tbout_t *path_out = NULL;
+static int path_fd = -1;
+
+/*
+ * --stats: when done, show where the time went, on the error handle.
+ * --stats-slowest=N: name the N slowest files.
+ */
+static bool opt_stats = false;
+static uint_t opt_slowest = 10;
+static tbstats_t *run_stats = NULL;
+
+/*
+ * Measure columns as terminal display cells of UTF-8 text.
+ */
+static bool opt_utf8 = false;
+
+/*
+ * Tab stops, from --tabs; NULL for every 8 columns.
+ */
+static tbtabs_t *opt_tabs = NULL;
+
+/*
+ * What ends a line, from --eol; TB_EOL_*.
+ */
+static uint_t opt_eol = TB_EOL_LF;
+
+/*
+ * --total: after the results for each file, show them for all files.
+ * --histogram: then, show how many lines there are of each width.
+ */
+static bool opt_total = false;
+static bool opt_histogram = false;
+
+/*
+ * --index=DIR: keep sidecar indexes in DIR, and measure only
+ * what has been appended since the last time.
+ */
+static const char *opt_index = NULL;
+
+/*
+ * --follow: keep measuring the files as they grow, and show the results
+ * for each file that changes; with --interval=N, show the results
+ * for all files every N seconds, instead.
+ */
+static bool opt_follow = false;
+static uint_t opt_interval = 0;
+
+/*
+ * --cache=FILE: keep the results for each file in FILE,
+ * and do not measure files that have not changed since.
+ */
+static const char *opt_cache = NULL;
+
+/*
+ * --decompress=auto|never: measure the text that gzip, xz
+ * and zstd files decode to, or the files as they are.
+ */
+static bool opt_decompress = true;
+
+/*
+ * -r, --recursive: measure every regular file in the trees given,
+ * on --jobs threads, or one for each CPU.
+ * -L, --dereference: follow symbolic links.
+ * -x, --one-file-system: do not leave the file system of each tree.
+ */
+static bool opt_recursive = false;
+static uint_t walk_flags = 0;
+
+/*
+ * --files0-from=F, --files-from=F: read the names of the files
+ * from F, or stdin if F is "-", ending in NUL or newline.
+ * They are measured in batches of at most LIST_BATCH, as they come.
+ */
+static const char *opt_files_from = NULL;
+static int files_from_sep = '\n';
+
+#define LIST_BATCH  1024
+
+/*
+ * Results for all files, so far.
+ */
+struct tbtotal {
+    size_t files;           // Reported, so far
+    size_t lines;
+    size_t columns;
+    size_t widest_line;     // in the widest file
+    off_t  widest_offset;
+    tbhist_t *hist;
+};
+
+/*
+ * Measure each (regular) file using this many threads.
+ */
+static uint_t opt_threads = 1;
+
+/*
+ * Measure this many files at a time; 0 until given.
+ * Show results in the order that files are given, unless --unordered.
+ */
+static uint_t opt_jobs = 0;
+static bool opt_unordered = false;
+
+/*
+ * How to do I/O for a list of files.
+ * Auto means use io_uring for long lists of files, when it is available.
+ */
+enum { IO_AUTO, IO_SYNC, IO_URING };
+
+#define IO_URING_MIN_FILES 16
+
+static int opt_io = IO_AUTO;
+
+/*
+ * --fits=COLSxLINES: only answer whether each file fits in the box,
+ * with the exit status.  Zero means no limit.
+ */
+static bool opt_fits = false;
+static size_t fits_columns = 0;
+static size_t fits_lines = 0;
+
 static struct option long_options[] = {
     {"help",              no_argument,       0,  'h'},
     {"version",           no_argument,       0,  'V'},
@@ -93,6 +248,30 @@ static struct option long_options[] = {
     {"lines",             no_argument,       0,  OPT_BASE | OPT_LINES},
     {"columns",           no_argument,       0,  OPT_BASE | OPT_COLUMNS},
     {"format",            required_argument, 0,  OPT_BASE | OPT_FORMAT},
+    {"utf8",              no_argument,       0,  OPT_BASE | OPT_UTF8},
+    {"tabs",              required_argument, 0,  OPT_BASE | OPT_TABS},
+    {"eol",               required_argument, 0,  OPT_BASE | OPT_EOL},
+    {"total",             no_argument,       0,  OPT_BASE | OPT_TOTAL},
+    {"histogram",         no_argument,       0,  OPT_BASE | OPT_HISTOGRAM},
+    {"index",             required_argument, 0,  OPT_BASE | OPT_INDEX},
+    {"follow",            no_argument,       0,  OPT_BASE | OPT_FOLLOW},
+    {"interval",          required_argument, 0,  OPT_BASE | OPT_INTERVAL},
+    {"cache",             required_argument, 0,  OPT_BASE | OPT_CACHE},
+    {"decompress",        required_argument, 0,  OPT_BASE | OPT_DECOMPRESS},
+    {"files0-from",       required_argument, 0,  OPT_BASE | OPT_FILES0_FROM},
+    {"files-from",        required_argument, 0,  OPT_BASE | OPT_FILES_FROM},
+    {"recursive",         no_argument,       0,  'r'},
+    {"dereference",       no_argument,       0,  'L'},
+    {"one-file-system",   no_argument,       0,  'x'},
+    {"threads",           required_argument, 0,  OPT_BASE | OPT_THREADS},
+    {"jobs",              required_argument, 0,  OPT_BASE | OPT_JOBS},
+    {"unordered",         no_argument,       0,  OPT_BASE | OPT_UNORDERED},
+    {"io",                required_argument, 0,  OPT_BASE | OPT_IO},
+    {"fits",              required_argument, 0,  OPT_BASE | OPT_FITS},
+    {"output",            required_argument, 0,  OPT_BASE | OPT_OUTPUT},
+    {"path-table",        required_argument, 0,  OPT_BASE | OPT_PATH_TABLE},
+    {"stats",             no_argument,       0,  OPT_BASE | OPT_STATS},
+    {"stats-slowest",     required_argument, 0,  OPT_BASE | OPT_SLOWEST},
     {0, 0, 0, 0 }
 };
 
@@ -105,6 +284,30 @@ static const char usage_text[] =
     "  --name            Show file name\n"
     "  --lines           Show number of lines (same as wc -l)\n"
     "  --columns         Show number of columns (maximum line length)\n"
+    "  --utf8            Count columns as display cells of UTF-8 text\n"
+    "  --tabs=N|LIST     Tab stops every N columns, or at a list of columns\n"
+    "  --eol=lf|crlf|cr|nul|auto  What ends a line\n"
+    "  --total           Also show results for all files together\n"
+    "  --histogram       Show how many lines there are of each width\n"
+    "  --index=DIR       Keep indexes in DIR; measure only appended text\n"
+    "  --follow          Keep measuring files as they grow, like tail -F\n"
+    "  --interval=N      With --follow, show all results every N seconds\n"
+    "  --cache=FILE      Keep results in FILE; skip files that have not changed\n"
+    "  --decompress=auto|never  Measure gzip, xz and zstd files decoded, or not\n"
+    "  --files0-from=F   Read the names of the files from F, each ending in NUL\n"
+    "  --files-from=F    Read the names of the files from F, one per line\n"
+    "  --recursive|-r    Measure every file in each directory tree\n"
+    "  --dereference|-L  With -r, follow symbolic links\n"
+    "  --one-file-system|-x  With -r, stay on the file system of each tree\n"
+    "  --threads=N       Measure each file using N threads\n"
+    "  --jobs=N          Measure N files at a time\n"
+    "  --unordered       With --jobs or io_uring, show results as soon as ready\n"
+    "  --io=auto|sync|uring  How to read a list of files\n"
+    "  --fits=COLSxLINES Exit 0 if all files fit in the box, 1 if not\n"
+    "  --output=text|jsonl|csv|binary  How to show results\n"
+    "  --path-table=FILE With --output=binary, write the file names to FILE\n"
+    "  --stats           When done, show where the time went\n"
+    "  --stats-slowest=N With --stats, name the N slowest files (10)\n"
     ;
 
 static const char version_text[] =
@@ -182,94 +385,154 @@ vischar_r(char *buf, size_t sz, int c)
  * const char *fmt, size_t Lines, size_t MaxWidth, uint_t fmt_options)
  */
 
-static void
-fshow_textbounds(FILE *f, const char *fname, textbox_t *txt)
+/*
+ * If a format string is given, use it;
+ * otherwise, build our own format string based on options
+ * (--name --lines --columns), in fmtbuf.
+ */
+static char *
+textbounds_fmt(char *fmt, uint_t fmt_options, char *fmtbuf)
 {
-    char fmtbuf[32];
-    char *fmt = txt->fmt;
-    uint_t fmt_options = txt->fmt_options;
-
-    /*
-     * If a format string is given, use it;
-     * otherwise, build our own format string based on options
-     * (--name --lines --columns).
-     *
-     */
-    if (fmt == NULL && fmt_options == 0) {
-        fmt = "%cx%l";
-    }
-    else if (fmt == NULL) {
-        char *bp;
-
-        bp = fmtbuf;
-        if ((fmt_options & OPT_NAME) != 0) {
-            if (bp > fmtbuf) {
-                *bp++ = ' ';
-            }
-            *bp++ = '%';
-            *bp++ = 'f';
+    char *bp;
+
+    if (fmt != NULL) {
+        return (fmt);
+    }
+    if (fmt_options == 0) {
+        return ("%cx%l");
+    }
+
+    bp = fmtbuf;
+    if ((fmt_options & OPT_NAME) != 0) {
+        if (bp > fmtbuf) {
+            *bp++ = ' ';
         }
+        *bp++ = '%';
+        *bp++ = 'f';
+    }
 
-        if ((fmt_options & OPT_LINES) != 0) {
-            if (bp > fmtbuf) {
-                *bp++ = ' ';
-            }
-            *bp++ = '%';
-            *bp++ = 'l';
+    if ((fmt_options & OPT_LINES) != 0) {
+        if (bp > fmtbuf) {
+            *bp++ = ' ';
         }
+        *bp++ = '%';
+        *bp++ = 'l';
+    }
 
-        if ((fmt_options & OPT_COLUMNS) != 0) {
-            if (bp > fmtbuf) {
-                *bp++ = ' ';
-            }
-            *bp++ = '%';
-            *bp++ = 'c';
+    if ((fmt_options & OPT_COLUMNS) != 0) {
+        if (bp > fmtbuf) {
+            *bp++ = ' ';
         }
-        *bp = '\0';
-        fmt = fmtbuf;
+        *bp++ = '%';
+        *bp++ = 'c';
     }
+    *bp = '\0';
+    return (fmtbuf);
+}
 
+/*
+ * Parse the argument of a numeric option.
+ * Return 0 on success; non-zero, with an error message, on failure.
+ */
+static int
+parse_uint_opt(uint_t *r, const char *opt, const char *str)
+{
+    unsigned long val;
+    char *end;
+
+    errno = 0;
+    val = strtoul(str, &end, 10);
+    if (errno != 0 || end == str || *end != '\0' || val == 0 || val > 1024) {
+        eprintf("%s: Invalid %s, '%s'\n", program_name, opt, str);
+        return (1);
+    }
+    *r = (uint_t)val;
+    return (0);
+}
 
-    dbg_printf("fname=[%s], fmt=[%s], lines=%zu, columns=%zu, fmt_options=%u\n",
-            fname, fmt, txt->lines, txt->columns, fmt_options);
+/*
+ * Parse the argument of --fits, COLSxLINES.
+ * Either one can be left out, for no limit.
+ * Return 0 on success; non-zero, with an error message, on failure.
+ */
+static int
+parse_fits_opt(const char *str)
+{
+    unsigned long cols;
+    unsigned long lines;
+    char *end;
+
+    errno = 0;
+    cols = 0;
+    lines = 0;
+    end = (char *)str;
+    if (isdigit((unsigned char)*str)) {
+        cols = strtoul(str, &end, 10);
+    }
+    if (*end == 'x' && isdigit((unsigned char)end[1])) {
+        lines = strtoul(end + 1, &end, 10);
+    }
+    else if (*end == 'x' && end[1] == '\0') {
+        ++end;
+    }
+    if (errno != 0 || *end != '\0' || (cols == 0 && lines == 0)) {
+        eprintf("%s: Invalid --fits, '%s'; expected COLSxLINES\n", program_name, str);
+        return (1);
+    }
+    opt_fits = true;
+    fits_columns = cols;
+    fits_lines = lines;
+    return (0);
+}
 
-    /*
-     * Interpret format string.
-     * Intercalate textbounds properties.
-     */
-    const char *fp;
-    for (fp = fmt; *fp; ++fp) {
-        int c;
+/*
+ * Parse the argument of --output.
+ * Return 0 on success; non-zero, with an error message, on failure.
+ */
+static int
+parse_output_opt(const char *str)
+{
+    static const char *const names[] = { "text", "jsonl", "csv", "binary" };
+    uint_t i;
+
+    for (i = 0; i < sizeof (names) / sizeof (names[0]); ++i) {
+        if (strcmp(str, names[i]) == 0) {
+            // In the order of TB_OUTPUT_*
+            opt_output = i;
+            return (0);
+        }
+    }
+    eprintf("%s: Invalid --output, '%s'\n", program_name, str);
+    return (1);
+}
 
-        c = *fp;
-        switch (c) {
-            default:
-                fputc(c, f);
-                break;
-            case '%':
-                ++fp;
-                c = *fp;
-                switch (c) {
-                    default:
-                        fprintf(f, "{%%%c=ERROR}", c);
-                        break;
-                    case '%':
-                        fputc(c, f);
-                        break;
-                    case 'f':
-                        fprintf(f, "%s", fname);
-                        break;
-                    case 'l':
-                        fprintf(f, "%zu", txt->lines);
-                        break;
-                    case 'c':
-                        fprintf(f, "%zu", txt->columns);
-                        break;
-                }
-                break;
+/*
+ * Parse --eol=lf|crlf|cr|nul|auto.
+ * Return 0 on success; non-zero, with an error message, on failure.
+ */
+static int
+parse_eol_opt(const char *str)
+{
+    static const struct {
+        const char *name;
+        uint_t eol;
+    } eols[] = {
+        { "lf",   TB_EOL_LF },
+        { "crlf", TB_EOL_CRLF },
+        { "cr",   TB_EOL_CR },
+        { "nul",  TB_EOL_NUL },
+        { "auto", TB_EOL_AUTO },
+    };
+    size_t i;
+
+    for (i = 0; i < sizeof (eols) / sizeof (eols[0]); ++i) {
+        if (strcmp(str, eols[i].name) == 0) {
+            opt_eol = eols[i].eol;
+            return (0);
         }
     }
-    fputc('\n', f);
+    eprintf("%s: Invalid --eol, '%s'\n", program_name, str);
+    return (1);
 }
 
 static struct _getopt_data null_getopts_data;
@@ -311,7 +574,7 @@ textbounds_getopt(cmd_t *cmd, int argc, char **argv, bool setargv)
         this_option_optind = optind ? optind : 1;
         getopt_ctx.optind = optind;
         getopt_ctx.opterr = opterr;
-        optc = cs_getopt_internal_r(argc, argv, "+hVdvc", long_options, &option_index, 0, &getopt_ctx, 0);
+        optc = cs_getopt_internal_r(argc, argv, "+hVdvcrLx", long_options, &option_index, 0, &getopt_ctx, 0);
 
         optind = getopt_ctx.optind;
         optarg = getopt_ctx.optarg;
@@ -349,6 +612,23 @@ textbounds_getopt(cmd_t *cmd, int argc, char **argv, bool setargv)
         case 'v':
             verbose = true;
             break;
+        case OPT_BASE|OPT_FILES0_FROM:
+            opt_files_from = optarg;
+            files_from_sep = '\0';
+            break;
+        case OPT_BASE|OPT_FILES_FROM:
+            opt_files_from = optarg;
+            files_from_sep = '\n';
+            break;
+        case 'r':
+            opt_recursive = true;
+            break;
+        case 'L':
+            walk_flags |= TB_WALK_FOLLOW;
+            break;
+        case 'x':
+            walk_flags |= TB_WALK_XDEV;
+            break;
         case OPT_BASE|OPT_LINES:
             fmt_options |= OPT_LINES;
             break;
@@ -361,6 +641,89 @@ textbounds_getopt(cmd_t *cmd, int argc, char **argv, bool setargv)
         case OPT_BASE|OPT_FORMAT:
             result_format = optarg;
             break;
+        case OPT_BASE|OPT_UTF8:
+            opt_utf8 = true;
+            break;
+        case OPT_BASE|OPT_TABS:
+            text_bounds_tabs_free(opt_tabs);
+            opt_tabs = text_bounds_tabs(optarg);
+            if (opt_tabs == NULL) {
+                eprintf("%s: Invalid --tabs, '%s'\n", program_name, optarg);
+                rv = 1;
+            }
+            break;
+        case OPT_BASE|OPT_EOL:
+            rv = parse_eol_opt(optarg);
+            break;
+        case OPT_BASE|OPT_TOTAL:
+            opt_total = true;
+            break;
+        case OPT_BASE|OPT_HISTOGRAM:
+            opt_histogram = true;
+            break;
+        case OPT_BASE|OPT_INDEX:
+            opt_index = optarg;
+            break;
+        case OPT_BASE|OPT_FOLLOW:
+            opt_follow = true;
+            break;
+        case OPT_BASE|OPT_INTERVAL:
+            rv = parse_uint_opt(&opt_interval, "--interval", optarg);
+            break;
+        case OPT_BASE|OPT_CACHE:
+            opt_cache = optarg;
+            break;
+        case OPT_BASE|OPT_DECOMPRESS:
+            if (strcmp(optarg, "auto") == 0) {
+                opt_decompress = true;
+            }
+            else if (strcmp(optarg, "never") == 0) {
+                opt_decompress = false;
+            }
+            else {
+                eprintf("%s: Invalid --decompress, '%s'\n", program_name, optarg);
+                rv = 1;
+            }
+            break;
+        case OPT_BASE|OPT_THREADS:
+            rv = parse_uint_opt(&opt_threads, "--threads", optarg);
+            break;
+        case OPT_BASE|OPT_JOBS:
+            rv = parse_uint_opt(&opt_jobs, "--jobs", optarg);
+            break;
+        case OPT_BASE|OPT_UNORDERED:
+            opt_unordered = true;
+            break;
+        case OPT_BASE|OPT_FITS:
+            rv = parse_fits_opt(optarg);
+            break;
+        case OPT_BASE|OPT_OUTPUT:
+            rv = parse_output_opt(optarg);
+            break;
+        case OPT_BASE|OPT_PATH_TABLE:
+            opt_path_table = optarg;
+            break;
+        case OPT_BASE|OPT_STATS:
+            opt_stats = true;
+            break;
+        case OPT_BASE|OPT_SLOWEST:
+            rv = parse_uint_opt(&opt_slowest, "--stats-slowest", optarg);
+            break;
+        case OPT_BASE|OPT_IO:
+            if (strcmp(optarg, "auto") == 0) {
+                opt_io = IO_AUTO;
+            }
+            else if (strcmp(optarg, "sync") == 0) {
+                opt_io = IO_SYNC;
+            }
+            else if (strcmp(optarg, "uring") == 0) {
+                opt_io = IO_URING;
+            }
+            else {
+                eprintf("%s: Invalid --io, '%s'\n", program_name, optarg);
+                rv = 1;
+            }
+            break;
         case '?':
             eprint(program_name);
             eprint(": ");
@@ -436,51 +799,689 @@ textbox_getchr(void *arg)
     return (fgetc(srcf));
 }
 
-int
-textbounds_filev(size_t filec, char **filev)
+/*
+ * Show the results for one file, as text, or as a record;
+ * with fname NULL, for all the files together.
+ */
+static void
+show_result(const char *fname, const textbox_t *box, int err)
+{
+    if (opt_output == TB_OUTPUT_TEXT) {
+        text_bounds_out_format(result_out, result_fmt,
+            fname != NULL ? fname : "total", box);
+    }
+    else {
+        text_bounds_out_record(result_out, opt_output, path_out, fname, box, err);
+    }
+}
+
+/*
+ * --verbose: how fast compressed text was read, and decoded.
+ */
+static void
+report_zstat(const tbfile_t *fp)
+{
+    const struct tbzstat *zs = &fp->box.zstat;
+    double secs = (zs->seconds > 0) ? zs->seconds : 1e-9;
+
+    eprintf("%s: '%s': %s, %.1f MB in, %.1f MB/s; %.1f MB out, %.1f MB/s\n",
+        program_name, fp->fname, zs->format,
+        zs->in / 1e6, zs->in / 1e6 / secs, zs->out / 1e6, zs->out / 1e6 / secs);
+}
+
+/*
+ * Nanoseconds since t0.
+ */
+static uint64_t
+elapsed_ns(const struct timespec *t0)
+{
+    struct timespec t1;
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return ((t1.tv_sec - t0->tv_sec) * 1000000000ULL + t1.tv_nsec - t0->tv_nsec);
+}
+
+/*
+ * Show the results for one file, or why there are none.
+ */
+static void
+report_one(tbfile_t *fp, struct tbtotal *total)
+{
+    if (fp->err != 0 && strcmp(fp->errop, "fopen") == 0) {
+        fprintf(stderr, "fopen('%s', r) failed.\n", fp->fname);
+        // A record for every file, even one that is not there
+        if (opt_output != TB_OUTPUT_TEXT) {
+            show_result(fp->fname, &fp->box, fp->err);
+        }
+        return;
+    }
+    if (fp->err != 0 && (strcmp(fp->errop, "opendir") == 0 || strcmp(fp->errop, "readdir") == 0)) {
+        eprintf("%s: '%s': %s\n", program_name, fp->fname, strerror(fp->err));
+        ++cmd->ioerr;
+        return;
+    }
+    if (fp->err != 0) {
+        // Say why; there are no results to show, only a record of the error
+        eprintf("%s: '%s': %s\n", program_name, fp->fname, strerror(fp->err));
+        ++cmd->ioerr;
+        if (opt_output != TB_OUTPUT_TEXT) {
+            show_result(fp->fname, &fp->box, fp->err);
+        }
+        return;
+    }
+    total->lines += fp->box.lines;
+    if (fp->box.columns > total->columns) {
+        total->columns = fp->box.columns;
+        total->widest_line = fp->box.widest_line;
+        total->widest_offset = fp->box.widest_offset;
+    }
+    show_result(fp->fname, &fp->box, 0);
+    if (verbose && fp->box.zstat.format != NULL) {
+        report_zstat(fp);
+    }
+}
+
+/*
+ * report_one(), and with --stats, count the file, and the time
+ * it takes to show its results.  Directories that could not be read
+ * are not files.
+ */
+static void
+report_file(tbfile_t *fp, void *arg)
+{
+    struct tbtotal *total = (struct tbtotal *)arg;
+    struct timespec t0;
+
+    ++total->files;
+    if (run_stats == NULL || (fp->err != 0 && (strcmp(fp->errop, "opendir") == 0
+        || strcmp(fp->errop, "readdir") == 0))) {
+        report_one(fp, total);
+        return;
+    }
+    text_bounds_stats_add(run_stats, fp->fname, &fp->box.fstat, fp->err);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    report_one(fp, total);
+    text_bounds_stats_format(run_stats, elapsed_ns(&t0));
+}
+
+/*
+ * --total and --histogram: results for all the files together.
+ */
+static void
+report_total(struct tbtotal *total, const textbox_t *proto)
 {
-    fvh_t fv;
+    textbox_t box = *proto;
+    size_t idx;
+    size_t lo;
+    size_t hi;
+    size_t count;
+
+    if (opt_total) {
+        box.lines = total->lines;
+        box.columns = total->columns;
+        box.widest_line = total->widest_line;
+        box.widest_offset = total->widest_offset;
+        if (total->hist != NULL) {
+            text_bounds_hist_dist(total->hist, &box.dist);
+        }
+        show_result(NULL, &box, 0);
+    }
+    if (opt_histogram && total->hist != NULL) {
+        idx = 0;
+        while (text_bounds_hist_bin(total->hist, &idx, &lo, &hi, &count)) {
+            if (opt_output == TB_OUTPUT_JSONL) {
+                text_bounds_out_write(result_out, "{\"lo\":", 6);
+                text_bounds_out_uint(result_out, lo);
+                text_bounds_out_write(result_out, ",\"hi\":", 6);
+                text_bounds_out_uint(result_out, hi);
+                text_bounds_out_write(result_out, ",\"lines\":", 9);
+                text_bounds_out_uint(result_out, count);
+                text_bounds_out_write(result_out, "}\n", 2);
+                continue;
+            }
+            text_bounds_out_uint(result_out, lo);
+            if (lo != hi) {
+                text_bounds_out_write(result_out, "-", 1);
+                text_bounds_out_uint(result_out, hi);
+            }
+            text_bounds_out_write(result_out, " ", 1);
+            text_bounds_out_uint(result_out, count);
+            text_bounds_out_write(result_out, "\n", 1);
+        }
+    }
+}
+
+/*
+ * --fits: does every file fit in the box?
+ * Each file is read only until it is known not to fit,
+ * and the first one that does not fit settles the answer.
+ *
+ * Return 0 if all the files fit, 1 if one does not, or 2 on error.
+ */
+static int
+textbounds_fits_filev(size_t filec, tbfile_t *files)
+{
+    tbfile_t *fp;
+    size_t fnr;
+
+    for (fnr = 0; fnr < filec; ++fnr) {
+        fp = &files[fnr];
+        fp->box.max_columns = fits_columns;
+        fp->box.max_lines = fits_lines;
+        fp->box.measure = 0;
+        if (fits_columns != 0) {
+            fp->box.measure |= TB_MEASURE_COLUMNS;
+        }
+        if (fits_lines != 0) {
+            fp->box.measure |= TB_MEASURE_LINES;
+        }
+
+        text_bounds_file(fp, 1);
+        if (run_stats != NULL) {
+            text_bounds_stats_add(run_stats, fp->fname, &fp->box.fstat, fp->err);
+        }
+        if (fp->err != 0 && strcmp(fp->errop, "fopen") == 0) {
+            fprintf(stderr, "fopen('%s', r) failed.\n", fp->fname);
+            return (2);
+        }
+        if (fp->err != 0) {
+            eprintf("%s: '%s': %s\n", program_name, fp->fname, strerror(fp->err));
+            return (2);
+        }
+        if (fp->box.overflow) {
+            if (verbose) {
+                eprintf("%s: '%s' does not fit in %zux%zu.\n",
+                    program_name, fp->fname, fits_columns, fits_lines);
+            }
+            return (1);
+        }
+    }
+    return (0);
+}
+
+/*
+ * --follow: show the results for a file, as soon as they change.
+ */
+static void
+report_follow(tbfile_t *fp, void *arg)
+{
+    (void)arg;
+    if (fp->err != 0) {
+        eprintf("%s: '%s': %s\n", program_name, fp->fname, strerror(fp->err));
+    }
+    else {
+        show_result(fp->fname, &fp->box, 0);
+    }
+    text_bounds_out_flush(result_out);
+    text_bounds_out_flush(path_out);
+}
+
+/*
+ * Measure the files, then keep measuring them as they grow.
+ * Return only on error.
+ */
+static int
+textbounds_follow(size_t filec, tbfile_t *files)
+{
+    struct timespec now;
+    struct timespec next;
+    tbfollow_t *fw;
+    long ms;
+    size_t fnr;
+    int n;
+
+    fw = text_bounds_follow_new(filec, files);
+    if (fw == NULL) {
+        eprintf("%s: Out of memory.\n", program_name);
+        return (2);
+    }
+    for (fnr = 0; fnr < filec; ++fnr) {
+        report_follow(&files[fnr], NULL);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    do {
+        if (opt_interval == 0) {
+            n = text_bounds_follow_poll(fw, -1, report_follow, NULL);
+            continue;
+        }
+        next.tv_sec += opt_interval;
+        do {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            ms = (next.tv_sec - now.tv_sec) * 1000 + (next.tv_nsec - now.tv_nsec) / 1000000;
+            n = text_bounds_follow_poll(fw, ms > 0 ? (int)ms : 0, NULL, NULL);
+        } while (n >= 0 && ms > 0);
+        for (fnr = 0; fnr < filec; ++fnr) {
+            report_follow(&files[fnr], NULL);
+        }
+    } while (n >= 0);
+
+    eprintf("%s: --follow: %s\n", program_name, strerror(errno));
+    text_bounds_follow_free(fw);
+    return (2);
+}
+
+/*
+ * -r: how many threads walk the trees.
+ */
+static uint_t
+walk_jobs(void)
+{
+    long ncpus;
+
+    if (opt_jobs != 0) {
+        return (opt_jobs);
+    }
+    ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return ((ncpus > 1) ? (uint_t)ncpus : 1);
+}
+
+/*
+ * What stays the same from one batch of files to the next.
+ */
+struct tbrun {
+    struct tbtotal total;
+    tbcache_t *cache;
+    textbox_t proto;        // Options for every file
+    char     fmtbuf[32];
+    const char *io_name;
+    size_t   nfiles;        // Files given, so far
+    struct timespec t0;
+};
+
+/*
+ * Get ready to measure files.
+ * Return 0 on success; non-zero, with an error message, on failure.
+ */
+static int
+run_begin(struct tbrun *run)
+{
+    textbox_t *proto = &run->proto;
+
+    memset(run, 0, sizeof (*run));
+    proto->fmt = textbounds_fmt(result_format, fmt_options, run->fmtbuf);
+    proto->fmt_options = fmt_options;
+    // Compiled once, for all the files
+    result_fmt = text_bounds_format_compile(proto->fmt);
+    result_out = text_bounds_out_new(STDOUT_FILENO);
+    if (result_fmt == NULL || result_out == NULL) {
+        eprintf("%s: Out of memory.\n", program_name);
+        text_bounds_format_free(result_fmt);
+        text_bounds_out_free(result_out);
+        return (2);
+    }
+    proto->measure = text_bounds_format_measure(result_fmt);
+    if (opt_output != TB_OUTPUT_TEXT) {
+        // Records have all the results, whatever the format.
+        proto->measure = TB_MEASURE_ALL;
+    }
+    if (opt_path_table != NULL) {
+        path_fd = open(opt_path_table, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        path_out = (path_fd >= 0) ? text_bounds_out_new(path_fd) : NULL;
+        if (path_out == NULL) {
+            eprintf("%s: --path-table, '%s': %s\n", program_name, opt_path_table, strerror(errno));
+            if (path_fd >= 0) {
+                close(path_fd);
+            }
+            text_bounds_format_free(result_fmt);
+            text_bounds_out_free(result_out);
+            return (2);
+        }
+    }
+    text_bounds_out_begin(result_out, opt_output);
+    if (opt_histogram) {
+        proto->measure = (proto->measure & ~TB_MEASURE_NONE) | TB_MEASURE_DIST;
+    }
+    // The distributions of all files merge into one.
+    if ((proto->measure & TB_MEASURE_DIST) != 0 && (opt_total || opt_histogram) && !opt_fits) {
+        run->total.hist = text_bounds_hist_new();
+        if (run->total.hist == NULL) {
+            eprintf("%s: Out of memory.\n", program_name);
+            return (2);
+        }
+    }
+    // Without a cache, it all still works; just not as fast.
+    if (opt_cache != NULL) {
+        run->cache = text_bounds_cache_open(opt_cache);
+        if (run->cache == NULL) {
+            eprintf("%s: --cache, '%s': %s\n", program_name, opt_cache, strerror(errno));
+        }
+    }
+    proto->utf8 = opt_utf8;
+    proto->tabs = opt_tabs;
+    proto->eol = opt_eol;
+    proto->index = opt_index;
+    proto->cache = run->cache;
+    proto->decompress = opt_decompress;
+    proto->hist = run->total.hist;
+    if (opt_stats) {
+        run_stats = text_bounds_stats_new(opt_slowest);
+        if (run_stats == NULL) {
+            eprintf("%s: Out of memory.\n", program_name);
+            return (2);
+        }
+        proto->stats = true;
+    }
+    run->io_name = "sync";
+    clock_gettime(CLOCK_MONOTONIC, &run->t0);
+    return (0);
+}
+
+/*
+ * Measure a batch of files, and show the results.
+ * Return the exit status, so far.
+ */
+static int
+run_files(struct tbrun *run, size_t filec, char **filev)
+{
+    tbfile_t *files;
+    size_t fnr;
     int rv;
 
-    fv.filec = filec;
-    fv.filev = filev;
-    fv.glnr = 0;
-    rv = 0;
-    for (fv.fnr = 0; fv.fnr < filec; ++fv.fnr) {
-        FILE *srcf;
+    files = calloc(filec, sizeof (tbfile_t));
+    if (files == NULL) {
+        eprintf("%s: Out of memory.\n", program_name);
+        return (2);
+    }
+    for (fnr = 0; fnr < filec; ++fnr) {
+        files[fnr].fname = filev[fnr];
+        files[fnr].box = run->proto;
+    }
+    run->nfiles += filec;
 
-        fv.fname = fv.filev[fv.fnr];
-        if (fv.fname[0] == '-' && fv.fname[1] == '\0') {
-            srcf = stdin;
+    rv = -1;
+    if (opt_fits) {
+        rv = textbounds_fits_filev(filec, files);
+    }
+    else if (opt_follow) {
+        rv = textbounds_follow(filec, files);
+    }
+    else if (opt_recursive && filec > 0) {
+        // Every file found gets the options of the first
+        rv = text_bounds_walk(filec, filev, &files[0], walk_jobs(), walk_flags,
+                report_file, &run->total);
+        run->io_name = "walk";
+    }
+    else if (opt_jobs > 1 && filec > 1) {
+        rv = text_bounds_filev_jobs(filec, files, opt_jobs, opt_threads,
+                !opt_unordered, report_file, &run->total);
+    }
+    else if (opt_io == IO_URING
+        || (opt_io == IO_AUTO && opt_threads <= 1 && filec >= IO_URING_MIN_FILES)) {
+        rv = text_bounds_filev_uring(filec, files, !opt_unordered, report_file, &run->total);
+        if (rv >= 0) {
+            run->io_name = "io_uring";
+        }
+        else if (opt_io == IO_URING && verbose) {
+            eprintf("%s: io_uring is not available; using synchronous I/O.\n",
+                program_name);
         }
-        else {
-            srcf = fopen(fv.fname, "r");
-            if (srcf == NULL) {
-                fprintf(stderr, "fopen('%s', r) failed.\n", fv.fname);
+    }
+
+    if (rv < 0) {
+        rv = 0;
+        for (fnr = 0; fnr < filec; ++fnr) {
+            text_bounds_file(&files[fnr], opt_threads);
+            report_file(&files[fnr], &run->total);
+            if (files[fnr].err != 0 && strcmp(files[fnr].errop, "fopen") == 0) {
                 rv = 2;
                 break;
             }
         }
+    }
+    free(files);
+    return (rv);
+}
 
-        fv.fh = srcf;
-        fv.flnr = 0;
+/*
+ * Show the results for all the files together, if asked, and clean up.
+ */
+static void
+run_end(struct tbrun *run)
+{
+    struct timespec t1;
+    uint64_t writes;
+    size_t nfiles;
+    double secs;
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    if (!opt_fits && run->nfiles > 0) {
+        report_total(&run->total, &run->proto);
+    }
+    text_bounds_out_flush(result_out);
+    text_bounds_out_flush(path_out);
+    writes = text_bounds_out_writes(result_out) + text_bounds_out_writes(path_out);
+    if (text_bounds_out_free(result_out) != 0) {
+        eprintf("%s: write error: %s\n", program_name, strerror(errno));
+        ++cmd->ioerr;
+    }
+    if (path_out != NULL) {
+        if (text_bounds_out_free(path_out) != 0 || close(path_fd) != 0) {
+            eprintf("%s: --path-table, '%s': %s\n", program_name, opt_path_table, strerror(errno));
+            ++cmd->ioerr;
+        }
+    }
+    text_bounds_format_free(result_fmt);
+    result_out = NULL;
+    result_fmt = NULL;
+    path_out = NULL;
+
+    if (run_stats != NULL) {
+        text_bounds_stats_format(run_stats, elapsed_ns(&t1));
+        text_bounds_stats_show(run_stats, errprint_fh, program_name,
+            elapsed_ns(&run->t0), writes);
+        text_bounds_stats_free(run_stats);
+        run_stats = NULL;
+    }
 
-        textbox_t textbox;
-        textbox.getchr = (int (*)(void *))textbox_getchr;
-        textbox.getchr_arg = (void *)srcf;
-        textbox.lines = 0;
-        textbox.columns = 0;
-        textbox.fmt = result_format;
-        textbox.fmt_options = fmt_options;
-        text_bounds(&textbox);
-        fclose(srcf);
-        fshow_textbounds(stdout, fv.fname, &textbox);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    if (verbose) {
+        secs = (t1.tv_sec - run->t0.tv_sec) + (t1.tv_nsec - run->t0.tv_nsec) / 1e9;
+        // With -r, not the trees, but the files in them
+        nfiles = opt_recursive ? run->total.files : run->nfiles;
+        eprintf("%s: %zu files in %.3f seconds, %.0f files/sec, %s\n",
+            program_name, nfiles, secs, secs > 0 ? nfiles / secs : 0.0, run->io_name);
     }
 
+    text_bounds_cache_close(run->cache);
+    text_bounds_hist_free(run->total.hist);
+}
+
+int
+textbounds_filev(size_t filec, char **filev)
+{
+    struct tbrun run;
+    int rv;
+
+    if (run_begin(&run) != 0) {
+        return (2);
+    }
+    rv = run_files(&run, filec, filev);
+    run_end(&run);
     return (rv);
 }
 
-void
+/*
+ * Names of files, read a buffer at a time from a list.
+ */
+struct namelist {
+    int      fd;
+    int      sep;
+    char     *buf;
+    size_t   size;
+    size_t   start;         // Next name starts here
+    size_t   end;           // End of what has been read
+    bool     eof;
+    int      err;
+};
+
+/*
+ * Return the next name in the list, which is good until the next call,
+ * or NULL at the end of the list, or on error.  With nowait, also return
+ * NULL if the next name has not all arrived yet.
+ */
+static char *
+namelist_next(struct namelist *nl, bool nowait)
+{
+    struct pollfd pfd;
+    ssize_t rsz;
+    size_t size;
+    char *name;
+    char *sep;
+    char *buf;
+
+    for (;;) {
+        name = nl->buf + nl->start;
+        sep = memchr(name, nl->sep, nl->end - nl->start);
+        if (sep != NULL) {
+            *sep = '\0';
+            nl->start = sep + 1 - nl->buf;
+            return (name);
+        }
+        if (nl->eof && nl->start < nl->end) {
+            // The last name need not end in a separator;
+            // there is always room for one more byte.
+            nl->buf[nl->end] = '\0';
+            nl->start = nl->end;
+            return (name);
+        }
+        if (nl->eof) {
+            return (NULL);
+        }
+        if (nowait) {
+            pfd.fd = nl->fd;
+            pfd.events = POLLIN;
+            if (poll(&pfd, 1, 0) == 0) {
+                return (NULL);
+            }
+        }
+
+        // Make room for more: move what is left of a name to the start,
+        // and, if that is the whole buffer, make it bigger.
+        memmove(nl->buf, nl->buf + nl->start, nl->end - nl->start);
+        nl->end -= nl->start;
+        nl->start = 0;
+        if (nl->end == nl->size) {
+            size = 2 * nl->size;
+            buf = realloc(nl->buf, size + 1);
+            if (buf == NULL) {
+                nl->err = ENOMEM;
+                return (NULL);
+            }
+            nl->buf = buf;
+            nl->size = size;
+        }
+        rsz = read(nl->fd, nl->buf + nl->end, nl->size - nl->end);
+        if (rsz < 0 && errno == EINTR) {
+            continue;
+        }
+        if (rsz < 0) {
+            nl->err = errno;
+            return (NULL);
+        }
+        if (rsz == 0) {
+            nl->eof = true;
+        }
+        nl->end += rsz;
+    }
+}
+
+/*
+ * --files0-from, --files-from: measure the files named in a list,
+ * a batch at a time.  A batch is measured as soon as it is full,
+ * or the names that have come so far are all there are for now,
+ * so that work goes on while the list is still being written.
+ */
+static int
+textbounds_files_from(const char *listname)
+{
+    struct namelist nl;
+    struct tbrun run;
+    char *names[LIST_BATCH];
+    char *name;
+    size_t n;
+    size_t i;
+    bool is_stdin;
+    int frv;
+    int rv;
+
+    memset(&nl, 0, sizeof (nl));
+    is_stdin = (strcmp(listname, "-") == 0);
+    nl.fd = is_stdin ? 0 : open(listname, O_RDONLY);
+    if (nl.fd < 0) {
+        eprintf("%s: '%s': %s\n", program_name, listname, strerror(errno));
+        return (2);
+    }
+    nl.sep = files_from_sep;
+    nl.size = 64 * 1024;
+    // One more, for a NUL after a last name that fills the buffer
+    nl.buf = malloc(nl.size + 1);
+    if (nl.buf == NULL || run_begin(&run) != 0) {
+        free(nl.buf);
+        if (!is_stdin) {
+            close(nl.fd);
+        }
+        return (2);
+    }
+
+    rv = 0;
+    n = 0;
+    do {
+        name = namelist_next(&nl, n > 0);
+        if (name != NULL && name[0] != '\0') {
+            if (is_stdin && strcmp(name, "-") == 0) {
+                eprintf("%s: '-' is not allowed in a list of files read from stdin\n",
+                    program_name);
+                rv = 2;
+                continue;
+            }
+            names[n] = strdup(name);
+            if (names[n] == NULL) {
+                nl.err = ENOMEM;
+                break;
+            }
+            ++n;
+        }
+        if (n == LIST_BATCH || (name == NULL && n > 0)) {
+            frv = run_files(&run, n, names);
+            // Whoever is reading should not have to wait for the rest
+            text_bounds_out_flush(result_out);
+            text_bounds_out_flush(path_out);
+            for (i = 0; i < n; ++i) {
+                free(names[i]);
+            }
+            n = 0;
+            if (frv > rv) {
+                rv = frv;
+            }
+            // Stop as soon as the answer is known, as with a list in argv;
+            // with -r, a tree that could not be walked is only reported.
+            if (frv != 0 && !opt_recursive) {
+                break;
+            }
+        }
+    } while (name != NULL || (!nl.eof && nl.err == 0));
+
+    for (i = 0; i < n; ++i) {
+        free(names[i]);
+    }
+    if (nl.err != 0) {
+        eprintf("%s: '%s': %s\n", program_name, listname, strerror(nl.err));
+        rv = 2;
+    }
+    run_end(&run);
+    free(nl.buf);
+    if (!is_stdin) {
+        close(nl.fd);
+    }
+    return (rv);
+}
+
+/*
+ * Return the exit status: 0 on success, 2 if any file could not
+ * be measured; with --fits, 1 if any file does not fit.
+ */
+int
 textbounds_argv(int argc, char **argv)
 {
     int rv;
@@ -504,7 +1505,7 @@ textbounds_argv(int argc, char **argv)
 
     if (rv != 0) {
         usage();
-        exit(1);
+        exit(2);
     }
 
     if (opt_show_argv) {
@@ -515,5 +1516,35 @@ textbounds_argv(int argc, char **argv)
         exit(2);
     }
 
-    textbounds_filev(cmd->argc, cmd->argv);
+    if (opt_output != TB_OUTPUT_TEXT && (result_format != NULL || fmt_options != 0)) {
+        eprintf("%s: --format, --name, --lines and --columns are only for --output=text\n",
+            program_name);
+        exit(2);
+    }
+    if ((opt_output == TB_OUTPUT_BINARY) != (opt_path_table != NULL)) {
+        eprintf("%s: --output=binary needs --path-table, and only it\n", program_name);
+        exit(2);
+    }
+    if ((opt_output == TB_OUTPUT_CSV || opt_output == TB_OUTPUT_BINARY)
+        && (opt_total || opt_histogram)) {
+        eprintf("%s: --total and --histogram are not for --output=csv or binary\n",
+            program_name);
+        exit(2);
+    }
+
+    if (opt_files_from != NULL) {
+        if (cmd->argc != 0 || opt_follow) {
+            eprintf("%s: --files0-from and --files-from take no files, and no --follow\n",
+                program_name);
+            exit(2);
+        }
+        rv = textbounds_files_from(opt_files_from);
+    }
+    else {
+        rv = textbounds_filev(cmd->argc, cmd->argv);
+    }
+    if (rv == 0 && cmd->ioerr) {
+        rv = 2;
+    }
+    return (rv);
 }
@@ -0,0 +1,535 @@
+/*
+ * Filename: textbounds-cache.c
+ * Library: libtextbounds
+ * Brief: Results of earlier runs, kept in a file, keyed by file identity.
+ *
+ * Description:
+ *   Most files in a tree do not change from one run to the next.
+ *   The cache remembers the results for each file, keyed by device,
+ *   inode, size, mtime and ctime, to the nanosecond, and by the options
+ *   that the results depend on; so, a file that has not changed
+ *   need only be stat()ed, not opened, let alone read.
+ *
+ *   The cache is a single file: a header, then an open-addressed hash
+ *   table of fixed-size entries, mapped into memory.  Lookups take
+ *   no lock at all.  Each entry carries a checksum of the rest of it,
+ *   written last, so an entry that is being written while it is read
+ *   is just a miss.  Writers, in this process or another, take a lock,
+ *   so that two of them never write the same entry at once.
+ *   When the table gets half full, a writer copies it to a new file,
+ *   twice the size, and renames that into place; others notice,
+ *   the next time they write, and map the new one.
+ *
+ *   A file modified within TB_CACHE_RACY_SEC of being measured
+ *   is not cached: it could be changed again, within the resolution
+ *   of its timestamps, without its key changing.
+ *
+ *   Results are cached only if they are complete: not with limits,
+ *   and never the distribution of line widths.
+ *   The cache is in the byte order of the machine that wrote it.
+ *
+ * Copyright (C) 2019 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE 1
+
+#include <textbounds.h>
+#include <textbounds_int.h>
+#include <errno.h>
+    // Import errno, EINVAL
+#include <fcntl.h>
+    // Import open()
+#include <pthread.h>
+    // Import pthread_mutex_lock(), pthread_mutex_unlock()
+#include <stdint.h>
+    // Import type uint64_t
+#include <stdio.h>
+    // Import snprintf(), rename()
+#include <stdlib.h>
+    // Import calloc(), malloc(), free()
+#include <string.h>
+    // Import memcmp(), memcpy(), memset(), strdup(), strlen()
+#include <sys/file.h>
+    // Import flock()
+#include <sys/mman.h>
+    // Import mmap(), munmap()
+#include <sys/stat.h>
+    // Import type struct stat, fstat(), stat()
+#include <time.h>
+    // Import time()
+#include <unistd.h>
+    // Import ftruncate(), pwrite(), close(), unlink(), getpid()
+
+#define TB_CACHE_MAGIC      "TBCACHE1"
+#define TB_CACHE_MIN_SLOTS  4096
+#define TB_CACHE_PROBE      16
+#define TB_CACHE_RACY_SEC   2
+
+struct tbcache_head {
+    char     magic[8];
+    uint64_t nslots;        // A power of 2
+    uint64_t count;         // Entries in use; kept by writers
+    uint64_t reserved[5];
+};
+
+struct tbcache_entry {
+    uint64_t check;         // Checksum of the rest; 0 for an empty slot
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    uint64_t mtime;         // Nanoseconds
+    uint64_t ctime;
+    uint64_t sig;           // Options; see tb_options_sig()
+    uint64_t measure;       // Which results there are
+    uint64_t lines;
+    uint64_t columns;
+    uint64_t widest_line;
+    uint64_t widest_offset;
+};
+
+/*
+ * One mapping of the cache file.  When the file is replaced,
+ * the old mapping is kept until the cache is closed, because lookups
+ * on other threads may still be using it.
+ */
+struct tbcache_map {
+    struct tbcache_head  *head;
+    struct tbcache_entry *slots;
+    uint64_t nslots;
+    size_t   mapsz;
+    int      fd;            // -1, once retired
+    ino_t    ino;           // of the file mapped
+    struct tbcache_map *prev;
+};
+
+struct tbcache {
+    char     *path;
+    struct tbcache_map *map;    // The current mapping
+    pthread_mutex_t lock;       // Held by writers, along with flock()
+};
+
+uint64_t
+tb_options_sig(const tbscan_t *sp)
+{
+    const struct tbtabs *tabs = sp->tabs;
+    uint64_t h = TB_FNV_BASIS;
+
+    h = tb_fnv1a_u64(h, sp->tws);
+    h = tb_fnv1a_u64(h, sp->utf8);
+    h = tb_fnv1a_u64(h, sp->eol);
+    h = tb_fnv1a_u64(h, tbtabs_kind(tabs));
+    h = tb_fnv1a_u64(h, tbtabs_width(tabs));
+    if (tbtabs_kind(tabs) == TB_TABS_LIST) {
+        h = tb_fnv1a_u64(h, tabs->last);
+        h = tb_fnv1a(h, tabs->next, tabs->last * sizeof (tabs->next[0]));
+    }
+    return (h);
+}
+
+static uint64_t
+entry_check(const struct tbcache_entry *ep)
+{
+    uint64_t h;
+
+    h = tb_fnv1a(TB_FNV_BASIS, &ep->dev, sizeof (*ep) - sizeof (ep->check));
+    return (h != 0 ? h : 1);
+}
+
+static uint64_t
+entry_home(uint64_t dev, uint64_t ino, uint64_t nslots)
+{
+    return (tb_fnv1a_u64(tb_fnv1a_u64(TB_FNV_BASIS, dev), ino) & (nslots - 1));
+}
+
+static uint64_t
+ts_nsec(const struct timespec *ts)
+{
+    return ((uint64_t)ts->tv_sec * 1000000000 + ts->tv_nsec);
+}
+
+/*
+ * The key of a file, and the options, in an entry.
+ */
+static void
+entry_key(struct tbcache_entry *ep, const struct stat *st, const textbox_t *ctxp)
+{
+    tbscan_t scan;
+
+    text_bounds_start(&scan, ctxp);
+    memset(ep, 0, sizeof (*ep));
+    ep->dev = st->st_dev;
+    ep->ino = st->st_ino;
+    ep->size = st->st_size;
+    ep->mtime = ts_nsec(&st->st_mtim);
+    ep->ctime = ts_nsec(&st->st_ctim);
+    // The same file is a different text, decompressed
+    ep->sig = tb_fnv1a_u64(tb_options_sig(&scan), ctxp->decompress);
+    ep->measure = scan.measure;
+}
+
+static bool
+same_key(const struct tbcache_entry *a, const struct tbcache_entry *b)
+{
+    return (a->dev == b->dev && a->ino == b->ino && a->size == b->size
+        && a->mtime == b->mtime && a->ctime == b->ctime && a->sig == b->sig);
+}
+
+static void
+map_free(struct tbcache_map *map)
+{
+    munmap(map->head, map->mapsz);
+    if (map->fd >= 0) {
+        close(map->fd);
+    }
+    free(map);
+}
+
+/*
+ * Map the cache file at path.  If it is empty, and nslots
+ * is not 0, set it up with that many slots.
+ * Return NULL, with errno set, on failure.
+ */
+static struct tbcache_map *
+map_file(const char *path, uint64_t nslots)
+{
+    struct tbcache_head head;
+    struct tbcache_map *map;
+    struct stat st;
+    void *addr;
+    int fd;
+    int err;
+
+    fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+    if (fd < 0) {
+        return (NULL);
+    }
+    if (fstat(fd, &st) != 0) {
+        goto fail;
+    }
+    if (st.st_size == 0 && nslots != 0) {
+        // New; whoever gets the lock first sets it up
+        flock(fd, LOCK_EX);
+        if (fstat(fd, &st) == 0 && st.st_size == 0) {
+            memset(&head, 0, sizeof (head));
+            memcpy(head.magic, TB_CACHE_MAGIC, sizeof (head.magic));
+            head.nslots = nslots;
+            st.st_size = sizeof (head) + nslots * sizeof (struct tbcache_entry);
+            if (ftruncate(fd, st.st_size) != 0
+                || pwrite(fd, &head, sizeof (head), 0) != sizeof (head)) {
+                flock(fd, LOCK_UN);
+                goto fail;
+            }
+        }
+        flock(fd, LOCK_UN);
+    }
+    if ((size_t)st.st_size < sizeof (head)) {
+        errno = EINVAL;
+        goto fail;
+    }
+
+    addr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        goto fail;
+    }
+    map = calloc(1, sizeof (*map));
+    if (map == NULL) {
+        munmap(addr, st.st_size);
+        goto fail;
+    }
+    map->head = (struct tbcache_head *)addr;
+    map->slots = (struct tbcache_entry *)(map->head + 1);
+    map->nslots = map->head->nslots;
+    map->mapsz = st.st_size;
+    map->fd = fd;
+    map->ino = st.st_ino;
+    if (memcmp(map->head->magic, TB_CACHE_MAGIC, sizeof (map->head->magic)) != 0
+        || map->nslots == 0 || (map->nslots & (map->nslots - 1)) != 0
+        || sizeof (*map->head) + map->nslots * sizeof (struct tbcache_entry) > map->mapsz) {
+        map_free(map);
+        errno = EINVAL;
+        return (NULL);
+    }
+    return (map);
+
+fail:
+    err = errno;
+    close(fd);
+    errno = err;
+    return (NULL);
+}
+
+/*
+ * Open a cache, creating it if need be.
+ * Return NULL, with errno set, on failure.
+ */
+tbcache_t *
+text_bounds_cache_open(const char *path)
+{
+    tbcache_t *cache;
+    int err;
+
+    cache = calloc(1, sizeof (*cache));
+    if (cache == NULL) {
+        return (NULL);
+    }
+    cache->path = strdup(path);
+    if (cache->path != NULL) {
+        cache->map = map_file(path, TB_CACHE_MIN_SLOTS);
+    }
+    if (cache->map == NULL) {
+        err = errno;
+        free(cache->path);
+        free(cache);
+        errno = err;
+        return (NULL);
+    }
+    pthread_mutex_init(&cache->lock, NULL);
+    return (cache);
+}
+
+void
+text_bounds_cache_close(tbcache_t *cache)
+{
+    struct tbcache_map *map;
+    struct tbcache_map *prev;
+
+    if (cache == NULL) {
+        return;
+    }
+    for (map = cache->map; map != NULL; map = prev) {
+        prev = map->prev;
+        map_free(map);
+    }
+    pthread_mutex_destroy(&cache->lock);
+    free(cache->path);
+    free(cache);
+}
+
+/*
+ * Make a new mapping the current one.  Called with cache->lock held.
+ */
+static void
+cache_replace(tbcache_t *cache, struct tbcache_map *map)
+{
+    struct tbcache_map *old = cache->map;
+
+    close(old->fd);
+    old->fd = -1;
+    map->prev = old;
+    __atomic_store_n(&cache->map, map, __ATOMIC_RELEASE);
+}
+
+/*
+ * Copy an entry out of the table, if it is whole.
+ */
+static bool
+entry_read(const struct tbcache_entry *slot, struct tbcache_entry *ep)
+{
+    uint64_t check;
+
+    check = __atomic_load_n(&slot->check, __ATOMIC_ACQUIRE);
+    if (check == 0) {
+        return (false);
+    }
+    memcpy(ep, slot, sizeof (*ep));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return (ep->check == check && entry_check(ep) == check);
+}
+
+bool
+tbcache_lookup(tbcache_t *cache, const struct stat *st, textbox_t *ctxp)
+{
+    const struct tbcache_map *map;
+    struct tbcache_entry key;
+    struct tbcache_entry ent;
+    uint64_t mask;
+    uint64_t idx;
+    uint_t i;
+
+    if (ctxp->hist != NULL || (tb_measure(ctxp) & TB_MEASURE_DIST) != 0) {
+        return (false);
+    }
+    entry_key(&key, st, ctxp);
+    map = __atomic_load_n(&cache->map, __ATOMIC_ACQUIRE);
+    mask = map->nslots - 1;
+    idx = entry_home(key.dev, key.ino, map->nslots);
+    for (i = 0; i < TB_CACHE_PROBE; ++i, idx = (idx + 1) & mask) {
+        if (!entry_read(&map->slots[idx], &ent) || !same_key(&ent, &key)) {
+            continue;
+        }
+        if ((ent.measure & key.measure) != key.measure) {
+            return (false);
+        }
+        if ((key.measure & TB_MEASURE_LINES) != 0) {
+            ctxp->lines = ent.lines;
+        }
+        if ((key.measure & TB_MEASURE_COLUMNS) != 0) {
+            ctxp->columns = ent.columns;
+            ctxp->widest_line = ent.widest_line;
+            ctxp->widest_offset = ent.widest_offset;
+        }
+        ctxp->overflow = (ctxp->max_lines != 0 && ent.lines > ctxp->max_lines)
+            || (ctxp->max_columns != 0 && ent.columns > ctxp->max_columns);
+        return (true);
+    }
+    return (false);
+}
+
+static void
+entry_write(struct tbcache_entry *slot, const struct tbcache_entry *ep)
+{
+    __atomic_store_n(&slot->check, 0, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(&slot->dev, &ep->dev, sizeof (*ep) - sizeof (ep->check));
+    __atomic_store_n(&slot->check, entry_check(ep), __ATOMIC_RELEASE);
+}
+
+/*
+ * Put an entry in the first empty slot, or the one for the same file,
+ * within TB_CACHE_PROBE of its home.  Return false if there is none.
+ */
+static bool
+map_put(struct tbcache_map *map, const struct tbcache_entry *ep)
+{
+    struct tbcache_entry ent;
+    uint64_t mask = map->nslots - 1;
+    uint64_t idx;
+    uint_t i;
+
+    idx = entry_home(ep->dev, ep->ino, map->nslots);
+    for (i = 0; i < TB_CACHE_PROBE; ++i, idx = (idx + 1) & mask) {
+        if (map->slots[idx].check == 0) {
+            ++map->head->count;
+            break;
+        }
+        if (entry_read(&map->slots[idx], &ent) && ent.dev == ep->dev && ent.ino == ep->ino) {
+            break;
+        }
+    }
+    if (i == TB_CACHE_PROBE) {
+        return (false);
+    }
+    entry_write(&map->slots[idx], ep);
+    return (true);
+}
+
+/*
+ * Copy the table to a new file, twice the size, and put that in place.
+ * Called with both locks held; the new file is not locked,
+ * but nobody can have it locked, either, before it is renamed into place.
+ */
+static int
+cache_grow(tbcache_t *cache)
+{
+    struct tbcache_map *old = cache->map;
+    struct tbcache_map *map;
+    struct tbcache_entry ent;
+    char *tmp;
+    size_t sz;
+    uint64_t i;
+    int err;
+
+    sz = strlen(cache->path) + 32;
+    tmp = malloc(sz);
+    if (tmp == NULL) {
+        return (ENOMEM);
+    }
+    snprintf(tmp, sz, "%s.%ld.tmp", cache->path, (long)getpid());
+    unlink(tmp);
+    map = map_file(tmp, old->nslots * 2);
+    if (map == NULL) {
+        err = errno;
+        free(tmp);
+        return (err);
+    }
+    for (i = 0; i < old->nslots; ++i) {
+        if (entry_read(&old->slots[i], &ent)) {
+            (void)map_put(map, &ent);
+        }
+    }
+    if (rename(tmp, cache->path) != 0) {
+        err = errno;
+        unlink(tmp);
+        map_free(map);
+        free(tmp);
+        return (err);
+    }
+    free(tmp);
+    cache_replace(cache, map);
+    return (0);
+}
+
+/*
+ * Take the lock on the cache file that is in place now,
+ * mapping it, if it is not the one that is mapped.
+ * Called with cache->lock held.
+ */
+static int
+cache_lock(tbcache_t *cache)
+{
+    struct tbcache_map *map;
+    struct stat st;
+
+    for (;;) {
+        flock(cache->map->fd, LOCK_EX);
+        if (stat(cache->path, &st) == 0 && st.st_ino == cache->map->ino) {
+            return (0);
+        }
+        // Replaced by someone else
+        flock(cache->map->fd, LOCK_UN);
+        map = map_file(cache->path, TB_CACHE_MIN_SLOTS);
+        if (map == NULL) {
+            return (errno);
+        }
+        cache_replace(cache, map);
+    }
+}
+
+/*
+ * Remember the results for a file, which was as st says, both before
+ * and after it was measured.
+ */
+void
+tbcache_store(tbcache_t *cache, const struct stat *st, const textbox_t *ctxp)
+{
+    struct tbcache_entry ent;
+    struct tbcache_map *map;
+
+    if (ctxp->hist != NULL || (tb_measure(ctxp) & TB_MEASURE_DIST) != 0
+        || ctxp->max_lines != 0 || ctxp->max_columns != 0
+        || st->st_mtim.tv_sec >= time(NULL) - TB_CACHE_RACY_SEC) {
+        return;
+    }
+    entry_key(&ent, st, ctxp);
+    ent.lines = ctxp->lines;
+    ent.columns = ctxp->columns;
+    ent.widest_line = ctxp->widest_line;
+    ent.widest_offset = ctxp->widest_offset;
+
+    pthread_mutex_lock(&cache->lock);
+    if (cache_lock(cache) == 0) {
+        map = cache->map;
+        if (map->head->count >= map->nslots / 2 || !map_put(map, &ent)) {
+            if (cache_grow(cache) == 0) {
+                (void)map_put(cache->map, &ent);
+            }
+        }
+        // Closing the old file, if it was replaced, let go of its lock
+        flock(cache->map->fd, LOCK_UN);
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
@@ -0,0 +1,519 @@
+/*
+ * Filename: textbounds-decompress.c
+ * Library: libtextbounds
+ * Brief: Measure gzip, xz and zstd compressed text, as it is decoded.
+ *
+ * Description:
+ *   Compressed input is known by its magic number, not by its name,
+ *   so it is recognized on stdin, too.  One thread decodes, and the
+ *   calling thread measures what it decodes; decoded text is passed
+ *   between them in a small ring of buffers, so that neither waits
+ *   on the other, unless it is the faster of the two, and memory
+ *   is bounded, however big the text.
+ *
+ *   Each format is decoded with its own library, if it was there
+ *   when this was built: zlib for gzip, liblzma for xz, and libzstd
+ *   for zstd (see src/config.mk).  A format that was not built in
+ *   is an error, ENOTSUP, rather than being measured as text.
+ *   Several gzip members, xz streams or zstd frames, one after
+ *   another, are decoded as one text, as zcat does.
+ *
+ * Copyright (C) 2019 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE 1
+
+#include <textbounds.h>
+#include <textbounds_int.h>
+#include <errno.h>
+    // Import errno, EINTR, EIO, ENOMEM, ENOTSUP
+#include <pthread.h>
+    // Import pthread_create(), pthread_join(), ...
+#include <stdlib.h>
+    // Import malloc(), free()
+#include <string.h>
+    // Import memcmp(), memset()
+#include <time.h>
+    // Import clock_gettime()
+#include <unistd.h>
+    // Import read()
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+    // Import inflateInit2(), inflate(), ...
+#endif
+#ifdef HAVE_LZMA
+#include <lzma.h>
+    // Import lzma_stream_decoder(), lzma_code(), ...
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+    // Import ZSTD_createDStream(), ZSTD_decompressStream(), ...
+#endif
+
+/*
+ * The size of each buffer of decoded text, and how many of them
+ * there are; also, compressed text is read this much at a time.
+ */
+#define TB_DECOMP_BUFSIZ  (256 * 1024)
+#define TB_DECOMP_NBUFS   4
+
+static const struct {
+    const char *name;
+    const char *magic;
+    size_t len;
+} formats[] = {
+    [TB_DECOMP_GZIP] = { "gzip", "\x1f\x8b", 2 },
+    [TB_DECOMP_XZ]   = { "xz",   "\xfd" "7zXZ\0", 6 },
+    [TB_DECOMP_ZSTD] = { "zstd", "\x28\xb5\x2f\xfd", 4 },
+};
+
+struct tbdecomp {
+    int      fd;
+    int      kind;          // TB_DECOMP_*
+    const char *head;       // Compressed text already read from fd
+    size_t   headsz;
+    char     *in;           // Compressed text, as read
+    char     *out;          // TB_DECOMP_NBUFS buffers of decoded text
+    size_t   len[TB_DECOMP_NBUFS];
+    size_t   filled;        // Buffers filled by the decoder, so far
+    size_t   drained;       // Buffers measured, so far
+    bool     done;          // The decoder has finished, with .err
+    bool     cancel;        // Nothing more is wanted
+    int      err;
+    off_t    in_bytes;
+    off_t    out_bytes;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+};
+
+/*
+ * What the first few bytes of a text say it is compressed with,
+ * or TB_DECOMP_NONE.
+ */
+int
+tbdecomp_kind(const char *buf, size_t sz)
+{
+    int kind;
+
+    for (kind = TB_DECOMP_GZIP; kind <= TB_DECOMP_ZSTD; ++kind) {
+        if (sz >= formats[kind].len && memcmp(buf, formats[kind].magic, formats[kind].len) == 0) {
+            return (kind);
+        }
+    }
+    return (TB_DECOMP_NONE);
+}
+
+/*
+ * Get more compressed text: first what was already read, then from fd.
+ * *szp is 0 at the end of the file.
+ */
+static int
+zd_input(struct tbdecomp *zd, const char **bufp, size_t *szp)
+{
+    ssize_t rsz;
+
+    if (zd->headsz != 0) {
+        *bufp = zd->head;
+        *szp = zd->headsz;
+        zd->in_bytes += zd->headsz;
+        zd->headsz = 0;
+        return (0);
+    }
+    do {
+        rsz = read(zd->fd, zd->in, TB_DECOMP_BUFSIZ);
+    } while (rsz < 0 && errno == EINTR);
+    if (rsz < 0) {
+        return (errno);
+    }
+    *bufp = zd->in;
+    *szp = rsz;
+    zd->in_bytes += rsz;
+    return (0);
+}
+
+/*
+ * Wait for an empty buffer to decode into.
+ * Return NULL if nothing more is wanted.
+ */
+static char *
+zd_buffer(struct tbdecomp *zd)
+{
+    char *buf;
+
+    pthread_mutex_lock(&zd->lock);
+    while (zd->filled - zd->drained == TB_DECOMP_NBUFS && !zd->cancel) {
+        pthread_cond_wait(&zd->cond, &zd->lock);
+    }
+    buf = zd->cancel ? NULL : zd->out + (zd->filled % TB_DECOMP_NBUFS) * TB_DECOMP_BUFSIZ;
+    pthread_mutex_unlock(&zd->lock);
+    return (buf);
+}
+
+/*
+ * Hand a buffer of sz bytes of decoded text over to be measured.
+ */
+static void
+zd_commit(struct tbdecomp *zd, size_t sz)
+{
+    if (sz == 0) {
+        return;
+    }
+    pthread_mutex_lock(&zd->lock);
+    zd->len[zd->filled % TB_DECOMP_NBUFS] = sz;
+    ++zd->filled;
+    zd->out_bytes += sz;
+    pthread_cond_broadcast(&zd->cond);
+    pthread_mutex_unlock(&zd->lock);
+}
+
+#ifdef HAVE_ZLIB
+static bool
+all_zero(const Bytef *buf, size_t sz)
+{
+    size_t i;
+
+    for (i = 0; i < sz; ++i) {
+        if (buf[i] != 0) {
+            return (false);
+        }
+    }
+    return (true);
+}
+
+/*
+ * Like gzip, accept zero bytes after the last member, as tar
+ * and tape tools may pad with.  No member starts with a zero byte.
+ */
+static int
+decode_gzip(struct tbdecomp *zd)
+{
+    z_stream zs;
+    const char *in;
+    size_t insz;
+    char *out;
+    bool full;
+    bool end;
+    bool padding;
+    int zret;
+    int err;
+
+    memset(&zs, 0, sizeof (zs));
+    // Only gzip gets here; 32 would also accept zlib.
+    if (inflateInit2(&zs, 15 + 16) != Z_OK) {
+        return (ENOMEM);
+    }
+    out = zd_buffer(zd);
+    zs.next_out = (Bytef *)out;
+    zs.avail_out = TB_DECOMP_BUFSIZ;
+    err = 0;
+    full = false;
+    end = false;
+    padding = false;
+    while (out != NULL) {
+        // A full buffer may have been all that stopped inflate()
+        if (zs.avail_in == 0 && !full) {
+            err = zd_input(zd, &in, &insz);
+            if (err != 0 || insz == 0) {
+                if (err == 0 && !end) {
+                    // Cut short
+                    err = EIO;
+                }
+                break;
+            }
+            zs.next_in = (Bytef *)in;
+            zs.avail_in = insz;
+        }
+        if (end && zs.avail_in != 0 && zs.next_in[0] == 0) {
+            padding = true;
+        }
+        if (padding) {
+            if (!all_zero(zs.next_in, zs.avail_in)) {
+                err = EIO;
+                break;
+            }
+            zs.avail_in = 0;
+            full = false;
+            continue;
+        }
+        zret = inflate(&zs, Z_NO_FLUSH);
+        if (zret == Z_STREAM_END) {
+            // Another member may follow
+            end = true;
+            inflateReset(&zs);
+        }
+        else if (zret == Z_OK) {
+            end = false;
+        }
+        else if (zret != Z_BUF_ERROR) {
+            err = (zret == Z_MEM_ERROR) ? ENOMEM : EIO;
+            break;
+        }
+        full = (zs.avail_out == 0);
+        if (full) {
+            zd_commit(zd, TB_DECOMP_BUFSIZ);
+            out = zd_buffer(zd);
+            zs.next_out = (Bytef *)out;
+            zs.avail_out = TB_DECOMP_BUFSIZ;
+        }
+    }
+    if (out != NULL) {
+        zd_commit(zd, TB_DECOMP_BUFSIZ - zs.avail_out);
+    }
+    inflateEnd(&zs);
+    return (err);
+}
+#endif
+
+#ifdef HAVE_LZMA
+static int
+decode_xz(struct tbdecomp *zd)
+{
+    lzma_stream xs = LZMA_STREAM_INIT;
+    lzma_action action;
+    lzma_ret xret;
+    const char *in;
+    size_t insz;
+    char *out;
+    int err;
+
+    if (lzma_stream_decoder(&xs, UINT64_MAX, LZMA_CONCATENATED) != LZMA_OK) {
+        return (ENOMEM);
+    }
+    out = zd_buffer(zd);
+    xs.next_out = (uint8_t *)out;
+    xs.avail_out = TB_DECOMP_BUFSIZ;
+    action = LZMA_RUN;
+    err = 0;
+    while (out != NULL) {
+        if (xs.avail_in == 0 && action == LZMA_RUN) {
+            err = zd_input(zd, &in, &insz);
+            if (err != 0) {
+                break;
+            }
+            if (insz == 0) {
+                action = LZMA_FINISH;
+            }
+            xs.next_in = (const uint8_t *)in;
+            xs.avail_in = insz;
+        }
+        xret = lzma_code(&xs, action);
+        if (xs.avail_out == 0 || xret != LZMA_OK) {
+            zd_commit(zd, TB_DECOMP_BUFSIZ - xs.avail_out);
+            out = (xret == LZMA_OK) ? zd_buffer(zd) : NULL;
+            xs.next_out = (uint8_t *)out;
+            xs.avail_out = TB_DECOMP_BUFSIZ;
+        }
+        if (xret == LZMA_STREAM_END) {
+            break;
+        }
+        if (xret != LZMA_OK) {
+            err = (xret == LZMA_MEM_ERROR) ? ENOMEM : EIO;
+            break;
+        }
+    }
+    lzma_end(&xs);
+    return (err);
+}
+#endif
+
+#ifdef HAVE_ZSTD
+static int
+decode_zstd(struct tbdecomp *zd)
+{
+    ZSTD_DStream *ds;
+    ZSTD_inBuffer zin = { NULL, 0, 0 };
+    ZSTD_outBuffer zout;
+    const char *in;
+    size_t insz;
+    size_t ret;
+    size_t pos;
+    bool eof;
+    int err;
+
+    ds = ZSTD_createDStream();
+    if (ds == NULL) {
+        return (ENOMEM);
+    }
+    ZSTD_initDStream(ds);
+    zout.dst = zd_buffer(zd);
+    zout.size = TB_DECOMP_BUFSIZ;
+    zout.pos = 0;
+    err = 0;
+    eof = false;
+    ret = 0;
+    while (zout.dst != NULL) {
+        if (zin.pos == zin.size && !eof) {
+            err = zd_input(zd, &in, &insz);
+            if (err != 0) {
+                break;
+            }
+            eof = (insz == 0);
+            zin.src = in;
+            zin.size = insz;
+            zin.pos = 0;
+        }
+        pos = zout.pos;
+        ret = ZSTD_decompressStream(ds, &zout, &zin);
+        if (ZSTD_isError(ret)) {
+            err = EIO;
+            break;
+        }
+        if (zout.pos == zout.size) {
+            zd_commit(zd, zout.pos);
+            zout.dst = zd_buffer(zd);
+            zout.pos = 0;
+            continue;
+        }
+        if (eof && ret == 0) {
+            break;
+        }
+        if (eof && zout.pos == pos) {
+            // Cut short
+            err = EIO;
+            break;
+        }
+    }
+    if (zout.dst != NULL) {
+        zd_commit(zd, zout.pos);
+    }
+    ZSTD_freeDStream(ds);
+    return (err);
+}
+#endif
+
+static void *
+decode_thread(void *arg)
+{
+    struct tbdecomp *zd = (struct tbdecomp *)arg;
+    int err;
+
+    switch (zd->kind) {
+#ifdef HAVE_ZLIB
+    case TB_DECOMP_GZIP:
+        err = decode_gzip(zd);
+        break;
+#endif
+#ifdef HAVE_LZMA
+    case TB_DECOMP_XZ:
+        err = decode_xz(zd);
+        break;
+#endif
+#ifdef HAVE_ZSTD
+    case TB_DECOMP_ZSTD:
+        err = decode_zstd(zd);
+        break;
+#endif
+    default:
+        err = ENOTSUP;
+        break;
+    }
+
+    pthread_mutex_lock(&zd->lock);
+    zd->err = err;
+    zd->done = true;
+    pthread_cond_broadcast(&zd->cond);
+    pthread_mutex_unlock(&zd->lock);
+    return (NULL);
+}
+
+/*
+ * Measure the text compressed in fd, from its current position,
+ * as it is decoded.  The first headsz bytes of it have already been read,
+ * into head.  The sizes of the text, compressed and not, and the time
+ * it took, are in ctxp->zstat.
+ *
+ * Return 0 on success, or an errno value.
+ */
+int
+tbdecomp_fd(int fd, int kind, const char *head, size_t headsz, textbox_t *ctxp)
+{
+    struct tbdecomp zd;
+    struct timespec t0;
+    struct timespec t1;
+    pthread_t thread;
+    tbscan_t scan;
+    const char *buf;
+    size_t sz;
+    bool ok;
+    int err;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    memset(&zd, 0, sizeof (zd));
+    zd.fd = fd;
+    zd.head = head;
+    zd.headsz = headsz;
+    zd.in = malloc(TB_DECOMP_BUFSIZ);
+    zd.out = malloc(TB_DECOMP_NBUFS * TB_DECOMP_BUFSIZ);
+    if (zd.in == NULL || zd.out == NULL) {
+        free(zd.in);
+        free(zd.out);
+        return (ENOMEM);
+    }
+    zd.kind = kind;
+    pthread_mutex_init(&zd.lock, NULL);
+    pthread_cond_init(&zd.cond, NULL);
+    err = pthread_create(&thread, NULL, decode_thread, &zd);
+    if (err != 0) {
+        pthread_cond_destroy(&zd.cond);
+        pthread_mutex_destroy(&zd.lock);
+        free(zd.in);
+        free(zd.out);
+        return (err);
+    }
+
+    text_bounds_start(&scan, ctxp);
+    ok = true;
+    pthread_mutex_lock(&zd.lock);
+    while (ok) {
+        while (zd.drained == zd.filled && !zd.done) {
+            pthread_cond_wait(&zd.cond, &zd.lock);
+        }
+        if (zd.drained == zd.filled) {
+            break;
+        }
+        buf = zd.out + (zd.drained % TB_DECOMP_NBUFS) * TB_DECOMP_BUFSIZ;
+        sz = zd.len[zd.drained % TB_DECOMP_NBUFS];
+        pthread_mutex_unlock(&zd.lock);
+
+        ok = text_bounds_feed(&scan, buf, sz);
+
+        pthread_mutex_lock(&zd.lock);
+        ++zd.drained;
+        // It does not fit; no need to decode the rest
+        zd.cancel = !ok;
+        pthread_cond_broadcast(&zd.cond);
+    }
+    pthread_mutex_unlock(&zd.lock);
+    pthread_join(thread, NULL);
+
+    err = zd.err;
+    if (err == 0) {
+        text_bounds_finish(&scan, ctxp);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        ctxp->zstat.format = formats[kind].name;
+        ctxp->zstat.in = zd.in_bytes;
+        ctxp->zstat.out = zd.out_bytes;
+        ctxp->zstat.seconds = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    }
+
+    pthread_cond_destroy(&zd.cond);
+    pthread_mutex_destroy(&zd.lock);
+    free(zd.in);
+    free(zd.out);
+    return (err);
+}
@@ -0,0 +1,720 @@
+/*
+ * Filename: textbounds-engine.c
+ * Library: libtextbounds
+ * Brief: Scan engines that measure spans of text; scalar and SIMD.
+ *
+ * Description:
+ *   The scalar engine looks at one byte at a time.
+ *
+ *   The SIMD engines classify 64 bytes at a time into bit masks
+ *   of newlines, tabs and spaces.  Everything else is "ink".
+ *   Line ends, the last ink column of each line and the width
+ *   of each line are then derived from the masks, a line at a time,
+ *   rather than a byte at a time.  A block that contains a tab
+ *   is handed to the scalar engine, because the column after a tab
+ *   depends on the column before it.
+ *
+ *   The SSE2, AVX2 and AVX-512 engines differ only in how they
+ *   compute the masks.  The best engine that the CPU supports
+ *   is chosen once, at load time.  The environment variable,
+ *   TEXTBOUNDS_ENGINE, can be used to choose an engine by name.
+ *
+ * Copyright (C) 2019 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <textbounds.h>
+#include <textbounds_int.h>
+#include <stdint.h>
+    // Import type uint64_t
+#include <stdlib.h>
+    // Import getenv()
+#include <string.h>
+    // Import strcmp(), memchr(), memcpy()
+
+#if defined(__x86_64__) || defined(__i386__)
+#define TB_X86 1
+#include <immintrin.h>
+#endif
+
+#define TB_ALWAYS_INLINE inline __attribute__((always_inline))
+
+/*
+ * The scalar engine, for one kind of tab stops and one kind of line ending.
+ * Each combination gets its own copy, with the rules built in.
+ *
+ * With CRLF, a CR right before a LF takes no column.  If a span ends
+ * with CR, it is left pending, to be settled by the next byte.
+ */
+static TB_ALWAYS_INLINE void
+tbscan_scalar_tabs(struct tbscan *sp, const unsigned char *buf, size_t sz, bool tws,
+    uint_t kind, uint_t eol)
+{
+    const struct tbtabs *tabs = sp->tabs;
+    struct tbhist *hist = sp->hist;
+    const unsigned char eolb = tb_eol_byte(eol);
+    const unsigned char *p;
+    const unsigned char *end;
+    size_t lnr;
+    size_t col;
+    size_t inkcol;
+    size_t maxcol = sp->maxcol;
+    size_t maxlnr = sp->maxlnr;
+    off_t maxoff = sp->maxoff;
+    off_t linestart = sp->linestart;
+    const off_t off = sp->off;
+    size_t tabw = (kind == TB_TABS_8) ? 8 : tabs->width;
+    size_t width;
+    bool cr;
+
+    if (eol == TB_EOL_CRLF && sz > 0) {
+        tbscan_cr_resolve(sp, buf[0]);
+    }
+    cr = sp->cr;
+    lnr = sp->lnr;
+    col = sp->col;
+    inkcol = sp->inkcol;
+
+    end = buf + sz;
+    for (p = buf; p < end; ++p) {
+        if (*p == eolb) {
+            ++lnr;
+            width = tws ? col : inkcol;
+            if (width > maxcol) {
+                maxcol = width;
+                maxlnr = lnr;
+                maxoff = linestart;
+            }
+            if (hist != NULL) {
+                tbhist_add(hist, width);
+            }
+            col = inkcol = 0;
+            linestart = off + (p - buf) + 1;
+            continue;
+        }
+        switch (*p) {
+            case '\t':
+                col = tbtabs_next(tabs, kind, tabw, col);
+                break;
+            case ' ':
+                ++col;
+                break;
+            case '\r':
+                if (eol == TB_EOL_CRLF) {
+                    if (p + 1 == end) {
+                        cr = true;
+                        break;
+                    }
+                    if (p[1] == '\n') {
+                        break;
+                    }
+                }
+                ++col;
+                inkcol = col;
+                break;
+            default:
+                ++col;
+                inkcol = col;
+        }
+    }
+
+    sp->lnr = lnr;
+    sp->col = col;
+    sp->inkcol = inkcol;
+    sp->maxcol = maxcol;
+    sp->maxlnr = maxlnr;
+    sp->maxoff = maxoff;
+    sp->linestart = linestart;
+    sp->off = off + sz;
+    sp->cr = cr;
+}
+
+static TB_ALWAYS_INLINE void
+tbscan_scalar_eol(struct tbscan *sp, const unsigned char *buf, size_t sz, bool tws,
+    uint_t eol)
+{
+    switch (tbtabs_kind(sp->tabs)) {
+    case TB_TABS_8:
+        tbscan_scalar_tabs(sp, buf, sz, tws, TB_TABS_8, eol);
+        break;
+    case TB_TABS_POW2:
+        tbscan_scalar_tabs(sp, buf, sz, tws, TB_TABS_POW2, eol);
+        break;
+    case TB_TABS_REGULAR:
+        tbscan_scalar_tabs(sp, buf, sz, tws, TB_TABS_REGULAR, eol);
+        break;
+    default:
+        tbscan_scalar_tabs(sp, buf, sz, tws, TB_TABS_LIST, eol);
+        break;
+    }
+}
+
+void
+tbscan_scalar(struct tbscan *sp, const unsigned char *buf, size_t sz, bool tws)
+{
+    switch (sp->eol) {
+    case TB_EOL_CRLF:
+        tbscan_scalar_eol(sp, buf, sz, tws, TB_EOL_CRLF);
+        break;
+    case TB_EOL_CR:
+        tbscan_scalar_eol(sp, buf, sz, tws, TB_EOL_CR);
+        break;
+    case TB_EOL_NUL:
+        tbscan_scalar_eol(sp, buf, sz, tws, TB_EOL_NUL);
+        break;
+    default:
+        tbscan_scalar_eol(sp, buf, sz, tws, TB_EOL_LF);
+        break;
+    }
+}
+
+/*
+ * Count engines.  After counting, the line in progress is empty
+ * exactly when the text so far ends with a line ending.
+ * With CRLF, every LF ends a line, so LF is what gets counted.
+ */
+static inline void
+tbcount_tail(struct tbscan *sp, const unsigned char *buf, size_t sz)
+{
+    if (sz > 0) {
+        sp->col = (buf[sz - 1] != tb_eol_byte(sp->eol));
+    }
+}
+
+void
+tbcount_scalar(struct tbscan *sp, const unsigned char *buf, size_t sz, bool tws)
+{
+    const unsigned char *p;
+    const unsigned char *end;
+    size_t lnr = sp->lnr;
+    int eolb = tb_eol_byte(sp->eol);
+
+    (void)tws;
+    end = buf + sz;
+    for (p = buf; (p = memchr(p, eolb, end - p)) != NULL; ++p) {
+        ++lnr;
+    }
+    sp->lnr = lnr;
+    tbcount_tail(sp, buf, sz);
+}
+
+/*
+ * Length of the leading run of ASCII, eight bytes at a time.
+ */
+size_t
+tbascii_scalar(const unsigned char *buf, size_t sz)
+{
+    uint64_t w;
+    size_t i;
+
+    for (i = 0; i + 8 <= sz; i += 8) {
+        memcpy(&w, buf + i, 8);
+        if ((w & 0x8080808080808080ULL) != 0) {
+            break;
+        }
+    }
+    while (i < sz && buf[i] < 0x80) {
+        ++i;
+    }
+    return (i);
+}
+
+#ifdef TB_X86
+
+/*
+ * Masks for one 64-byte block.  Bit i describes byte i.
+ * For CRLF, .crlf marks each CR that is followed by LF;
+ * for bit 63, the LF is the first byte of the next block.
+ */
+struct tbmask {
+    uint64_t nl;
+    uint64_t tab;
+    uint64_t ink;
+    uint64_t crlf;
+};
+
+/*
+ * Apply the masks of the first n bytes of a 64-byte block, at buf,
+ * to the scan state.  The block starts at offset sp->off in the text.
+ */
+static TB_ALWAYS_INLINE void
+tbscan_block(struct tbscan *sp, const unsigned char *buf,
+    const struct tbmask *m, size_t n, bool tws)
+{
+    uint64_t valid = (n < 64) ? (1ULL << n) - 1 : ~0ULL;
+    uint64_t nl = m->nl & valid;
+    uint64_t crlf = m->crlf & valid;
+    uint64_t ink = m->ink & ~crlf & valid;
+    size_t pos;
+    size_t width;
+    size_t e;
+
+    if ((m->tab & valid) != 0) {
+        tbscan_scalar(sp, buf, n, tws);
+        return;
+    }
+
+    pos = 0;
+    while (nl != 0) {
+        e = __builtin_ctzll(nl);
+        if ((ink & ((1ULL << e) - 1)) != 0) {
+            sp->inkcol = sp->col + (64 - __builtin_clzll(ink & ((1ULL << e) - 1))) - pos;
+        }
+        // Less the CR, if any, right before this LF
+        sp->col += e - pos - (size_t)(((crlf << 1) >> e) & 1);
+        width = tws ? sp->col : sp->inkcol;
+        if (width > sp->maxcol) {
+            sp->maxcol = width;
+            sp->maxlnr = sp->lnr + 1;
+            sp->maxoff = sp->linestart;
+        }
+        if (sp->hist != NULL) {
+            tbhist_add(sp->hist, width);
+        }
+        ++sp->lnr;
+        sp->col = sp->inkcol = 0;
+        sp->linestart = sp->off + e + 1;
+        ink &= ~((2ULL << e) - 1);
+        pos = e + 1;
+        nl &= nl - 1;
+    }
+
+    if (ink != 0) {
+        sp->inkcol = sp->col + (64 - __builtin_clzll(ink)) - pos;
+    }
+    sp->col += n - pos - (size_t)(crlf >> 63);
+}
+
+/*
+ * Generate a span engine from a block classifier.
+ * Whole blocks go through the classifier; so does any remainder,
+ * copied into a block of its own, so as not to read past the end.
+ * In UTF-8 mode, spans are runs of ASCII, so short remainders are common.
+ *
+ * Each kind of line ending gets its own copy of the engine;
+ * the kind is looked at once per span, not once per byte.
+ * With CRLF, a CR at the end of the span is left pending,
+ * and one left pending by a tab block, which goes to the scalar engine,
+ * is settled at the start of the next block.
+ */
+#define TBSCAN_SIMD(name, isa, classify)                                    \
+__attribute__((target(isa))) static TB_ALWAYS_INLINE void                   \
+name##_eol(struct tbscan *sp, const unsigned char *buf, size_t sz, bool tws,\
+    unsigned char eolb, bool crlf)                                          \
+{                                                                           \
+    struct tbscan scan = *sp;                                               \
+    struct tbmask m;                                                        \
+    const unsigned char *p;                                                 \
+    const unsigned char *end;                                               \
+    const unsigned char *last;                                              \
+    const off_t off = sp->off + sz;                                         \
+    bool cr = false;                                                        \
+                                                                            \
+    if (crlf && sz > 0) {                                                   \
+        tbscan_cr_resolve(&scan, buf[0]);                                   \
+        if (buf[sz - 1] == '\r') {                                          \
+            --sz;                                                           \
+            cr = true;                                                      \
+        }                                                                   \
+    }                                                                       \
+    last = buf + sz;                                                        \
+    end = buf + (sz & ~(size_t)63);                                         \
+    for (p = buf; p < end; p += 64) {                                       \
+        classify(p, &m, eolb, crlf);                                        \
+        if (crlf) {                                                         \
+            tbscan_cr_resolve(&scan, p[0]);                                 \
+            m.crlf &= (m.nl >> 1)                                           \
+                | ((p + 64 < last && p[64] == '\n') ? 1ULL << 63 : 0);      \
+        }                                                                   \
+        scan.off = sp->off + (p - buf);                                     \
+        tbscan_block(&scan, p, &m, 64, tws);                                \
+    }                                                                       \
+    if ((sz & 63) != 0) {                                                   \
+        unsigned char tail[64] = { 0 };                                     \
+                                                                            \
+        memcpy(tail, p, sz & 63);                                           \
+        classify(tail, &m, eolb, crlf);                                     \
+        if (crlf) {                                                         \
+            tbscan_cr_resolve(&scan, p[0]);                                 \
+            m.crlf &= m.nl >> 1;                                            \
+        }                                                                   \
+        scan.off = sp->off + (p - buf);                                     \
+        tbscan_block(&scan, tail, &m, sz & 63, tws);                        \
+    }                                                                       \
+    scan.off = off;                                                         \
+    if (cr) {                                                               \
+        tbscan_cr_resolve(&scan, '\r');                                     \
+        scan.cr = true;                                                     \
+    }                                                                       \
+    *sp = scan;                                                             \
+}                                                                           \
+                                                                            \
+__attribute__((target(isa))) static void                                    \
+name(struct tbscan *sp, const unsigned char *buf, size_t sz, bool tws)      \
+{                                                                           \
+    switch (sp->eol) {                                                      \
+    case TB_EOL_CRLF:                                                       \
+        name##_eol(sp, buf, sz, tws, '\n', true);                           \
+        break;                                                              \
+    case TB_EOL_CR:                                                         \
+        name##_eol(sp, buf, sz, tws, '\r', false);                          \
+        break;                                                              \
+    case TB_EOL_NUL:                                                        \
+        name##_eol(sp, buf, sz, tws, '\0', false);                          \
+        break;                                                              \
+    default:                                                                \
+        name##_eol(sp, buf, sz, tws, '\n', false);                          \
+        break;                                                              \
+    }                                                                       \
+}
+
+/*
+ * Classifiers.  Bytes equal to eolb end lines; with crlf,
+ * CRs are marked, too, for the engine to pair up with LFs.
+ */
+__attribute__((target("sse2"))) static TB_ALWAYS_INLINE void
+classify_sse2(const unsigned char *p, struct tbmask *m, unsigned char eolb, bool crlf)
+{
+    const __m128i vnl  = _mm_set1_epi8(eolb);
+    const __m128i vtab = _mm_set1_epi8('\t');
+    const __m128i vsp  = _mm_set1_epi8(' ');
+    const __m128i vcr  = _mm_set1_epi8('\r');
+    uint64_t nl = 0;
+    uint64_t tab = 0;
+    uint64_t ws = 0;
+    uint64_t cr = 0;
+    int i;
+
+    for (i = 0; i < 4; ++i) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + 16 * i));
+        __m128i cnl  = _mm_cmpeq_epi8(v, vnl);
+        __m128i ctab = _mm_cmpeq_epi8(v, vtab);
+        __m128i csp  = _mm_cmpeq_epi8(v, vsp);
+        __m128i cws  = _mm_or_si128(_mm_or_si128(cnl, ctab), csp);
+        nl  |= (uint64_t)(uint16_t)_mm_movemask_epi8(cnl)  << (16 * i);
+        tab |= (uint64_t)(uint16_t)_mm_movemask_epi8(ctab) << (16 * i);
+        ws  |= (uint64_t)(uint16_t)_mm_movemask_epi8(cws)  << (16 * i);
+        if (crlf) {
+            cr |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, vcr)) << (16 * i);
+        }
+    }
+    m->nl = nl;
+    m->tab = tab;
+    m->ink = ~ws;
+    m->crlf = cr;
+}
+
+__attribute__((target("avx2"))) static TB_ALWAYS_INLINE void
+classify_avx2(const unsigned char *p, struct tbmask *m, unsigned char eolb, bool crlf)
+{
+    const __m256i vnl  = _mm256_set1_epi8(eolb);
+    const __m256i vtab = _mm256_set1_epi8('\t');
+    const __m256i vsp  = _mm256_set1_epi8(' ');
+    const __m256i vcr  = _mm256_set1_epi8('\r');
+    uint64_t nl = 0;
+    uint64_t tab = 0;
+    uint64_t ws = 0;
+    uint64_t cr = 0;
+    int i;
+
+    for (i = 0; i < 2; ++i) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(p + 32 * i));
+        __m256i cnl  = _mm256_cmpeq_epi8(v, vnl);
+        __m256i ctab = _mm256_cmpeq_epi8(v, vtab);
+        __m256i csp  = _mm256_cmpeq_epi8(v, vsp);
+        __m256i cws  = _mm256_or_si256(_mm256_or_si256(cnl, ctab), csp);
+        nl  |= (uint64_t)(uint32_t)_mm256_movemask_epi8(cnl)  << (32 * i);
+        tab |= (uint64_t)(uint32_t)_mm256_movemask_epi8(ctab) << (32 * i);
+        ws  |= (uint64_t)(uint32_t)_mm256_movemask_epi8(cws)  << (32 * i);
+        if (crlf) {
+            cr |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, vcr)) << (32 * i);
+        }
+    }
+    m->nl = nl;
+    m->tab = tab;
+    m->ink = ~ws;
+    m->crlf = cr;
+}
+
+__attribute__((target("avx512f,avx512bw"))) static TB_ALWAYS_INLINE void
+classify_avx512(const unsigned char *p, struct tbmask *m, unsigned char eolb, bool crlf)
+{
+    __m512i v = _mm512_loadu_si512((const void *)p);
+
+    m->nl  = _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8(eolb));
+    m->tab = _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8('\t'));
+    m->ink = ~(m->nl | m->tab | _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8(' ')));
+    m->crlf = crlf ? _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8('\r')) : 0;
+}
+
+TBSCAN_SIMD(tbscan_sse2, "sse2", classify_sse2)
+TBSCAN_SIMD(tbscan_avx2, "avx2", classify_avx2)
+TBSCAN_SIMD(tbscan_avx512, "avx512f,avx512bw", classify_avx512)
+
+/*
+ * Count newlines by subtracting the result of each compare (-1)
+ * from a vector of byte counters, which are summed up
+ * before any of them can overflow.
+ */
+__attribute__((target("sse2"))) static void
+tbcount_sse2(struct tbscan *sp, const unsigned char *buf, size_t sz, bool tws)
+{
+    const __m128i vnl = _mm_set1_epi8(tb_eol_byte(sp->eol));
+    const __m128i zero = _mm_setzero_si128();
+    const unsigned char *p;
+    size_t nvec;
+    size_t n;
+
+    p = buf;
+    nvec = sz / 16;
+    while (nvec > 0) {
+        __m128i acc = zero;
+
+        n = nvec < 255 ? nvec : 255;
+        nvec -= n;
+        for (; n > 0; --n, p += 16) {
+            acc = _mm_sub_epi8(acc,
+                _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)p), vnl));
+        }
+        acc = _mm_sad_epu8(acc, zero);
+        sp->lnr += (size_t)_mm_cvtsi128_si32(acc) + (size_t)_mm_extract_epi16(acc, 4);
+    }
+    tbcount_scalar(sp, p, buf + sz - p, tws);
+    tbcount_tail(sp, buf, sz);
+}
+
+__attribute__((target("avx2"))) static void
+tbcount_avx2(struct tbscan *sp, const unsigned char *buf, size_t sz, bool tws)
+{
+    const __m256i vnl = _mm256_set1_epi8(tb_eol_byte(sp->eol));
+    const __m256i zero = _mm256_setzero_si256();
+    const unsigned char *p;
+    size_t nvec;
+    size_t n;
+
+    p = buf;
+    nvec = sz / 32;
+    while (nvec > 0) {
+        __m256i acc = zero;
+        __m128i sum;
+
+        n = nvec < 255 ? nvec : 255;
+        nvec -= n;
+        for (; n > 0; --n, p += 32) {
+            acc = _mm256_sub_epi8(acc,
+                _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)p), vnl));
+        }
+        acc = _mm256_sad_epu8(acc, zero);
+        sum = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+        sp->lnr += (size_t)_mm_cvtsi128_si32(sum) + (size_t)_mm_extract_epi16(sum, 4);
+    }
+    tbcount_scalar(sp, p, buf + sz - p, tws);
+    tbcount_tail(sp, buf, sz);
+}
+
+__attribute__((target("avx512f,avx512bw,popcnt"))) static void
+tbcount_avx512(struct tbscan *sp, const unsigned char *buf, size_t sz, bool tws)
+{
+    const __m512i vnl = _mm512_set1_epi8(tb_eol_byte(sp->eol));
+    const unsigned char *p;
+    const unsigned char *end;
+    size_t lnr = sp->lnr;
+
+    end = buf + (sz & ~(size_t)63);
+    for (p = buf; p < end; p += 64) {
+        lnr += __builtin_popcountll(
+            _mm512_cmpeq_epi8_mask(_mm512_loadu_si512((const void *)p), vnl));
+    }
+    sp->lnr = lnr;
+    tbcount_scalar(sp, p, sz & 63, tws);
+    tbcount_tail(sp, buf, sz);
+}
+
+/*
+ * Leading ASCII: whole vectors with no high bit set are skipped
+ * with one test each; the first vector with a high bit set
+ * says exactly where the run ends.
+ */
+__attribute__((target("sse2"))) static size_t
+tbascii_sse2(const unsigned char *buf, size_t sz)
+{
+    size_t i;
+    int m;
+
+    for (i = 0; i + 16 <= sz; i += 16) {
+        m = _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(buf + i)));
+        if (m != 0) {
+            return (i + __builtin_ctz(m));
+        }
+    }
+    return (i + tbascii_scalar(buf + i, sz - i));
+}
+
+__attribute__((target("avx2"))) static size_t
+tbascii_avx2(const unsigned char *buf, size_t sz)
+{
+    size_t i;
+    uint32_t m;
+
+    for (i = 0; i + 32 <= sz; i += 32) {
+        m = _mm256_movemask_epi8(_mm256_loadu_si256((const __m256i *)(buf + i)));
+        if (m != 0) {
+            return (i + __builtin_ctz(m));
+        }
+    }
+    return (i + tbascii_scalar(buf + i, sz - i));
+}
+
+__attribute__((target("avx512f,avx512bw"))) static size_t
+tbascii_avx512(const unsigned char *buf, size_t sz)
+{
+    size_t i;
+    uint64_t m;
+
+    for (i = 0; i + 64 <= sz; i += 64) {
+        m = _mm512_movepi8_mask(_mm512_loadu_si512((const void *)(buf + i)));
+        if (m != 0) {
+            return (i + __builtin_ctzll(m));
+        }
+    }
+    return (i + tbascii_scalar(buf + i, sz - i));
+}
+
+static bool
+cpu_has_sse2(void)
+{
+    return (__builtin_cpu_supports("sse2"));
+}
+
+static bool
+cpu_has_avx2(void)
+{
+    return (__builtin_cpu_supports("avx2"));
+}
+
+static bool
+cpu_has_avx512(void)
+{
+    return (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"));
+}
+
+#endif /* TB_X86 */
+
+static bool
+cpu_has_nothing(void)
+{
+    return (true);
+}
+
+struct tbengine {
+    const char *name;
+    tbscan_fn  span;
+    tbscan_fn  count;
+    tbascii_fn ascii;
+    bool       (*supported)(void);
+};
+
+/*
+ * Best engine last.
+ */
+static const struct tbengine engines[] = {
+    { "scalar", tbscan_scalar, tbcount_scalar, tbascii_scalar, cpu_has_nothing },
+#ifdef TB_X86
+    { "sse2",   tbscan_sse2,   tbcount_sse2,   tbascii_sse2,   cpu_has_sse2 },
+    { "avx2",   tbscan_avx2,   tbcount_avx2,   tbascii_avx2,   cpu_has_avx2 },
+    { "avx512", tbscan_avx512, tbcount_avx512, tbascii_avx512, cpu_has_avx512 },
+#endif
+};
+
+#define NR_ENGINES (sizeof (engines) / sizeof (engines[0]))
+
+tbscan_fn tbscan_span = tbscan_scalar;
+tbscan_fn tbcount_span = tbcount_scalar;
+tbascii_fn tbascii_span = tbascii_scalar;
+static const char *engine_name = "scalar";
+
+/*
+ * Choose a scan engine by name.
+ * Return 0 on success, -1 if there is no such engine,
+ * or if this CPU does not support it.
+ */
+int
+text_bounds_set_engine(const char *name)
+{
+    size_t i;
+
+    for (i = 0; i < NR_ENGINES; ++i) {
+        if (strcmp(engines[i].name, name) == 0 && engines[i].supported()) {
+            tbscan_span = engines[i].span;
+            tbcount_span = engines[i].count;
+            tbascii_span = engines[i].ascii;
+            engine_name = engines[i].name;
+            return (0);
+        }
+    }
+    return (-1);
+}
+
+const char *
+text_bounds_get_engine(void)
+{
+    return (engine_name);
+}
+
+/*
+ * Return the name of the idx'th engine supported by this CPU,
+ * or NULL if there are no more.
+ */
+const char *
+text_bounds_engine_list(size_t idx)
+{
+    size_t i;
+
+    for (i = 0; i < NR_ENGINES; ++i) {
+        if (engines[i].supported()) {
+            if (idx == 0) {
+                return (engines[i].name);
+            }
+            --idx;
+        }
+    }
+    return (NULL);
+}
+
+__attribute__((constructor)) static void
+text_bounds_engine_init(void)
+{
+    const char *name;
+    size_t i;
+
+#ifdef TB_X86
+    __builtin_cpu_init();
+#endif
+    for (i = NR_ENGINES; i-- > 0; ) {
+        if (engines[i].supported()) {
+            tbscan_span = engines[i].span;
+            tbcount_span = engines[i].count;
+            tbascii_span = engines[i].ascii;
+            engine_name = engines[i].name;
+            break;
+        }
+    }
+
+    name = getenv("TEXTBOUNDS_ENGINE");
+    if (name != NULL) {
+        (void)text_bounds_set_engine(name);
+    }
+}
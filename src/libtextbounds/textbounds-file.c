@@ -0,0 +1,384 @@
+/*
+ * Filename: textbounds-file.c
+ * Library: libtextbounds
+ * Brief: Measure the text in an open file.
+ *
+ * Description:
+ *   Regular files are mapped into memory, and the mapping is handed
+ *   straight to the scan engine.  No copying from the kernel, no stdio.
+ *
+ *   Everything else -- pipes, FIFOs, terminals, small files,
+ *   and files that change while they are being measured -- is read
+ *   with read(), a large buffer at a time.
+ *
+ *   A file that is truncated while it is mapped raises SIGBUS,
+ *   when we touch a page that is no longer there.  That is caught,
+ *   and the file is measured again using read().
+ *
+ * Copyright (C) 2019 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE 1
+
+#include <textbounds.h>
+#include <textbounds_int.h>
+#include <errno.h>
+    // Import errno, EINTR
+#include <pthread.h>
+    // Import pthread_once()
+#include <setjmp.h>
+    // Import sigsetjmp(), siglongjmp()
+#include <signal.h>
+    // Import sigaction(), type siginfo_t
+#include <string.h>
+    // Import memset()
+#include <sys/mman.h>
+    // Import mmap(), madvise()
+#include <sys/stat.h>
+    // Import fstat()
+#include <unistd.h>
+    // Import read(), pread(), lseek()
+
+/*
+ * Files smaller than this are cheaper to read() than to map.
+ */
+#define TB_MMAP_MIN      (64 * 1024)
+
+/*
+ * Worth asking for huge pages, for mappings at least this big.
+ */
+#define TB_HUGEPAGE_MIN  (4 * 1024 * 1024)
+
+#define TB_READ_BUFSIZ   (128 * 1024)
+
+/*
+ * The SIGBUS handler is installed once, for the whole process,
+ * and left installed; a thread that is scanning a mapping says so
+ * in sigbus_jmp, which is its own.  Installing and restoring it
+ * around each mapping would race with other threads doing the same.
+ */
+static __thread sigjmp_buf *sigbus_jmp;
+static pthread_once_t sigbus_once = PTHREAD_ONCE_INIT;
+static struct sigaction sigbus_old;
+
+static void
+sigbus_handler(int sig, siginfo_t *info, void *uctx)
+{
+    if (sigbus_jmp != NULL) {
+        siglongjmp(*sigbus_jmp, 1);
+    }
+    // Not ours; pass it on to whatever was there before
+    if ((sigbus_old.sa_flags & SA_SIGINFO) != 0 && sigbus_old.sa_sigaction != NULL) {
+        (*sigbus_old.sa_sigaction)(sig, info, uctx);
+        return;
+    }
+    if (sigbus_old.sa_handler != SIG_DFL && sigbus_old.sa_handler != SIG_IGN) {
+        (*sigbus_old.sa_handler)(sig);
+        return;
+    }
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+static void
+sigbus_install(void)
+{
+    struct sigaction sa;
+
+    memset(&sa, 0, sizeof (sa));
+    sa.sa_sigaction = sigbus_handler;
+    sa.sa_flags = SA_SIGINFO;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGBUS, &sa, &sigbus_old);
+}
+
+/*
+ * Measure a file, from its current position, using read(),
+ * after the headsz bytes in head, which have already been read.
+ * Return 0 on success, or an errno value.
+ */
+static int
+text_bounds_read(int fd, const char *head, size_t headsz, textbox_t *ctxp)
+{
+    char buf[TB_READ_BUFSIZ];
+    tbscan_t scan;
+    ssize_t rsz;
+    uint64_t t0;
+
+    t0 = 0;
+    text_bounds_start(&scan, ctxp);
+    if (headsz != 0 && !text_bounds_feed(&scan, head, headsz)) {
+        text_bounds_finish(&scan, ctxp);
+        return (0);
+    }
+    for (;;) {
+        if (ctxp->stats) {
+            t0 = tb_clock_ns();
+        }
+        rsz = read(fd, buf, sizeof (buf));
+        if (ctxp->stats) {
+            tbfstat_read(&ctxp->fstat, t0, rsz);
+        }
+        if (rsz < 0 && errno == EINTR) {
+            continue;
+        }
+        if (rsz < 0) {
+            return (errno);
+        }
+        if (rsz == 0) {
+            break;
+        }
+        if (!text_bounds_feed(&scan, buf, rsz)) {
+            break;
+        }
+    }
+    text_bounds_finish(&scan, ctxp);
+    return (0);
+}
+
+/*
+ * Read the first few bytes of the text, to see whether it is compressed.
+ * Those of a regular file are left where they are, and *headszp is 0;
+ * those of anything else cannot be put back, and are left in head.
+ * Return 0 on success, or an errno value.
+ */
+static int
+text_bounds_peek(int fd, bool regular, char *head, size_t *headszp, int *kindp,
+    struct tbfstat *fs)
+{
+    ssize_t rsz;
+    size_t sz;
+    off_t off;
+    uint64_t t0;
+
+    *kindp = TB_DECOMP_NONE;
+    off = 0;
+    if (regular) {
+        off = lseek(fd, 0, SEEK_CUR);
+        if (off < 0) {
+            return (errno);
+        }
+    }
+    sz = 0;
+    t0 = 0;
+    while (sz < TB_DECOMP_PEEK) {
+        if (fs != NULL) {
+            t0 = tb_clock_ns();
+        }
+        if (regular) {
+            rsz = pread(fd, head + sz, TB_DECOMP_PEEK - sz, off + sz);
+        }
+        else {
+            rsz = read(fd, head + sz, TB_DECOMP_PEEK - sz);
+        }
+        if (fs != NULL) {
+            // Only what cannot be read again counts as bytes read
+            tbfstat_read(fs, t0, regular ? 0 : rsz);
+        }
+        if (rsz < 0 && errno == EINTR) {
+            continue;
+        }
+        if (rsz < 0) {
+            return (errno);
+        }
+        if (rsz == 0) {
+            break;
+        }
+        sz += rsz;
+    }
+    *kindp = tbdecomp_kind(head, sz);
+    *headszp = regular ? 0 : sz;
+    return (0);
+}
+
+static bool
+same_stat(const struct stat *a, const struct stat *b)
+{
+    return (a->st_size == b->st_size
+        && a->st_mtim.tv_sec == b->st_mtim.tv_sec
+        && a->st_mtim.tv_nsec == b->st_mtim.tv_nsec);
+}
+
+/*
+ * Measure a regular file by mapping it into memory.
+ * Return 0 on success, or -1 if the caller should fall back to read().
+ */
+static int
+text_bounds_mmap(int fd, const struct stat *st, textbox_t *ctxp)
+{
+    sigjmp_buf jmp;
+    struct stat st2;
+    textbox_t result;
+    tbhist_t *hist;
+    void *map;
+    size_t sz;
+    int rv;
+
+    // If this does not work out, the file is read all over again;
+    // so, line widths go to a histogram of their own, until then.
+    hist = NULL;
+    if (ctxp->hist != NULL) {
+        hist = text_bounds_hist_new();
+        if (hist == NULL) {
+            return (-1);
+        }
+    }
+
+    sz = st->st_size;
+    map = mmap(NULL, sz, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        text_bounds_hist_free(hist);
+        return (-1);
+    }
+    (void)madvise(map, sz, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+    if (sz >= TB_HUGEPAGE_MIN) {
+        (void)madvise(map, sz, MADV_HUGEPAGE);
+    }
+#endif
+
+    pthread_once(&sigbus_once, sigbus_install);
+
+    rv = -1;
+    result = *ctxp;
+    result.hist = hist;
+    if (sigsetjmp(jmp, 1) == 0) {
+        sigbus_jmp = &jmp;
+        text_bounds_buf(map, sz, &result);
+        rv = 0;
+    }
+    sigbus_jmp = NULL;
+    munmap(map, sz);
+
+    // Did the file change while we were looking at it?
+    if (rv == 0 && (fstat(fd, &st2) != 0 || !same_stat(st, &st2))) {
+        rv = -1;
+    }
+    if (rv == 0) {
+        ctxp->lines = result.lines;
+        ctxp->columns = result.columns;
+        ctxp->widest_line = result.widest_line;
+        ctxp->widest_offset = result.widest_offset;
+        ctxp->overflow = result.overflow;
+        if (result.hist != NULL) {
+            text_bounds_hist_merge(ctxp->hist, result.hist);
+            text_bounds_hist_dist(ctxp->hist, &ctxp->dist);
+        }
+    }
+    text_bounds_hist_free(result.hist);
+    return (rv);
+}
+
+/*
+ * Measure the text of an open file, from its current position.
+ * Regular files are mapped, or measured using nthreads threads.
+ * With ctxp->decompress, compressed text is decoded as it is measured.
+ * If nothing is to be measured, nothing is read.
+ * With limits, reading stops as soon as the text does not fit.
+ *
+ * Return 0 on success, or an errno value.
+ */
+int
+text_bounds_fd(int fd, textbox_t *ctxp, uint_t nthreads)
+{
+    struct stat st;
+    char head[TB_DECOMP_PEEK];
+    size_t headsz;
+    bool regular;
+    bool whole;
+    int kind;
+    int err;
+
+    if (tb_measure(ctxp) == TB_MEASURE_NONE) {
+        return (0);
+    }
+    regular = (fstat(fd, &st) == 0 && S_ISREG(st.st_mode));
+    whole = (regular && lseek(fd, 0, SEEK_CUR) == 0);
+    if (ctxp->stats) {
+        ctxp->fstat.syscalls += regular ? 2 : 1;
+    }
+    headsz = 0;
+    if (ctxp->decompress) {
+        err = text_bounds_peek(fd, regular, head, &headsz, &kind,
+                ctxp->stats ? &ctxp->fstat : NULL);
+        if (err != 0) {
+            return (err);
+        }
+        if (kind != TB_DECOMP_NONE) {
+            err = tbdecomp_fd(fd, kind, head, headsz, ctxp);
+            if (ctxp->stats) {
+                ctxp->fstat.bytes += ctxp->zstat.in;
+            }
+            return (err);
+        }
+    }
+    if (whole && ctxp->index != NULL && ctxp->max_lines == 0 && ctxp->max_columns == 0
+        && (tb_measure(ctxp) & TB_MEASURE_DIST) == 0) {
+        if (ctxp->stats) {
+            ctxp->fstat.bytes += st.st_size;
+        }
+        return (tbindex_fd(fd, &st, ctxp, nthreads));
+    }
+    if (whole && st.st_size >= TB_MMAP_MIN) {
+        // Splitting the work would only get in the way of stopping early,
+        // and a list of tab stops cannot be split at all.
+        if (nthreads > 1 && ctxp->max_lines == 0 && ctxp->max_columns == 0
+            && tbtabs_kind(ctxp->tabs) != TB_TABS_LIST) {
+            if (ctxp->stats) {
+                ctxp->fstat.bytes += st.st_size;
+            }
+            return (text_bounds_fd_parallel(fd, st.st_size, ctxp, nthreads));
+        }
+        if (text_bounds_mmap(fd, &st, ctxp) == 0) {
+            if (ctxp->stats) {
+                // mmap(), madvise(), munmap(), fstat()
+                ctxp->fstat.syscalls += 4;
+                ctxp->fstat.bytes += st.st_size;
+            }
+            return (0);
+        }
+        if (lseek(fd, 0, SEEK_SET) < 0) {
+            return (errno);
+        }
+    }
+    return (text_bounds_read(fd, head, headsz, ctxp));
+}
+
+int
+text_bounds_fits(int fd, size_t columns, size_t lines)
+{
+    textbox_t box = { 0 };
+    int err;
+
+    if (columns == 0 && lines == 0) {
+        return (0);
+    }
+    box.max_columns = columns;
+    box.max_lines = lines;
+    if (columns != 0) {
+        box.measure |= TB_MEASURE_COLUMNS;
+    }
+    if (lines != 0) {
+        box.measure |= TB_MEASURE_LINES;
+    }
+    err = text_bounds_fd(fd, &box, 1);
+    if (err != 0) {
+        errno = err;
+        return (-1);
+    }
+    return (box.overflow ? 1 : 0);
+}
@@ -0,0 +1,389 @@
+/*
+ * Filename: textbounds-follow.c
+ * Library: libtextbounds
+ * Brief: Keep the measurements of growing files current, like tail -F.
+ *
+ * Description:
+ *   Each file is kept open, along with the scan state at its end,
+ *   including any line still being written; when it grows, only the new
+ *   text is read, and fed to the scan, just as if it had been there
+ *   all along.  A file that is truncated is measured again from the start.
+ *   A file that is replaced, as when a log is rotated, is reopened,
+ *   and the new file measured from the start; so is a file that
+ *   could not be opened before, but can now.
+ *
+ *   Waiting is done with inotify, on the directory of each file,
+ *   so that both appends and the creation of a new file by that name
+ *   wake us up.  Any event at all just means: look at every file again.
+ *   Without inotify, files are looked at every TB_FOLLOW_POLL_MS.
+ *
+ *   Anything that is not a regular file, such as stdin,
+ *   is measured once, to its end, and then left alone;
+ *   so is compressed text.
+ *
+ * Copyright (C) 2019 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE 1
+
+#include <textbounds.h>
+#include <textbounds_int.h>
+#include <errno.h>
+    // Import errno, EINTR, EIO
+#include <fcntl.h>
+    // Import open()
+#include <poll.h>
+    // Import poll()
+#include <stdlib.h>
+    // Import calloc(), malloc(), free()
+#include <string.h>
+    // Import strcpy(), strdup(), strrchr()
+#include <sys/stat.h>
+    // Import stat(), fstat()
+#include <unistd.h>
+    // Import pread(), read(), close()
+
+#ifdef __linux__
+#include <sys/inotify.h>
+    // Import inotify_init1(), inotify_add_watch()
+#endif
+
+/*
+ * Without inotify, look at the files this often.
+ */
+#define TB_FOLLOW_POLL_MS  1000
+
+/*
+ * New text is read this much at a time.
+ */
+#define TB_FOLLOW_BLOCK    (1024 * 1024)
+
+struct tbfollow_file {
+    int    fd;          // -1 if not open
+    dev_t  dev;
+    ino_t  ino;
+    off_t  off;         // How much has been measured
+    tbscan_t scan;      // The scan state there
+    bool   once;        // Not a regular file; measured once, and done
+};
+
+struct tbfollow {
+    tbfile_t *files;
+    size_t   filec;
+    struct tbfollow_file *ff;
+    int      ifd;       // inotify, or -1
+    char     *buf;
+};
+
+/*
+ * Watch the directory that a file is in.
+ */
+static void
+follow_watch(tbfollow_t *fw, const char *fname)
+{
+#ifdef __linux__
+    char *dir;
+    char *slash;
+
+    if (fw->ifd < 0) {
+        return;
+    }
+    dir = strdup(fname);
+    if (dir == NULL) {
+        return;
+    }
+    slash = strrchr(dir, '/');
+    if (slash == NULL) {
+        strcpy(dir, ".");
+    }
+    else if (slash == dir) {
+        slash[1] = '\0';
+    }
+    else {
+        *slash = '\0';
+    }
+    (void)inotify_add_watch(fw->ifd, dir,
+        IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO);
+    free(dir);
+#else
+    (void)fw;
+    (void)fname;
+#endif
+}
+
+/*
+ * Start over, from an empty file.
+ */
+static void
+follow_reset(tbfile_t *fp, struct tbfollow_file *ffp)
+{
+    fp->box.lines = 0;
+    fp->box.columns = 0;
+    fp->box.widest_line = 0;
+    fp->box.widest_offset = 0;
+    ffp->off = 0;
+    text_bounds_start(&ffp->scan, &fp->box);
+}
+
+/*
+ * Measure whatever has been appended to a file since last time.
+ * Return true if there was any.
+ */
+static bool
+follow_read(tbfollow_t *fw, tbfile_t *fp, struct tbfollow_file *ffp)
+{
+    struct stat st;
+    ssize_t rsz;
+    size_t sz;
+    bool grew;
+
+    if (fstat(ffp->fd, &st) != 0) {
+        return (false);
+    }
+    grew = false;
+    if (st.st_size < ffp->off) {
+        follow_reset(fp, ffp);
+        grew = true;
+    }
+    while (ffp->off < st.st_size) {
+        sz = st.st_size - ffp->off;
+        if (sz > TB_FOLLOW_BLOCK) {
+            sz = TB_FOLLOW_BLOCK;
+        }
+        rsz = pread(ffp->fd, fw->buf, sz, ffp->off);
+        if (rsz < 0 && errno == EINTR) {
+            continue;
+        }
+        if (rsz <= 0) {
+            // An error, or the file shrank underneath us; try again later
+            break;
+        }
+        text_bounds_feed(&ffp->scan, fw->buf, rsz);
+        ffp->off += rsz;
+        grew = true;
+    }
+    if (grew) {
+        text_bounds_finish(&ffp->scan, &fp->box);
+    }
+    return (grew);
+}
+
+/*
+ * Compressed text does not grow by appending to it;
+ * it is measured once, decoded, like anything else that does not.
+ */
+static bool
+follow_compressed(const tbfile_t *fp, int fd)
+{
+    char head[TB_DECOMP_PEEK];
+    ssize_t rsz;
+
+    if (!fp->box.decompress) {
+        return (false);
+    }
+    rsz = pread(fd, head, sizeof (head), 0);
+    return (rsz > 0 && tbdecomp_kind(head, rsz) != TB_DECOMP_NONE);
+}
+
+/*
+ * (Re)open a file, and measure it from the start.
+ * Return true if there is anything new to report.
+ */
+static bool
+follow_open(tbfollow_t *fw, tbfile_t *fp, struct tbfollow_file *ffp)
+{
+    struct stat st;
+    bool is_stdin;
+    int fd;
+    int err;
+
+    if (ffp->fd >= 0) {
+        close(ffp->fd);
+        ffp->fd = -1;
+    }
+    is_stdin = (fp->fname[0] == '-' && fp->fname[1] == '\0');
+    if (is_stdin) {
+        fd = 0;
+    }
+    else {
+        fd = open(fp->fname, O_RDONLY);
+    }
+    if (fd < 0) {
+        err = errno;
+        if (fp->err == err) {
+            return (false);
+        }
+        fp->err = err;
+        fp->errop = "fopen";
+        return (true);
+    }
+    fp->err = 0;
+    fp->errop = NULL;
+
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || follow_compressed(fp, fd)) {
+        follow_reset(fp, ffp);
+        err = text_bounds_fd(fd, &fp->box, 1);
+        if (err != 0) {
+            fp->err = err;
+            fp->errop = "read";
+        }
+        if (!is_stdin) {
+            close(fd);
+        }
+        ffp->once = true;
+        return (true);
+    }
+
+    ffp->fd = fd;
+    ffp->dev = st.st_dev;
+    ffp->ino = st.st_ino;
+    follow_reset(fp, ffp);
+    follow_read(fw, fp, ffp);
+    return (true);
+}
+
+/*
+ * Bring one file up to date.
+ * Return true if there is anything new to report.
+ */
+static bool
+follow_update(tbfollow_t *fw, tbfile_t *fp, struct tbfollow_file *ffp)
+{
+    struct stat st;
+
+    if (ffp->once) {
+        return (false);
+    }
+    if (stat(fp->fname, &st) != 0) {
+        // Gone, for now; keep what we have
+        return (ffp->fd >= 0 ? follow_read(fw, fp, ffp) : false);
+    }
+    if (ffp->fd < 0 || st.st_dev != ffp->dev || st.st_ino != ffp->ino) {
+        // Replaced, or there at last
+        return (follow_open(fw, fp, ffp));
+    }
+    return (follow_read(fw, fp, ffp));
+}
+
+/*
+ * Open and measure each file, and start watching them.
+ * The width distribution is not kept.
+ */
+tbfollow_t *
+text_bounds_follow_new(size_t filec, tbfile_t *files)
+{
+    tbfollow_t *fw;
+    size_t i;
+
+    fw = calloc(1, sizeof (*fw));
+    if (fw == NULL) {
+        return (NULL);
+    }
+    fw->files = files;
+    fw->filec = filec;
+    fw->ff = calloc(filec, sizeof (fw->ff[0]));
+    fw->buf = malloc(TB_FOLLOW_BLOCK);
+    if (fw->ff == NULL || fw->buf == NULL) {
+        free(fw->ff);
+        free(fw->buf);
+        free(fw);
+        return (NULL);
+    }
+#ifdef __linux__
+    fw->ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#else
+    fw->ifd = -1;
+#endif
+
+    for (i = 0; i < filec; ++i) {
+        files[i].box.measure &= ~TB_MEASURE_DIST;
+        files[i].box.hist = NULL;
+        files[i].box.index = NULL;
+        files[i].err = 0;
+        fw->ff[i].fd = -1;
+        follow_watch(fw, files[i].fname);
+        follow_open(fw, &files[i], &fw->ff[i]);
+    }
+    return (fw);
+}
+
+/*
+ * Wait up to timeout_ms (forever, if negative) for any file to change,
+ * then bring every file up to date, and report those that changed,
+ * if report is not NULL.
+ * Return how many files changed, or -1 on error.
+ */
+int
+text_bounds_follow_poll(tbfollow_t *fw, int timeout_ms,
+    tbfile_report_fn report, void *report_arg)
+{
+    struct pollfd pfd;
+    char evbuf[4096];
+    size_t i;
+    int n;
+
+    if (fw->ifd >= 0) {
+        pfd.fd = fw->ifd;
+        pfd.events = POLLIN;
+        n = poll(&pfd, 1, timeout_ms);
+        if (n < 0 && errno != EINTR) {
+            return (-1);
+        }
+        // What changed does not matter; every file is looked at.
+        while (read(fw->ifd, evbuf, sizeof (evbuf)) > 0) {
+            continue;
+        }
+    }
+    else {
+        if (timeout_ms < 0 || timeout_ms > TB_FOLLOW_POLL_MS) {
+            timeout_ms = TB_FOLLOW_POLL_MS;
+        }
+        (void)poll(NULL, 0, timeout_ms);
+    }
+
+    n = 0;
+    for (i = 0; i < fw->filec; ++i) {
+        if (follow_update(fw, &fw->files[i], &fw->ff[i])) {
+            ++n;
+            if (report != NULL) {
+                (*report)(&fw->files[i], report_arg);
+            }
+        }
+    }
+    return (n);
+}
+
+void
+text_bounds_follow_free(tbfollow_t *fw)
+{
+    size_t i;
+
+    if (fw == NULL) {
+        return;
+    }
+    for (i = 0; i < fw->filec; ++i) {
+        if (fw->ff[i].fd > 0) {
+            close(fw->ff[i].fd);
+        }
+    }
+    if (fw->ifd >= 0) {
+        close(fw->ifd);
+    }
+    free(fw->ff);
+    free(fw->buf);
+    free(fw);
+}
@@ -0,0 +1,225 @@
+/*
+ * Filename: textbounds-hist.c
+ * Library: libtextbounds
+ * Brief: Histograms of line widths, and their quantiles.
+ *
+ * Description:
+ *   The scan engines add the width of each line to a histogram
+ *   as they go (see tbhist_add()), so the distribution costs
+ *   no second pass over the text.  Memory is fixed: an exact counter
+ *   for each width below TB_HIST_EXACT, then log-linear buckets,
+ *   64 to each power of 2.  Merging is just adding counters,
+ *   so it does not matter how the text was split up, between
+ *   threads, or between files.
+ *
+ * Copyright (C) 2019 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <textbounds.h>
+#include <textbounds_int.h>
+#include <errno.h>
+    // Import ENOMEM
+#include <stdlib.h>
+    // Import calloc(), free()
+#include <string.h>
+    // Import memset()
+
+tbhist_t *
+text_bounds_hist_new(void)
+{
+    struct tbhist *hist;
+
+    hist = calloc(1, sizeof (*hist));
+    if (hist == NULL) {
+        return (NULL);
+    }
+    pthread_mutex_init(&hist->lock, NULL);
+    return (hist);
+}
+
+void
+text_bounds_hist_free(tbhist_t *hist)
+{
+    if (hist != NULL) {
+        pthread_mutex_destroy(&hist->lock);
+        free(hist);
+    }
+}
+
+void
+text_bounds_hist_clear(tbhist_t *hist)
+{
+    hist->lines = 0;
+    hist->max = 0;
+    hist->sum = 0;
+    memset(hist->exact, 0, sizeof (hist->exact));
+    memset(hist->log, 0, sizeof (hist->log));
+}
+
+void
+text_bounds_hist_merge(tbhist_t *dst, const tbhist_t *src)
+{
+    size_t i;
+
+    pthread_mutex_lock(&dst->lock);
+    dst->lines += src->lines;
+    dst->sum += src->sum;
+    if (src->max > dst->max) {
+        dst->max = src->max;
+    }
+    for (i = 0; i < TB_HIST_EXACT; ++i) {
+        dst->exact[i] += src->exact[i];
+    }
+    for (i = 0; i < TB_HIST_LOG; ++i) {
+        dst->log[i] += src->log[i];
+    }
+    pthread_mutex_unlock(&dst->lock);
+}
+
+/*
+ * Bin idx counts the widths *lop through *hip.
+ * Return its count.
+ */
+static size_t
+hist_bin(const struct tbhist *hist, size_t idx, size_t *lop, size_t *hip)
+{
+    uint_t msb;
+    size_t step;
+
+    if (idx < TB_HIST_EXACT) {
+        *lop = *hip = idx;
+        return (hist->exact[idx]);
+    }
+    idx -= TB_HIST_EXACT;
+    msb = idx / TB_HIST_SUB + TB_HIST_EXACT_BITS;
+    step = (size_t)1 << (msb - TB_HIST_SUB_BITS);
+    *lop = (TB_HIST_SUB + idx % TB_HIST_SUB) * step;
+    *hip = *lop + (step - 1);
+    return (hist->log[idx]);
+}
+
+bool
+text_bounds_hist_bin(const tbhist_t *hist, size_t *idxp,
+    size_t *lop, size_t *hip, size_t *countp)
+{
+    size_t idx;
+    size_t count;
+
+    for (idx = *idxp; idx < TB_HIST_EXACT + TB_HIST_LOG; ++idx) {
+        count = hist_bin(hist, idx, lop, hip);
+        if (count != 0) {
+            if (*hip > hist->max) {
+                *hip = hist->max;
+            }
+            *countp = count;
+            *idxp = idx + 1;
+            return (true);
+        }
+    }
+    *idxp = idx;
+    return (false);
+}
+
+/*
+ * Nearest rank.  Within a bucket, guess the middle,
+ * but never more than the widest line actually seen.
+ */
+size_t
+text_bounds_hist_quantile(const tbhist_t *hist, double q)
+{
+    double x;
+    size_t rank;
+    size_t seen;
+    size_t idx;
+    size_t lo;
+    size_t hi;
+    size_t mid;
+
+    if (hist->lines == 0) {
+        return (0);
+    }
+    x = q * (double)hist->lines;
+    rank = (x > 0.0) ? (size_t)x : 0;
+    if ((double)rank < x) {
+        ++rank;
+    }
+    if (rank < 1) {
+        rank = 1;
+    }
+    if (rank > hist->lines) {
+        rank = hist->lines;
+    }
+
+    seen = 0;
+    for (idx = 0; idx < TB_HIST_EXACT + TB_HIST_LOG; ++idx) {
+        seen += hist_bin(hist, idx, &lo, &hi);
+        if (seen >= rank) {
+            mid = lo + (hi - lo) / 2;
+            return (mid < hist->max ? mid : hist->max);
+        }
+    }
+    return (hist->max);
+}
+
+void
+text_bounds_hist_dist(const tbhist_t *hist, tbdist_t *dist)
+{
+    dist->lines = hist->lines;
+    dist->max = hist->max;
+    dist->mean = (hist->lines != 0) ? (double)hist->sum / (double)hist->lines : 0.0;
+    dist->p50 = text_bounds_hist_quantile(hist, 0.50);
+    dist->p90 = text_bounds_hist_quantile(hist, 0.90);
+    dist->p99 = text_bounds_hist_quantile(hist, 0.99);
+    dist->p999 = text_bounds_hist_quantile(hist, 0.999);
+}
+
+/*
+ * Give a file a histogram of its own, for as long as it is being
+ * measured; the one it had, if any, is returned in *sharedp.
+ * Return 0, or ENOMEM, in which case there is no histogram at all.
+ */
+int
+tbfile_hist_begin(tbfile_t *fp, tbhist_t **sharedp)
+{
+    *sharedp = fp->box.hist;
+    if ((tb_measure(&fp->box) & TB_MEASURE_DIST) == 0) {
+        return (0);
+    }
+    fp->box.hist = text_bounds_hist_new();
+    return (fp->box.hist != NULL ? 0 : ENOMEM);
+}
+
+/*
+ * The file is measured.  If all went well, merge its histogram
+ * into the shared one.
+ */
+void
+tbfile_hist_end(tbfile_t *fp, tbhist_t *shared, bool ok)
+{
+    tbhist_t *own = fp->box.hist;
+
+    if (own == shared) {
+        return;
+    }
+    if (own != NULL) {
+        if (ok && shared != NULL) {
+            text_bounds_hist_merge(shared, own);
+        }
+        text_bounds_hist_free(own);
+    }
+    fp->box.hist = shared;
+}
@@ -0,0 +1,382 @@
+/*
+ * Filename: textbounds-index.c
+ * Library: libtextbounds
+ * Brief: Sidecar indexes, to measure only what has been appended to a file.
+ *
+ * Description:
+ *   Logs only grow, and get measured over and over.  An index remembers,
+ *   for each file, how far it has been measured, and the results
+ *   up to there; the next time, measurement resumes from there,
+ *   so it costs only as much as the text that has been appended.
+ *
+ *   An index always ends at the end of a line, where the scan state
+ *   is just the results so far: the partial line at the end of a file
+ *   that is still being written is measured each time, but never saved.
+ *
+ *   Indexes live in a directory of their own, one file for each
+ *   file measured, named by its device and inode number; so, a log that
+ *   is renamed by rotation keeps its index.  An index is thrown away,
+ *   and the file measured from the start, if the file is now shorter
+ *   than the index says, if the block of text just before where the index
+ *   ends has changed, or if the options that the results depend on
+ *   are not the same.
+ *
+ *   Indexes are written to a temporary file, then renamed into place,
+ *   so they are never seen half-written.  They are a cache: failing
+ *   to read or write one costs time, but never changes the results.
+ *   They are in the byte order of the machine that wrote them.
+ *
+ * Copyright (C) 2019 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE 1
+
+#include <textbounds.h>
+#include <textbounds_int.h>
+#include <errno.h>
+    // Import errno, ENOMEM, EIO, EINTR
+#include <fcntl.h>
+    // Import open()
+#include <stdint.h>
+    // Import type uint64_t, uintmax_t
+#include <stdio.h>
+    // Import snprintf(), rename()
+#include <stdlib.h>
+    // Import malloc(), free()
+#include <string.h>
+    // Import memcmp(), memcpy(), memset(), memrchr(), strlen()
+#include <sys/stat.h>
+    // Import type struct stat, mkdir()
+#include <unistd.h>
+    // Import pread(), write(), close(), unlink(), getpid()
+
+/*
+ * The checksum of this much text, just before where an index ends,
+ * tells whether the file was rewritten.
+ */
+#define TB_INDEX_TAIL   4096
+
+/*
+ * Text measured after the index, this much at a time.
+ */
+#define TB_INDEX_BLOCK  (256 * 1024)
+
+#define TB_INDEX_MAGIC  "TBINDEX1"
+
+struct tbindex {
+    char     magic[8];
+    uint64_t sig;           // Options that the results depend on
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t off;           // Measured up to here, the end of a line
+    uint64_t tail;          // Checksum of the text before .off
+    uint64_t lines;
+    uint64_t columns;
+    uint64_t widest_line;
+    uint64_t widest_offset;
+    uint32_t eol;           // What ends a line, with TB_EOL_AUTO decided
+    uint32_t measure;
+};
+
+/*
+ * Everything, other than the text, that the results depend on,
+ * including which results there are.
+ */
+static uint64_t
+index_sig(const tbscan_t *sp)
+{
+    return (tb_fnv1a_u64(tb_options_sig(sp), sp->measure));
+}
+
+/*
+ * pread() all of sz bytes, or fail.
+ */
+static int
+pread_full(int fd, char *buf, size_t sz, off_t off)
+{
+    ssize_t rsz;
+
+    while (sz > 0) {
+        rsz = pread(fd, buf, sz, off);
+        if (rsz < 0 && errno == EINTR) {
+            continue;
+        }
+        if (rsz <= 0) {
+            // An error, or the file shrank underneath us
+            return ((rsz < 0) ? errno : EIO);
+        }
+        buf += rsz;
+        off += rsz;
+        sz -= rsz;
+    }
+    return (0);
+}
+
+/*
+ * Checksum of the text just before off.
+ */
+static int
+index_tail(int fd, off_t off, uint64_t *sump)
+{
+    char buf[TB_INDEX_TAIL];
+    size_t sz;
+    int err;
+
+    sz = (off < TB_INDEX_TAIL) ? (size_t)off : TB_INDEX_TAIL;
+    err = pread_full(fd, buf, sz, off - sz);
+    if (err == 0) {
+        *sump = tb_fnv1a(TB_FNV_BASIS, buf, sz);
+    }
+    return (err);
+}
+
+static char *
+index_path(const char *dir, const struct stat *st)
+{
+    size_t sz;
+    char *path;
+
+    sz = strlen(dir) + 2 * 16 + 8;
+    path = malloc(sz);
+    if (path != NULL) {
+        snprintf(path, sz, "%s/%jx-%jx", dir,
+            (uintmax_t)st->st_dev, (uintmax_t)st->st_ino);
+    }
+    return (path);
+}
+
+/*
+ * Read the index at path, and check that it still holds for the file.
+ */
+static bool
+index_load(const char *path, int fd, const struct stat *st, uint64_t sig,
+    struct tbindex *idx)
+{
+    uint64_t tail;
+    ssize_t rsz;
+    int ifd;
+
+    ifd = open(path, O_RDONLY);
+    if (ifd < 0) {
+        return (false);
+    }
+    rsz = read(ifd, idx, sizeof (*idx));
+    close(ifd);
+    if (rsz != sizeof (*idx)
+        || memcmp(idx->magic, TB_INDEX_MAGIC, sizeof (idx->magic)) != 0
+        || idx->sig != sig
+        || idx->dev != (uint64_t)st->st_dev
+        || idx->ino != (uint64_t)st->st_ino
+        || idx->off > (uint64_t)st->st_size) {
+        return (false);
+    }
+    return (index_tail(fd, idx->off, &tail) == 0 && tail == idx->tail);
+}
+
+static void
+index_save(const char *path, int fd, const struct tbindex *idx)
+{
+    struct tbindex rec = *idx;
+    char *tmp;
+    size_t sz;
+    int ifd;
+    bool ok;
+
+    if (index_tail(fd, rec.off, &rec.tail) != 0) {
+        return;
+    }
+    sz = strlen(path) + 32;
+    tmp = malloc(sz);
+    if (tmp == NULL) {
+        return;
+    }
+    snprintf(tmp, sz, "%s.%ld.tmp", path, (long)getpid());
+    ifd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (ifd >= 0) {
+        ok = (write(ifd, &rec, sizeof (rec)) == sizeof (rec));
+        ok = (close(ifd) == 0) && ok;
+        if (!ok || rename(tmp, path) != 0) {
+            unlink(tmp);
+        }
+    }
+    free(tmp);
+}
+
+/*
+ * Measure the text of fd from off to end, continuing from the results
+ * in ctxp.  Offsets in the results are offsets in the file.
+ */
+static int
+index_scan(int fd, off_t off, off_t end, textbox_t *ctxp)
+{
+    tbscan_t scan;
+    char *buf;
+    size_t sz;
+    int err;
+
+    buf = malloc(TB_INDEX_BLOCK);
+    if (buf == NULL) {
+        return (ENOMEM);
+    }
+    err = 0;
+    text_bounds_start(&scan, ctxp);
+    scan.off = scan.linestart = off;
+    while (off < end) {
+        sz = (end - off < TB_INDEX_BLOCK) ? (size_t)(end - off) : TB_INDEX_BLOCK;
+        err = pread_full(fd, buf, sz, off);
+        if (err != 0) {
+            break;
+        }
+        text_bounds_feed(&scan, buf, sz);
+        off += sz;
+    }
+    if (err == 0) {
+        text_bounds_finish(&scan, ctxp);
+    }
+    free(buf);
+    return (err);
+}
+
+/*
+ * Find the end of the last complete line between off and end.
+ * Return off, if there is none.
+ */
+static int
+index_last_line(int fd, off_t off, off_t end, int eolb, off_t *lastp)
+{
+    char buf[TB_INDEX_TAIL];
+    const char *nl;
+    size_t sz;
+    int err;
+
+    while (end > off) {
+        sz = (end - off < TB_INDEX_TAIL) ? (size_t)(end - off) : TB_INDEX_TAIL;
+        err = pread_full(fd, buf, sz, end - sz);
+        if (err != 0) {
+            return (err);
+        }
+        nl = memrchr(buf, eolb, sz);
+        if (nl != NULL) {
+            *lastp = end - sz + (nl + 1 - buf);
+            return (0);
+        }
+        end -= sz;
+    }
+    *lastp = off;
+    return (0);
+}
+
+/*
+ * Measure a regular file, open at offset 0, with an index kept
+ * in the directory ctxp->index.  The results are for the file alone.
+ *
+ * Return 0 on success, or an errno value.
+ */
+int
+tbindex_fd(int fd, const struct stat *st, textbox_t *ctxp, uint_t nthreads)
+{
+    struct tbindex idx;
+    tbscan_t scan;
+    textbox_t box;
+    char peek[TB_EOL_PEEK];
+    char *path;
+    off_t last;
+    uint64_t sig;
+    size_t sz;
+    int err;
+
+    path = index_path(ctxp->index, st);
+    if (path == NULL) {
+        return (ENOMEM);
+    }
+    (void)mkdir(ctxp->index, 0777);
+
+    box = *ctxp;
+    box.index = NULL;
+    box.lines = 0;
+    box.columns = 0;
+    box.widest_line = 0;
+    box.widest_offset = 0;
+    text_bounds_start(&scan, &box);
+    sig = index_sig(&scan);
+
+    if (index_load(path, fd, st, sig, &idx)) {
+        box.eol = idx.eol;
+        box.lines = idx.lines;
+        box.columns = idx.columns;
+        box.widest_line = idx.widest_line;
+        box.widest_offset = idx.widest_offset;
+    }
+    else {
+        memset(&idx, 0, sizeof (idx));
+        memcpy(idx.magic, TB_INDEX_MAGIC, sizeof (idx.magic));
+        idx.sig = sig;
+        idx.dev = st->st_dev;
+        idx.ino = st->st_ino;
+        idx.measure = scan.measure;
+        if (box.eol == TB_EOL_AUTO) {
+            // Decided once, for good
+            sz = (st->st_size < TB_EOL_PEEK) ? (size_t)st->st_size : TB_EOL_PEEK;
+            err = pread_full(fd, peek, sz, 0);
+            if (err != 0) {
+                free(path);
+                return (err);
+            }
+            tbscan_eol_detect(&scan, peek, sz);
+            box.eol = scan.eol;
+        }
+    }
+    idx.eol = box.eol;
+
+    // Complete lines, which go into the index ...
+    err = index_last_line(fd, idx.off, st->st_size, tb_eol_byte(box.eol), &last);
+    if (err == 0 && last > (off_t)idx.off) {
+        if (idx.off == 0) {
+            err = text_bounds_fd_parallel(fd, last, &box, nthreads);
+        }
+        else {
+            err = index_scan(fd, idx.off, last, &box);
+        }
+        if (err == 0) {
+            idx.off = last;
+            idx.lines = box.lines;
+            idx.columns = box.columns;
+            idx.widest_line = box.widest_line;
+            idx.widest_offset = box.widest_offset;
+            index_save(path, fd, &idx);
+        }
+    }
+    // ... then, whatever is left of a line still being written.
+    if (err == 0 && st->st_size > last) {
+        err = index_scan(fd, last, st->st_size, &box);
+    }
+    free(path);
+    if (err != 0) {
+        return (err);
+    }
+
+    if ((scan.measure & TB_MEASURE_LINES) != 0) {
+        ctxp->lines = box.lines;
+    }
+    if ((scan.measure & TB_MEASURE_COLUMNS) != 0) {
+        ctxp->columns = box.columns;
+        ctxp->widest_line = box.widest_line;
+        ctxp->widest_offset = box.widest_offset;
+    }
+    ctxp->overflow = false;
+    return (0);
+}
@@ -0,0 +1,360 @@
+/*
+ * Filename: textbounds-jobs.c
+ * Library: libtextbounds
+ * Brief: Measure a list of files using a pool of worker threads.
+ *
+ * Description:
+ *   All the files are stat()ed first, and the work queue is sorted
+ *   by size, largest first, so that one giant file does not end up
+ *   being started last, while every other thread sits idle.
+ *   The small files at the end of the queue are claimed in batches,
+ *   to keep the cost of taking work off the queue small.
+ *
+ *   Workers claim work from the shared queue with an atomic increment,
+ *   so a worker that finishes early simply takes more; no worker
+ *   is ever left holding a backlog that others could be doing.
+ *
+ *   Results are reported in the original order, using a reorder
+ *   buffer -- the array of files itself -- unless the caller asks
+ *   for results in whatever order they finish.
+ *
+ * Copyright (C) 2019 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE 1
+
+#include <textbounds.h>
+#include <textbounds_int.h>
+#include <errno.h>
+    // Import errno
+#include <fcntl.h>
+    // Import openat(), AT_FDCWD
+#include <pthread.h>
+    // Import pthread_create(), pthread_join(), ...
+#include <stdlib.h>
+    // Import qsort_r(), calloc(), free()
+#include <string.h>
+    // Import strcmp(), memset()
+#include <sys/stat.h>
+    // Import fstatat(), fstat()
+#include <unistd.h>
+    // Import close()
+
+/*
+ * Files smaller than this are claimed from the queue in batches.
+ */
+#define TB_TINY_FILE   (16 * 1024)
+#define TB_TINY_BATCH  32
+
+struct tbpool {
+    tbfile_t *files;
+    size_t   filec;
+    size_t   *order;        // Indices of files, largest first
+    size_t   next;          // Next entry of order[] to be claimed
+    uint_t   nthreads;      // Threads per file
+    bool     ordered;
+    bool     cancel;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    tbfile_report_fn report;
+    void     *report_arg;
+};
+
+/*
+ * Measure one file, name, in the directory dirfd, as for openat().
+ * With a cache, a regular file whose results are in it is not even opened.
+ * Return 0 on success, or an errno value,
+ * which is also recorded in the tbfile_t, along with the failed operation.
+ */
+int
+tbfile_at(int dirfd, const char *name, tbfile_t *fp, uint_t nthreads)
+{
+    struct tbfstat *fs;
+    struct stat st;
+    struct stat st2;
+    tbhist_t *shared;
+    uint64_t t0;
+    uint64_t t1;
+    bool store;
+    bool is_stdin;
+    int fd;
+    int err;
+
+    // .stats: open_ns is all the time outside text_bounds_fd(),
+    // and measure_ns is all the time inside it, but for reading.
+    fs = NULL;
+    t0 = 0;
+    if (fp->box.stats) {
+        fs = &fp->box.fstat;
+        memset(fs, 0, sizeof (*fs));
+        t0 = tb_clock_ns();
+    }
+
+    store = false;
+    is_stdin = (dirfd == AT_FDCWD && name[0] == '-' && name[1] == '\0');
+    if (is_stdin) {
+        fd = 0;
+    }
+    else {
+        if (fp->box.cache != NULL && fstatat(dirfd, name, &st, 0) == 0 && S_ISREG(st.st_mode)) {
+            if (tbcache_lookup(fp->box.cache, &st, &fp->box)) {
+                if (fs != NULL) {
+                    fs->open_ns = tb_clock_ns() - t0;
+                    fs->syscalls = 1;
+                }
+                return (0);
+            }
+            store = true;
+        }
+        fd = openat(dirfd, name, O_RDONLY);
+        if (fs != NULL) {
+            fs->syscalls += (fp->box.cache != NULL) ? 2 : 1;
+        }
+        if (fd < 0) {
+            fp->err = errno;
+            fp->errop = "fopen";
+            if (fs != NULL) {
+                fs->open_ns = tb_clock_ns() - t0;
+            }
+            return (fp->err);
+        }
+    }
+
+    // What gets cached is what the file was when it was opened
+    store = store && fstat(fd, &st) == 0;
+    err = tbfile_hist_begin(fp, &shared);
+    t1 = 0;
+    if (fs != NULL) {
+        t1 = tb_clock_ns();
+        fs->open_ns = t1 - t0;
+        fs->syscalls += store ? 1 : 0;
+    }
+    if (err == 0) {
+        err = text_bounds_fd(fd, &fp->box, nthreads);
+    }
+    if (fs != NULL) {
+        t0 = tb_clock_ns();
+        fs->measure_ns = t0 - t1 - fs->read_ns;
+    }
+    tbfile_hist_end(fp, shared, err == 0);
+    if (err == 0 && store && fstat(fd, &st2) == 0 && st2.st_size == st.st_size
+        && st2.st_mtim.tv_sec == st.st_mtim.tv_sec && st2.st_mtim.tv_nsec == st.st_mtim.tv_nsec) {
+        tbcache_store(fp->box.cache, &st, &fp->box);
+    }
+    if (err != 0) {
+        fp->err = err;
+        fp->errop = "read";
+    }
+    if (!is_stdin) {
+        close(fd);
+    }
+    if (fs != NULL) {
+        fs->open_ns += tb_clock_ns() - t0;
+        fs->syscalls += (store ? 1 : 0) + (is_stdin ? 0 : 1);
+    }
+    return (err);
+}
+
+/*
+ * Measure one file.
+ */
+int
+text_bounds_file(tbfile_t *fp, uint_t nthreads)
+{
+    return (tbfile_at(AT_FDCWD, fp->fname, fp, nthreads));
+}
+
+/*
+ * A file that could not even be opened stops everything,
+ * just as it does when files are measured one at a time.
+ */
+static bool
+open_failed(const tbfile_t *fp)
+{
+    return (fp->err != 0 && strcmp(fp->errop, "fopen") == 0);
+}
+
+static int
+cmp_size_desc(const void *a, const void *b, void *arg)
+{
+    const struct tbpool *pool = (const struct tbpool *)arg;
+    size_t ia = *(const size_t *)a;
+    size_t ib = *(const size_t *)b;
+    off_t sa = pool->files[ia].size;
+    off_t sb = pool->files[ib].size;
+
+    if (sa != sb) {
+        return (sa > sb ? -1 : 1);
+    }
+    return (ia < ib ? -1 : (ia > ib));
+}
+
+static void *
+tbpool_worker(void *arg)
+{
+    struct tbpool *pool = (struct tbpool *)arg;
+    size_t start;
+    size_t end;
+    size_t peek;
+    size_t claim;
+    size_t i;
+
+    while (!__atomic_load_n(&pool->cancel, __ATOMIC_RELAXED)) {
+        // Everything after a tiny file is tiny, too.
+        peek = __atomic_load_n(&pool->next, __ATOMIC_RELAXED);
+        claim = 1;
+        if (peek < pool->filec && pool->files[pool->order[peek]].size < TB_TINY_FILE) {
+            claim = TB_TINY_BATCH;
+        }
+        start = __atomic_fetch_add(&pool->next, claim, __ATOMIC_RELAXED);
+        if (start >= pool->filec) {
+            break;
+        }
+        end = start + claim;
+        if (end > pool->filec) {
+            end = pool->filec;
+        }
+
+        for (i = start; i < end; ++i) {
+            tbfile_t *fp = &pool->files[pool->order[i]];
+
+            text_bounds_file(fp, pool->nthreads);
+            if (!pool->ordered) {
+                pthread_mutex_lock(&pool->lock);
+                (*pool->report)(fp, pool->report_arg);
+                pthread_mutex_unlock(&pool->lock);
+            }
+        }
+
+        if (pool->ordered) {
+            pthread_mutex_lock(&pool->lock);
+            for (i = start; i < end; ++i) {
+                pool->files[pool->order[i]].done = true;
+            }
+            pthread_cond_broadcast(&pool->cond);
+            pthread_mutex_unlock(&pool->lock);
+        }
+    }
+    return (NULL);
+}
+
+/*
+ * Measure filec files, using njobs worker threads,
+ * and nthreads threads for each file.
+ *
+ * Each file is reported by calling report(), exactly once, either
+ * in order, or, if !ordered, in whatever order they finish.
+ * In order, reporting stops after the first file that fails,
+ * just as it would if the files were measured one at a time.
+ * Calls to report() are never concurrent.
+ *
+ * Return 0, or 2 if any file could not be opened; as in the serial loop,
+ * other errors are only in the .err of each file, for report() to see.
+ * Return -1 if the pool could not be set up, in which case nothing
+ * has been done.
+ */
+int
+text_bounds_filev_jobs(size_t filec, tbfile_t *files, uint_t njobs, uint_t nthreads,
+    bool ordered, tbfile_report_fn report, void *report_arg)
+{
+    struct tbpool pool;
+    struct stat st;
+    pthread_t *tids;
+    bool *started;
+    size_t i;
+    uint_t t;
+    int rv;
+
+    pool.files = files;
+    pool.filec = filec;
+    pool.order = calloc(filec, sizeof (size_t));
+    tids = calloc(njobs, sizeof (pthread_t));
+    started = calloc(njobs, sizeof (bool));
+    if (pool.order == NULL || tids == NULL || started == NULL) {
+        free(pool.order);
+        free(tids);
+        free(started);
+        return (-1);
+    }
+    pool.next = 0;
+    pool.nthreads = nthreads;
+    pool.ordered = ordered;
+    pool.cancel = false;
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.cond, NULL);
+    pool.report = report;
+    pool.report_arg = report_arg;
+
+    for (i = 0; i < filec; ++i) {
+        pool.order[i] = i;
+        files[i].done = false;
+        files[i].err = 0;
+        files[i].errop = NULL;
+        files[i].size = 0;
+        if (stat(files[i].fname, &st) == 0 && S_ISREG(st.st_mode)) {
+            files[i].size = st.st_size;
+        }
+    }
+    qsort_r(pool.order, filec, sizeof (size_t), cmp_size_desc, &pool);
+
+    for (t = 0; t < njobs; ++t) {
+        started[t] = (pthread_create(&tids[t], NULL, tbpool_worker, &pool) == 0);
+    }
+    if (!started[0]) {
+        // Could not start even one thread; do all the work ourselves.
+        tbpool_worker(&pool);
+    }
+
+    rv = 0;
+    if (ordered) {
+        for (i = 0; i < filec; ++i) {
+            pthread_mutex_lock(&pool.lock);
+            while (!files[i].done) {
+                pthread_cond_wait(&pool.cond, &pool.lock);
+            }
+            pthread_mutex_unlock(&pool.lock);
+            (*report)(&files[i], report_arg);
+            if (open_failed(&files[i])) {
+                // Stop, just like the serial loop
+                __atomic_store_n(&pool.cancel, true, __ATOMIC_RELAXED);
+                rv = 2;
+                break;
+            }
+        }
+    }
+
+    for (t = 0; t < njobs; ++t) {
+        if (started[t]) {
+            pthread_join(tids[t], NULL);
+        }
+    }
+
+    if (!ordered) {
+        for (i = 0; i < filec; ++i) {
+            if (open_failed(&files[i])) {
+                rv = 2;
+            }
+        }
+    }
+
+    pthread_mutex_destroy(&pool.lock);
+    pthread_cond_destroy(&pool.cond);
+    free(pool.order);
+    free(tids);
+    free(started);
+    return (rv);
+}
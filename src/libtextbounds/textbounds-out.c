@@ -0,0 +1,843 @@
+/*
+ * Filename: textbounds-out.c
+ * Library: libtextbounds
+ * Brief: Show results: formats compiled once, and a buffered writer.
+ *
+ * Description:
+ *   A format, like "%f %l %c", is compiled, once, into a list of ops:
+ *   runs of literal text, and the results to be shown between them.
+ *   Showing the results for a file is then just a walk over the ops,
+ *   with numbers converted to decimal in place, in a large buffer.
+ *   The buffer is written out only when it is full, or when asked,
+ *   with writev(), so that anything too big to be worth copying
+ *   goes out together with it, as it is.
+ *
+ *   Results can also be shown for programs to read: as JSON Lines,
+ *   as CSV, or as fixed-size binary records, with the file names
+ *   in a table of their own.  Names are copied a run at a time,
+ *   between the few bytes that need escaping.
+ *
+ * Copyright (C) 2019 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <textbounds.h>
+#include <textbounds_int.h>
+#include <errno.h>
+    // Import errno, EINTR, ENOMEM
+#include <stddef.h>
+    // Import offsetof()
+#include <stdio.h>
+    // Import snprintf()
+#include <stdlib.h>
+    // Import malloc(), free()
+#include <string.h>
+    // Import memcpy(), strlen(), strerror()
+#include <sys/uio.h>
+    // Import writev(), struct iovec
+#include <unistd.h>
+    // Import isatty()
+
+enum {
+    OP_TEXT = 0,            // Literal text, .len bytes at .off in .text
+    OP_FNAME,
+    OP_LINES,
+    OP_COLUMNS,
+    OP_WIDEST_LINE,
+    OP_WIDEST_OFFSET,
+    OP_MEAN,
+    OP_QUANTILE             // The size_t at .off in tbdist_t
+};
+
+struct tbop {
+    uint_t kind;
+    size_t off;
+    size_t len;
+};
+
+struct tbformat {
+    uint_t measure;         // TB_MEASURE_* of what is shown
+    size_t nops;
+    struct tbop *ops;
+    char   *text;           // Literal text of all the OP_TEXT ops
+    size_t textlen;
+};
+
+#define TB_OUT_SIZE  (256 * 1024)
+
+// Anything at least this big is written from where it is.
+#define TB_OUT_DIRECT  (TB_OUT_SIZE / 4)
+
+// Room enough for any number.
+#define TB_OUT_NUMBER  24
+
+struct tbout {
+    int    fd;
+    bool   linebuf;
+    int    err;             // errno of the first write that failed
+    uint64_t pos;           // Bytes written, not counting the buffer
+    uint64_t writes;        // System calls, so far
+    size_t len;
+    char   buf[TB_OUT_SIZE];
+};
+
+/*
+ * Append an op, of literal text, or of a result.
+ * Literal text that follows literal text just makes it longer.
+ */
+static void
+fmt_op(struct tbformat *fmt, uint_t kind, size_t off, size_t len)
+{
+    struct tbop *op;
+
+    if (kind == OP_TEXT && len == 0) {
+        return;
+    }
+    if (kind == OP_TEXT && fmt->nops > 0) {
+        op = &fmt->ops[fmt->nops - 1];
+        if (op->kind == OP_TEXT && op->off + op->len == off) {
+            op->len += len;
+            return;
+        }
+    }
+    op = &fmt->ops[fmt->nops++];
+    op->kind = kind;
+    op->off = off;
+    op->len = len;
+}
+
+/*
+ * Append literal text.
+ */
+static void
+fmt_text(struct tbformat *fmt, const char *str, size_t len)
+{
+    memcpy(fmt->text + fmt->textlen, str, len);
+    fmt_op(fmt, OP_TEXT, fmt->textlen, len);
+    fmt->textlen += len;
+}
+
+/*
+ * One of the %{name} placeholders, which describe
+ * the distribution of line widths.
+ * Return false if there is no such placeholder.
+ */
+static bool
+fmt_dist(struct tbformat *fmt, const char *name, size_t len)
+{
+    static const struct {
+        const char *name;
+        size_t offset;
+    } quantiles[] = {
+        { "p50",  offsetof(tbdist_t, p50) },
+        { "p90",  offsetof(tbdist_t, p90) },
+        { "p99",  offsetof(tbdist_t, p99) },
+        { "p999", offsetof(tbdist_t, p999) },
+    };
+    size_t i;
+
+    if (len == 4 && memcmp(name, "mean", 4) == 0) {
+        fmt_op(fmt, OP_MEAN, 0, 0);
+        return (true);
+    }
+    for (i = 0; i < sizeof (quantiles) / sizeof (quantiles[0]); ++i) {
+        if (len == strlen(quantiles[i].name) && memcmp(name, quantiles[i].name, len) == 0) {
+            fmt_op(fmt, OP_QUANTILE, quantiles[i].offset, 0);
+            return (true);
+        }
+    }
+    return (false);
+}
+
+/*
+ * Compile a format.  A placeholder that is not known is shown
+ * as it is, as {%x=ERROR}; that text is made here, once.
+ */
+tbformat_t *
+text_bounds_format_compile(const char *str)
+{
+    struct tbformat *fmt;
+    const char *fp;
+    const char *end;
+    size_t sz;
+    uint_t measure;
+
+    sz = strlen(str);
+    fmt = calloc(1, sizeof (*fmt));
+    if (fmt == NULL) {
+        return (NULL);
+    }
+    // At most one op for each byte of the format, and the newline;
+    // no error is more than 5 times as long as its placeholder.
+    fmt->ops = malloc((sz + 1) * sizeof (struct tbop));
+    fmt->text = malloc(sz * 5 + 16);
+    if (fmt->ops == NULL || fmt->text == NULL) {
+        text_bounds_format_free(fmt);
+        errno = ENOMEM;
+        return (NULL);
+    }
+
+    measure = 0;
+    for (fp = str; *fp; ++fp) {
+        if (*fp != '%') {
+            end = strchr(fp, '%');
+            if (end == NULL) {
+                end = str + sz;
+            }
+            fmt_text(fmt, fp, end - fp);
+            fp = end - 1;
+            continue;
+        }
+        ++fp;
+        switch (*fp) {
+        case '\0':
+            fmt_text(fmt, "{%=ERROR}", 9);
+            --fp;
+            break;
+        default:
+            fmt_text(fmt, "{", 1);
+            fmt_text(fmt, fp - 1, 2);
+            fmt_text(fmt, "=ERROR}", 7);
+            break;
+        case '%':
+            fmt_text(fmt, fp, 1);
+            break;
+        case 'f':
+            fmt_op(fmt, OP_FNAME, 0, 0);
+            break;
+        case 'l':
+            fmt_op(fmt, OP_LINES, 0, 0);
+            measure |= TB_MEASURE_LINES;
+            break;
+        case 'c':
+            fmt_op(fmt, OP_COLUMNS, 0, 0);
+            measure |= TB_MEASURE_COLUMNS;
+            break;
+        case 'L':
+            // Where the widest line is comes with how wide it is
+            fmt_op(fmt, OP_WIDEST_LINE, 0, 0);
+            measure |= TB_MEASURE_COLUMNS;
+            break;
+        case 'o':
+            fmt_op(fmt, OP_WIDEST_OFFSET, 0, 0);
+            measure |= TB_MEASURE_COLUMNS;
+            break;
+        case '{':
+            // Any of the %{...} placeholders
+            measure |= TB_MEASURE_DIST;
+            end = strchr(fp, '}');
+            if (end == NULL) {
+                fmt_text(fmt, "{", 1);
+                fmt_text(fmt, fp - 1, strlen(fp - 1));
+                fmt_text(fmt, "=ERROR}", 7);
+                fp += strlen(fp) - 1;
+                break;
+            }
+            if (!fmt_dist(fmt, fp + 1, end - (fp + 1))) {
+                fmt_text(fmt, "{", 1);
+                fmt_text(fmt, fp - 1, end + 1 - (fp - 1));
+                fmt_text(fmt, "=ERROR}", 7);
+            }
+            fp = end;
+            break;
+        }
+    }
+    fmt_text(fmt, "\n", 1);
+    fmt->measure = (measure != 0 ? measure : TB_MEASURE_NONE);
+    return (fmt);
+}
+
+void
+text_bounds_format_free(tbformat_t *fmt)
+{
+    if (fmt != NULL) {
+        free(fmt->ops);
+        free(fmt->text);
+        free(fmt);
+    }
+}
+
+/*
+ * What a format shows, so that nothing else need be measured.
+ */
+uint_t
+text_bounds_format_measure(const tbformat_t *fmt)
+{
+    return (fmt->measure);
+}
+
+tbout_t *
+text_bounds_out_new(int fd)
+{
+    struct tbout *out;
+
+    out = malloc(sizeof (*out));
+    if (out == NULL) {
+        return (NULL);
+    }
+    out->fd = fd;
+    out->linebuf = isatty(fd);
+    out->err = 0;
+    out->pos = 0;
+    out->len = 0;
+    return (out);
+}
+
+/*
+ * Write the buffer, then extra, if any.
+ * After an error, there is nowhere for output to go; it is dropped.
+ */
+static void
+out_writev(struct tbout *out, const char *extra, size_t extralen)
+{
+    struct iovec iov[2];
+    struct iovec *iop;
+    ssize_t wsz;
+    int iovcnt;
+
+    iov[0].iov_base = out->buf;
+    iov[0].iov_len = out->len;
+    iov[1].iov_base = (void *)extra;
+    iov[1].iov_len = extralen;
+    iop = iov;
+    iovcnt = 2;
+    out->pos += out->len + extralen;
+    out->len = 0;
+    while (out->err == 0 && iovcnt > 0) {
+        if (iop->iov_len == 0) {
+            ++iop;
+            --iovcnt;
+            continue;
+        }
+        ++out->writes;
+        wsz = writev(out->fd, iop, iovcnt);
+        if (wsz < 0 && errno == EINTR) {
+            continue;
+        }
+        if (wsz < 0) {
+            out->err = errno;
+            break;
+        }
+        while (iovcnt > 0 && (size_t)wsz >= iop->iov_len) {
+            wsz -= iop->iov_len;
+            ++iop;
+            --iovcnt;
+        }
+        if (iovcnt > 0) {
+            iop->iov_base = (char *)iop->iov_base + wsz;
+            iop->iov_len -= wsz;
+        }
+    }
+}
+
+void
+text_bounds_out_write(tbout_t *out, const char *str, size_t len)
+{
+    if (len >= TB_OUT_DIRECT) {
+        out_writev(out, str, len);
+        return;
+    }
+    if (out->len + len > TB_OUT_SIZE) {
+        out_writev(out, NULL, 0);
+    }
+    memcpy(out->buf + out->len, str, len);
+    out->len += len;
+}
+
+static const char digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+/*
+ * Convert v to decimal, in place, two digits at a time,
+ * from the end.  There must be room for TB_OUT_NUMBER bytes.
+ */
+static size_t
+out_utoa(char *buf, uint64_t v)
+{
+    char tmp[TB_OUT_NUMBER];
+    char *p = tmp + sizeof (tmp);
+    size_t len;
+
+    while (v >= 100) {
+        p -= 2;
+        memcpy(p, digit_pairs + 2 * (v % 100), 2);
+        v /= 100;
+    }
+    if (v >= 10) {
+        p -= 2;
+        memcpy(p, digit_pairs + 2 * v, 2);
+    }
+    else {
+        *--p = (char)('0' + v);
+    }
+    len = tmp + sizeof (tmp) - p;
+    memcpy(buf, p, len);
+    return (len);
+}
+
+static inline void
+out_reserve(struct tbout *out, size_t len)
+{
+    if (out->len + len > TB_OUT_SIZE) {
+        out_writev(out, NULL, 0);
+    }
+}
+
+void
+text_bounds_out_uint(tbout_t *out, uint64_t v)
+{
+    out_reserve(out, TB_OUT_NUMBER);
+    out->len += out_utoa(out->buf + out->len, v);
+}
+
+static void
+out_int(struct tbout *out, int64_t v)
+{
+    out_reserve(out, TB_OUT_NUMBER);
+    if (v < 0) {
+        out->buf[out->len++] = '-';
+        out->len += out_utoa(out->buf + out->len, -(uint64_t)v);
+        return;
+    }
+    out->len += out_utoa(out->buf + out->len, (uint64_t)v);
+}
+
+/*
+ * Show the results for one file, as the format says.
+ * With line buffering, they are written out as soon as they are done.
+ */
+void
+text_bounds_out_format(tbout_t *out, const tbformat_t *fmt,
+    const char *fname, const textbox_t *txt)
+{
+    const struct tbop *op;
+    const struct tbop *end;
+
+    end = fmt->ops + fmt->nops;
+    for (op = fmt->ops; op < end; ++op) {
+        switch (op->kind) {
+        case OP_TEXT:
+            text_bounds_out_write(out, fmt->text + op->off, op->len);
+            break;
+        case OP_FNAME:
+            text_bounds_out_write(out, fname, strlen(fname));
+            break;
+        case OP_LINES:
+            text_bounds_out_uint(out, txt->lines);
+            break;
+        case OP_COLUMNS:
+            text_bounds_out_uint(out, txt->columns);
+            break;
+        case OP_WIDEST_LINE:
+            text_bounds_out_uint(out, txt->widest_line);
+            break;
+        case OP_WIDEST_OFFSET:
+            out_int(out, txt->widest_offset);
+            break;
+        case OP_MEAN:
+            // Rounded just as printf() rounds it; this one is rare.
+            out_reserve(out, 64);
+            out->len += snprintf(out->buf + out->len, 64, "%.1f", txt->dist.mean);
+            break;
+        case OP_QUANTILE:
+            text_bounds_out_uint(out,
+                *(const size_t *)((const char *)&txt->dist + op->off));
+            break;
+        }
+    }
+    if (out->linebuf) {
+        out_writev(out, NULL, 0);
+    }
+}
+
+/*
+ * Results for programs to read.
+ */
+
+static inline void
+out_char(struct tbout *out, char c)
+{
+    out_reserve(out, 1);
+    out->buf[out->len++] = c;
+}
+
+static inline void
+out_str(struct tbout *out, const char *str)
+{
+    text_bounds_out_write(out, str, strlen(str));
+}
+
+/*
+ * The length of the well-formed UTF-8 sequence at p, which is not ASCII,
+ * or 0 if it is not one.  No overlong forms, surrogates,
+ * or code points past U+10FFFF.
+ */
+static size_t
+u8_seqlen(const unsigned char *p)
+{
+    unsigned char c = p[0];
+
+    if (c >= 0xc2 && c <= 0xdf) {
+        return ((p[1] & 0xc0) == 0x80 ? 2 : 0);
+    }
+    if (c >= 0xe0 && c <= 0xef) {
+        if ((c == 0xe0 && p[1] < 0xa0) || (c == 0xed && p[1] >= 0xa0)) {
+            return (0);
+        }
+        return ((p[1] & 0xc0) == 0x80 && (p[2] & 0xc0) == 0x80 ? 3 : 0);
+    }
+    if (c >= 0xf0 && c <= 0xf4) {
+        if ((c == 0xf0 && p[1] < 0x90) || (c == 0xf4 && p[1] >= 0x90)) {
+            return (0);
+        }
+        return ((p[1] & 0xc0) == 0x80 && (p[2] & 0xc0) == 0x80
+            && (p[3] & 0xc0) == 0x80 ? 4 : 0);
+    }
+    return (0);
+}
+
+/*
+ * A JSON string.  Bytes that are not UTF-8 cannot be in one;
+ * each becomes U+FFFD.  Return false if there were any.
+ */
+static bool
+out_json_str(struct tbout *out, const char *str)
+{
+    static const char hex[] = "0123456789abcdef";
+    const unsigned char *p = (const unsigned char *)str;
+    const unsigned char *run;
+    char esc[6];
+    size_t n;
+    bool valid;
+
+    valid = true;
+    out_char(out, '"');
+    run = p;
+    for (;;) {
+        while (*p >= 0x20 && *p < 0x80 && *p != '"' && *p != '\\') {
+            ++p;
+        }
+        text_bounds_out_write(out, (const char *)run, p - run);
+        if (*p == '\0') {
+            break;
+        }
+        if (*p >= 0x80) {
+            n = u8_seqlen(p);
+            if (n != 0) {
+                text_bounds_out_write(out, (const char *)p, n);
+                p += n;
+            }
+            else {
+                text_bounds_out_write(out, "\\ufffd", 6);
+                valid = false;
+                ++p;
+            }
+        }
+        else if (*p == '"' || *p == '\\') {
+            esc[0] = '\\';
+            esc[1] = *p++;
+            text_bounds_out_write(out, esc, 2);
+        }
+        else {
+            memcpy(esc, "\\u00", 4);
+            esc[4] = hex[*p >> 4];
+            esc[5] = hex[*p & 0xf];
+            text_bounds_out_write(out, esc, 6);
+            ++p;
+        }
+        run = p;
+    }
+    out_char(out, '"');
+    return (valid);
+}
+
+/*
+ * The name as it is, in hex; for names that are not UTF-8.
+ */
+static void
+out_hex(struct tbout *out, const char *str)
+{
+    static const char hex[] = "0123456789abcdef";
+    const unsigned char *p;
+
+    out_char(out, '"');
+    for (p = (const unsigned char *)str; *p; ++p) {
+        out_reserve(out, 2);
+        out->buf[out->len++] = hex[*p >> 4];
+        out->buf[out->len++] = hex[*p & 0xf];
+    }
+    out_char(out, '"');
+}
+
+/*
+ * A CSV field (RFC 4180): quoted, with quotes doubled,
+ * only if there is a quote, comma, or line ending in it.
+ */
+static void
+out_csv_str(struct tbout *out, const char *str)
+{
+    const char *p;
+    const char *q;
+
+    if (strpbrk(str, "\",\r\n") == NULL) {
+        out_str(out, str);
+        return;
+    }
+    out_char(out, '"');
+    for (p = str; (q = strchr(p, '"')) != NULL; p = q + 1) {
+        text_bounds_out_write(out, p, q + 1 - p);
+        out_char(out, '"');
+    }
+    out_str(out, p);
+    out_char(out, '"');
+}
+
+static void
+out_mean(struct tbout *out, double mean)
+{
+    out_reserve(out, 64);
+    out->len += snprintf(out->buf + out->len, 64, "%.3f", mean);
+}
+
+static void
+out_jsonl(struct tbout *out, const char *fname, const textbox_t *txt, int err)
+{
+    static const char *const names[] = { ",\"p50\":", ",\"p90\":", ",\"p99\":", ",\"p999\":" };
+    const size_t *q[4];
+    size_t i;
+
+    if (fname == NULL) {
+        out_str(out, "{\"total\":true");
+    }
+    else {
+        out_str(out, "{\"file\":");
+        if (!out_json_str(out, fname)) {
+            out_str(out, ",\"file_hex\":");
+            out_hex(out, fname);
+        }
+    }
+    out_str(out, ",\"lines\":");
+    text_bounds_out_uint(out, txt->lines);
+    out_str(out, ",\"columns\":");
+    text_bounds_out_uint(out, txt->columns);
+    out_str(out, ",\"widest_line\":");
+    text_bounds_out_uint(out, txt->widest_line);
+    out_str(out, ",\"widest_offset\":");
+    out_int(out, txt->widest_offset);
+    if ((tb_measure(txt) & TB_MEASURE_DIST) != 0) {
+        out_str(out, ",\"mean\":");
+        out_mean(out, txt->dist.mean);
+        q[0] = &txt->dist.p50;
+        q[1] = &txt->dist.p90;
+        q[2] = &txt->dist.p99;
+        q[3] = &txt->dist.p999;
+        for (i = 0; i < 4; ++i) {
+            out_str(out, names[i]);
+            text_bounds_out_uint(out, *q[i]);
+        }
+    }
+    if (err != 0) {
+        out_str(out, ",\"error\":");
+        out_json_str(out, strerror(err));
+    }
+    out_str(out, "}\n");
+}
+
+static void
+out_csv(struct tbout *out, const char *fname, const textbox_t *txt, int err)
+{
+    const size_t *q[4];
+    size_t i;
+
+    out_csv_str(out, fname != NULL ? fname : "");
+    out_char(out, ',');
+    text_bounds_out_uint(out, txt->lines);
+    out_char(out, ',');
+    text_bounds_out_uint(out, txt->columns);
+    out_char(out, ',');
+    text_bounds_out_uint(out, txt->widest_line);
+    out_char(out, ',');
+    out_int(out, txt->widest_offset);
+    out_char(out, ',');
+    if ((tb_measure(txt) & TB_MEASURE_DIST) != 0) {
+        out_mean(out, txt->dist.mean);
+        q[0] = &txt->dist.p50;
+        q[1] = &txt->dist.p90;
+        q[2] = &txt->dist.p99;
+        q[3] = &txt->dist.p999;
+        for (i = 0; i < 4; ++i) {
+            out_char(out, ',');
+            text_bounds_out_uint(out, *q[i]);
+        }
+    }
+    else {
+        out_str(out, ",,,,");
+    }
+    out_char(out, ',');
+    if (err != 0) {
+        out_csv_str(out, strerror(err));
+    }
+    out_char(out, '\n');
+}
+
+static inline void
+put_le32(unsigned char *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static inline void
+put_le64(unsigned char *p, uint64_t v)
+{
+    put_le32(p, (uint32_t)v);
+    put_le32(p + 4, (uint32_t)(v >> 32));
+}
+
+static void
+out_binary(struct tbout *out, struct tbout *paths,
+    const char *fname, const textbox_t *txt, int err)
+{
+    unsigned char rec[TB_REC_SIZE];
+    uint64_t mean;
+    size_t len;
+    uint32_t flags;
+
+    memset(rec, 0, sizeof (rec));
+    len = strlen(fname);
+    put_le64(rec + 0, paths->pos + paths->len);
+    put_le32(rec + 8, (uint32_t)len);
+    text_bounds_out_write(paths, fname, len + 1);
+
+    flags = 0;
+    if (err != 0) {
+        flags |= TB_REC_ERROR;
+        put_le32(rec + 48, (uint32_t)err);
+    }
+    put_le64(rec + 16, txt->lines);
+    put_le64(rec + 24, txt->columns);
+    put_le64(rec + 32, txt->widest_line);
+    put_le64(rec + 40, (uint64_t)txt->widest_offset);
+    if ((tb_measure(txt) & TB_MEASURE_DIST) != 0) {
+        flags |= TB_REC_DIST;
+        memcpy(&mean, &txt->dist.mean, sizeof (mean));
+        put_le64(rec + 56, mean);
+        put_le64(rec + 64, txt->dist.p50);
+        put_le64(rec + 72, txt->dist.p90);
+        put_le64(rec + 80, txt->dist.p99);
+        put_le64(rec + 88, txt->dist.p999);
+    }
+    put_le32(rec + 12, flags);
+    text_bounds_out_write(out, (const char *)rec, sizeof (rec));
+}
+
+/*
+ * What comes before any results: the names of the CSV columns,
+ * or the header of the binary records.
+ */
+void
+text_bounds_out_begin(tbout_t *out, uint_t kind)
+{
+    unsigned char hdr[TB_REC_HEADER];
+
+    switch (kind) {
+    case TB_OUTPUT_CSV:
+        out_str(out, "file,lines,columns,widest_line,widest_offset,"
+            "mean,p50,p90,p99,p999,error\n");
+        break;
+    case TB_OUTPUT_BINARY:
+        memcpy(hdr, TB_REC_MAGIC, 8);
+        put_le32(hdr + 8, TB_REC_SIZE);
+        put_le32(hdr + 12, TB_REC_VERSION);
+        text_bounds_out_write(out, (const char *)hdr, sizeof (hdr));
+        break;
+    }
+}
+
+void
+text_bounds_out_record(tbout_t *out, uint_t kind, tbout_t *paths,
+    const char *fname, const textbox_t *txt, int err)
+{
+    switch (kind) {
+    case TB_OUTPUT_JSONL:
+        out_jsonl(out, fname, txt, err);
+        break;
+    case TB_OUTPUT_CSV:
+        out_csv(out, fname, txt, err);
+        break;
+    case TB_OUTPUT_BINARY:
+        out_binary(out, paths, fname, txt, err);
+        break;
+    }
+    if (out->linebuf) {
+        out_writev(out, NULL, 0);
+    }
+}
+
+/*
+ * Write out whatever is in the buffer, if there is one.
+ * Return 0, or -1, with errno set, if any write has failed.
+ */
+int
+text_bounds_out_flush(tbout_t *out)
+{
+    if (out == NULL) {
+        return (0);
+    }
+    if (out->len > 0) {
+        out_writev(out, NULL, 0);
+    }
+    if (out->err != 0) {
+        errno = out->err;
+        return (-1);
+    }
+    return (0);
+}
+
+int
+text_bounds_out_free(tbout_t *out)
+{
+    int err;
+
+    if (out == NULL) {
+        return (0);
+    }
+    text_bounds_out_flush(out);
+    err = out->err;
+    free(out);
+    if (err != 0) {
+        errno = err;
+        return (-1);
+    }
+    return (0);
+}
+
+uint64_t
+text_bounds_out_writes(const tbout_t *out)
+{
+    return (out == NULL ? 0 : out->writes);
+}
@@ -0,0 +1,732 @@
+/*
+ * Filename: textbounds-parallel.c
+ * Library: libtextbounds
+ * Brief: Measure one buffer or file on several threads at once.
+ *
+ * Description:
+ *   The text is split into chunks, at arbitrary places, and each chunk
+ *   is measured on its own thread, producing a small summary.
+ *   Summaries combine associatively, so the results are exactly
+ *   the same as measuring the whole text serially.
+ *
+ *   A chunk can start in the middle of a line.  The bytes before the
+ *   first newline in a chunk (the leading segment) cannot be measured
+ *   until we know what column they start at.  But, because a tab
+ *   advances to the next multiple of the tab width, only the column
+ *   modulo the tab width matters, and only up to the first tab
+ *   in the segment.  After that, the segment is in step with the
+ *   tab stops.  So, a segment is summarized as the columns before
+ *   its first tab, and the columns after, relative to the tab stop
+ *   that tab reaches.
+ *
+ *   That does not work for an irregular list of tab stops,
+ *   so then, the text is measured serially.
+ *
+ * Copyright (C) 2019 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE 1
+
+#include <textbounds.h>
+#include <textbounds_int.h>
+#include <errno.h>
+    // Import errno, EINTR
+#include <pthread.h>
+    // Import pthread_create(), pthread_join()
+#include <stdlib.h>
+    // Import malloc(), free()
+#include <string.h>
+    // Import memchr(), memrchr(), memcpy()
+#include <unistd.h>
+    // Import pread()
+
+/*
+ * Do not bother splitting text into chunks smaller than this.
+ */
+#define TB_PAR_MIN_CHUNK  (64 * 1024)
+
+/*
+ * Each thread reads its part of a file in blocks of this size.
+ */
+#define TB_PAR_BLOCK      (1024 * 1024)
+
+/*
+ * Summary of a segment: part of a line, with no newline.
+ *
+ * .pre       columns up to the first tab (or all, if no tab)
+ * .pre_ink   last ink column up to the first tab, if .pre_has_ink
+ * .tab       the segment contains a tab
+ * .post      columns after the first tab,
+ *            relative to the tab stop that the first tab reaches
+ * .post_ink  last ink column after the first tab, relative, if .post_has_ink
+ *
+ * A zero-width mark is ink, even at relative column 0.
+ */
+struct tbseg {
+    size_t pre;
+    size_t pre_ink;
+    bool   pre_has_ink;
+    bool   tab;
+    size_t post;
+    size_t post_ink;
+    bool   post_has_ink;
+};
+
+/*
+ * Summary of a chunk of text.
+ *
+ * .nl      the chunk contains at least one newline
+ * .lead    the leading segment; all of the chunk, if no newline
+ * .lines   number of newlines
+ * .maxcol  widest line that lies wholly inside the chunk
+ * .maxlnr  its line number, where the line that .lead ends is line 1
+ * .maxoff  its offset
+ * .col     state of the trailing partial line, after the last newline
+ * .inkcol
+ * .linestart  offset of the trailing partial line
+ * .size    length of the chunk, in bytes
+ *
+ * Offsets are relative to the start of the chunk.
+ */
+struct tbchunk {
+    bool   nl;
+    struct tbseg lead;
+    size_t lines;
+    size_t maxcol;
+    size_t maxlnr;
+    off_t  maxoff;
+    size_t col;
+    size_t inkcol;
+    off_t  linestart;
+    off_t  size;
+};
+
+/*
+ * The empty chunk.  Joining it with any other chunk changes nothing.
+ */
+static const struct tbchunk null_chunk;
+
+/*
+ * Continue a line at (*colp, *inkp) with the given segment.
+ */
+static void
+tbseg_apply(const struct tbseg *seg, size_t *colp, size_t *inkp, bool *has_inkp, size_t tabw)
+{
+    size_t col = *colp;
+
+    if (seg->pre_has_ink) {
+        *inkp = col + seg->pre_ink;
+    }
+    col += seg->pre;
+    if (seg->tab) {
+        col += tabw - col % tabw;
+        if (seg->post_has_ink) {
+            *inkp = col + seg->post_ink;
+        }
+        col += seg->post;
+    }
+    if (has_inkp != NULL) {
+        *has_inkp = *has_inkp || seg->pre_has_ink || (seg->tab && seg->post_has_ink);
+    }
+    *colp = col;
+}
+
+/*
+ * Segment a, followed by segment b.
+ */
+static void
+tbseg_join(struct tbseg *a, const struct tbseg *b, size_t tabw)
+{
+    if (!a->tab) {
+        if (b->pre_has_ink) {
+            a->pre_ink = a->pre + b->pre_ink;
+            a->pre_has_ink = true;
+        }
+        a->pre += b->pre;
+        a->tab = b->tab;
+        a->post = b->post;
+        a->post_ink = b->post_ink;
+        a->post_has_ink = b->post_has_ink;
+    }
+    else {
+        // a->post is relative to a tab stop,
+        // so it is a valid starting column for b.
+        tbseg_apply(b, &a->post, &a->post_ink, &a->post_has_ink, tabw);
+    }
+}
+
+/*
+ * The parts of a chunk are measured with scans that start out
+ * as a copy of opts: the options (.tws, .utf8, .tabs, .eol) with every
+ * counter at zero.
+ *
+ * Run the scan engine over one piece of a chunk.
+ * Chunks never split a UTF-8 sequence, nor a CRLF (see tbpar_align()),
+ * so any sequence still incomplete at the end of a piece is cut short
+ * by whatever follows it, and a CR at the end is not followed by LF,
+ * just as it would be in one serial scan.
+ */
+static void
+tbpiece_scan(tbscan_t *sp, const char *buf, size_t sz, bool tws)
+{
+    (*tbscan_engine(sp->utf8))(sp, (const unsigned char *)buf, sz, tws);
+    tbscan_u8flush(sp);
+    tbscan_cr_resolve(sp, '\0');
+}
+
+/*
+ * Measure part of a segment with the scan engine, from a tab stop.
+ * The scan starts at column base, not 0, so that a zero-width mark
+ * right at the start still moves .inkcol, and is seen to be ink.
+ */
+static void
+tbseg_piece(tbscan_t *sp, const char *buf, size_t sz, size_t base,
+    size_t *colp, size_t *inkp, bool *has_inkp)
+{
+    sp->col = base;
+    sp->inkcol = 0;
+    tbpiece_scan(sp, buf, sz, false);
+    *colp = sp->col - base;
+    *has_inkp = (sp->inkcol != 0);
+    *inkp = *has_inkp ? sp->inkcol - base : 0;
+}
+
+/*
+ * Measure a segment with the scan engine.
+ * It starts at a tab stop, so the results are relative to any tab stop.
+ * Tab stops are regular, here, with a width of at least 1.
+ */
+static void
+tbseg_scan(struct tbseg *seg, const char *buf, size_t sz, const tbscan_t *opts)
+{
+    tbscan_t scan = *opts;
+    size_t base = tbtabs_width(opts->tabs);
+    const char *tab;
+
+    tab = memchr(buf, '\t', sz);
+    if (tab == NULL) {
+        tbseg_piece(&scan, buf, sz, base, &seg->pre, &seg->pre_ink, &seg->pre_has_ink);
+        seg->tab = false;
+        seg->post = 0;
+        seg->post_ink = 0;
+        seg->post_has_ink = false;
+        return;
+    }
+
+    tbseg_piece(&scan, buf, tab - buf, base, &seg->pre, &seg->pre_ink, &seg->pre_has_ink);
+    seg->tab = true;
+    ++tab;
+    tbseg_piece(&scan, tab, buf + sz - tab, base, &seg->post, &seg->post_ink,
+        &seg->post_has_ink);
+}
+
+static void
+tbchunk_scan(struct tbchunk *cp, const char *buf, size_t sz, const tbscan_t *opts)
+{
+    tbscan_t scan = *opts;
+    const char *nl;
+    size_t len;
+
+    *cp = null_chunk;
+    cp->size = sz;
+    nl = memchr(buf, tb_eol_byte(opts->eol), sz);
+    if (nl == NULL) {
+        tbseg_scan(&cp->lead, buf, sz, opts);
+        return;
+    }
+
+    // The CR of a CRLF is part of the line ending, not of the line
+    len = nl - buf;
+    if (opts->eol == TB_EOL_CRLF && len > 0 && nl[-1] == '\r') {
+        --len;
+    }
+    tbseg_scan(&cp->lead, buf, len, opts);
+    ++nl;
+    scan.off = scan.linestart = nl - buf;
+    tbpiece_scan(&scan, nl, buf + sz - nl, opts->tws);
+    cp->nl = true;
+    cp->lines = 1 + scan.lnr;
+    cp->maxcol = scan.maxcol;
+    cp->maxlnr = 1 + scan.maxlnr;
+    cp->maxoff = scan.maxoff;
+    cp->col = scan.col;
+    cp->inkcol = scan.inkcol;
+    cp->linestart = scan.linestart;
+}
+
+/*
+ * Summarize a chunk when only lines are wanted.
+ * Columns are just byte counts, then; all that matters in the end
+ * is whether the last line is empty.
+ */
+static void
+tbchunk_count(struct tbchunk *cp, const char *buf, size_t sz, const tbscan_t *opts)
+{
+    tbscan_t scan = *opts;
+    int eolb = tb_eol_byte(opts->eol);
+    const char *nl;
+
+    *cp = null_chunk;
+    cp->size = sz;
+    nl = memchr(buf, eolb, sz);
+    if (nl == NULL) {
+        cp->lead.pre = sz;
+        return;
+    }
+
+    cp->lead.pre = nl - buf;
+    (*tbcount_span)(&scan, (const unsigned char *)buf, sz, false);
+    cp->nl = true;
+    cp->lines = scan.lnr;
+    nl = memrchr(buf, eolb, sz);
+    cp->col = buf + sz - (nl + 1);
+}
+
+/*
+ * Chunk a, followed by chunk b.
+ * The line that a leaves open, and b ends, is added to opts->hist.
+ */
+static void
+tbchunk_join(struct tbchunk *a, const struct tbchunk *b, const tbscan_t *opts)
+{
+    size_t tabw = tbtabs_width(opts->tabs);
+    size_t width;
+    off_t size = a->size;
+
+    if (!a->nl) {
+        struct tbseg lead = a->lead;
+
+        tbseg_join(&lead, &b->lead, tabw);
+        *a = *b;
+        a->lead = lead;
+        a->size += size;
+        if (a->nl) {
+            a->maxoff += size;
+            a->linestart += size;
+        }
+        return;
+    }
+
+    a->size += b->size;
+    tbseg_apply(&b->lead, &a->col, &a->inkcol, NULL, tabw);
+    if (!b->nl) {
+        return;
+    }
+
+    // The first newline of b ends the line that a left open.
+    width = opts->tws ? a->col : a->inkcol;
+    if (width > a->maxcol) {
+        a->maxcol = width;
+        a->maxlnr = a->lines + 1;
+        a->maxoff = a->linestart;
+    }
+    if (opts->hist != NULL) {
+        tbhist_add(opts->hist, width);
+    }
+    if (b->maxcol > a->maxcol) {
+        a->maxcol = b->maxcol;
+        a->maxlnr = a->lines + b->maxlnr;
+        a->maxoff = size + b->maxoff;
+    }
+    a->lines += b->lines;
+    a->col = b->col;
+    a->inkcol = b->inkcol;
+    a->linestart = size + b->linestart;
+}
+
+/*
+ * Continue a stream with a chunk.
+ */
+static void
+tbchunk_apply(tbscan_t *sp, const struct tbchunk *cp)
+{
+    size_t width;
+
+    off_t off = sp->off;
+
+    sp->off += cp->size;
+    tbseg_apply(&cp->lead, &sp->col, &sp->inkcol, NULL, tbtabs_width(sp->tabs));
+    if (!cp->nl) {
+        return;
+    }
+
+    width = sp->tws ? sp->col : sp->inkcol;
+    if (width > sp->maxcol) {
+        sp->maxcol = width;
+        sp->maxlnr = sp->lnr + 1;
+        sp->maxoff = sp->linestart;
+    }
+    if (sp->hist != NULL) {
+        tbhist_add(sp->hist, width);
+    }
+    if (cp->maxcol > sp->maxcol) {
+        sp->maxcol = cp->maxcol;
+        sp->maxlnr = sp->lnr + cp->maxlnr;
+        sp->maxoff = off + cp->maxoff;
+    }
+    sp->lnr += cp->lines;
+    sp->col = cp->col;
+    sp->inkcol = cp->inkcol;
+    sp->linestart = off + cp->linestart;
+}
+
+struct tbpar_job {
+    const char *buf;    // Text in memory, or
+    int    fd;          // text in a file, at
+    off_t  off;         // this offset
+    size_t sz;
+    tbscan_t opts;      // Options, with counters zero
+    bool   lines_only;
+    struct tbchunk sum; // Starts out empty
+    int    err;
+    bool   threaded;
+    pthread_t tid;
+};
+
+static void
+tbpar_scan(struct tbpar_job *job, struct tbchunk *cp, const char *buf, size_t sz)
+{
+    if (job->lines_only) {
+        tbchunk_count(cp, buf, sz, &job->opts);
+    }
+    else {
+        tbchunk_scan(cp, buf, sz, &job->opts);
+    }
+}
+
+static void *
+tbpar_buf_worker(void *arg)
+{
+    struct tbpar_job *job = (struct tbpar_job *)arg;
+
+    tbpar_scan(job, &job->sum, job->buf, job->sz);
+    return (NULL);
+}
+
+static void *
+tbpar_fd_worker(void *arg)
+{
+    struct tbpar_job *job = (struct tbpar_job *)arg;
+    struct tbchunk blk;
+    char *buf;
+    off_t off;
+    size_t rem;
+    ssize_t rsz;
+
+    buf = malloc(TB_PAR_BLOCK);
+    if (buf == NULL) {
+        job->err = ENOMEM;
+        return (NULL);
+    }
+
+    off = job->off;
+    rem = job->sz;
+    while (rem > 0) {
+        rsz = pread(job->fd, buf, rem < TB_PAR_BLOCK ? rem : TB_PAR_BLOCK, off);
+        if (rsz < 0 && errno == EINTR) {
+            continue;
+        }
+        if (rsz <= 0) {
+            // An error, or the file shrank underneath us
+            job->err = (rsz < 0) ? errno : EIO;
+            break;
+        }
+        if (job->opts.utf8 && (size_t)rsz < rem) {
+            // Leave a sequence split by the end of the block for the next one
+            size_t len = tb_u8_complete((const unsigned char *)buf, rsz);
+
+            if (len != 0) {
+                rsz = len;
+            }
+        }
+        if (job->opts.eol == TB_EOL_CRLF && (size_t)rsz < rem && rsz > 1
+            && buf[rsz - 1] == '\r') {
+            // Likewise, a CR that may be the start of a CRLF
+            --rsz;
+        }
+        tbpar_scan(job, &blk, buf, rsz);
+        tbchunk_join(&job->sum, &blk, &job->opts);
+        off += rsz;
+        rem -= rsz;
+    }
+
+    free(buf);
+    return (NULL);
+}
+
+/*
+ * Move a boundary between jobs forward, past any continuation bytes,
+ * so that no UTF-8 sequence is split between two jobs.
+ * At most 3; any more than that are strays, in any case.
+ * With CRLF, also move it past a LF that follows a CR.
+ */
+static size_t
+tbpar_align(const struct tbpar_job *proto, size_t pos, size_t sz)
+{
+    bool crlf = (proto->opts.eol == TB_EOL_CRLF);
+    unsigned char peek[4];
+    ssize_t n;
+    ssize_t i;
+
+    if ((!proto->opts.utf8 && !crlf) || pos == 0 || pos >= sz) {
+        return (pos);
+    }
+    // The byte before the boundary, then up to 3 after it
+    n = (sz - pos < sizeof (peek) - 1) ? (ssize_t)(sz - pos) + 1 : (ssize_t)sizeof (peek);
+    if (proto->buf != NULL) {
+        memcpy(peek, proto->buf + pos - 1, n);
+    }
+    else {
+        n = pread(proto->fd, peek, n, proto->off + pos - 1);
+    }
+    if (crlf && n >= 2 && peek[0] == '\r' && peek[1] == '\n') {
+        return (pos + 1);
+    }
+    if (!proto->opts.utf8) {
+        return (pos);
+    }
+    for (i = 1; i < n && (peek[i] & 0xc0) == 0x80; ++i) {
+        continue;
+    }
+    return (pos + i - 1);
+}
+
+/*
+ * Split sz bytes into jobs, run them on threads, then combine
+ * the summaries, in order, into the results.
+ *
+ * Return 0 on success, or an errno value.
+ */
+static int
+tbpar_run(struct tbpar_job *proto, size_t sz, textbox_t *ctxp, uint_t nthreads,
+    void *(*worker)(void *))
+{
+    struct tbpar_job *jobs;
+    tbscan_t scan;
+    size_t njobs;
+    size_t base;
+    size_t i;
+    int err;
+
+    njobs = sz / TB_PAR_MIN_CHUNK;
+    if (njobs > nthreads) {
+        njobs = nthreads;
+    }
+    if (njobs < 1) {
+        njobs = 1;
+    }
+
+    jobs = calloc(njobs, sizeof (*jobs));
+    if (jobs == NULL) {
+        return (ENOMEM);
+    }
+
+    err = 0;
+    base = 0;
+    for (i = 0; i < njobs; ++i) {
+        size_t end = tbpar_align(proto, (sz / njobs) * (i + 1), sz);
+
+        if (i == njobs - 1) {
+            end = sz;
+        }
+        jobs[i] = *proto;
+        if (jobs[i].buf != NULL) {
+            jobs[i].buf += base;
+        }
+        jobs[i].off += base;
+        jobs[i].sz = end - base;
+        base = end;
+        // Each job adds to a histogram of its own
+        if (proto->opts.hist != NULL) {
+            jobs[i].opts.hist = text_bounds_hist_new();
+            if (jobs[i].opts.hist == NULL) {
+                err = ENOMEM;
+            }
+        }
+    }
+    if (err != 0) {
+        goto done;
+    }
+
+    // Job 0 runs on this thread.
+    for (i = 1; i < njobs; ++i) {
+        jobs[i].threaded = (pthread_create(&jobs[i].tid, NULL, worker, &jobs[i]) == 0);
+        if (!jobs[i].threaded) {
+            // Do it ourselves, then
+            (*worker)(&jobs[i]);
+        }
+    }
+    (*worker)(&jobs[0]);
+    for (i = 1; i < njobs; ++i) {
+        if (jobs[i].threaded) {
+            pthread_join(jobs[i].tid, NULL);
+        }
+    }
+
+    for (i = 0; i < njobs; ++i) {
+        if (jobs[i].err != 0 && err == 0) {
+            err = jobs[i].err;
+        }
+        if (i > 0) {
+            tbchunk_join(&jobs[0].sum, &jobs[i].sum, &proto->opts);
+        }
+        if (jobs[i].opts.hist != NULL) {
+            text_bounds_hist_merge(proto->opts.hist, jobs[i].opts.hist);
+        }
+    }
+
+    if (err == 0) {
+        text_bounds_start(&scan, ctxp);
+        tbchunk_apply(&scan, &jobs[0].sum);
+        text_bounds_finish(&scan, ctxp);
+    }
+
+done:
+    for (i = 0; i < njobs; ++i) {
+        if (jobs[i].opts.hist != proto->opts.hist) {
+            text_bounds_hist_free(jobs[i].opts.hist);
+        }
+    }
+    free(jobs);
+    return (err);
+}
+
+/*
+ * Set up the options common to all jobs, for sz bytes of text.
+ * Return false if the text cannot be split: with a list of tab stops,
+ * a line cannot be measured without knowing where it started.
+ *
+ * With TB_EOL_AUTO, the kind of line ending is decided here,
+ * from the start of the text, once for all jobs.
+ */
+static bool
+tbpar_init(struct tbpar_job *proto, size_t sz, const textbox_t *ctxp)
+{
+    textbox_t opts = *ctxp;
+    char *peek;
+    ssize_t n;
+
+    opts.lines = 0;
+    opts.columns = 0;
+    opts.widest_line = 0;
+    opts.widest_offset = 0;
+    text_bounds_start(&proto->opts, &opts);
+    proto->lines_only = (tb_measure(ctxp) == TB_MEASURE_LINES);
+    if (!proto->lines_only && tbtabs_kind(ctxp->tabs) == TB_TABS_LIST) {
+        return (false);
+    }
+
+    if (proto->opts.eol == TB_EOL_AUTO) {
+        if (sz > TB_EOL_PEEK) {
+            sz = TB_EOL_PEEK;
+        }
+        if (proto->buf != NULL) {
+            tbscan_eol_detect(&proto->opts, proto->buf, sz);
+        }
+        else {
+            peek = malloc(sz);
+            if (peek == NULL) {
+                return (false);
+            }
+            n = pread(proto->fd, peek, sz, proto->off);
+            tbscan_eol_detect(&proto->opts, peek, n > 0 ? n : 0);
+            free(peek);
+        }
+    }
+    return (true);
+}
+
+/*
+ * Measure a buffer in memory, using up to nthreads threads.
+ */
+void
+text_bounds_buf_parallel(const char *buf, size_t sz, textbox_t *ctxp, uint_t nthreads)
+{
+    struct tbpar_job proto = { 0 };
+
+    proto.buf = buf;
+    if (tb_measure(ctxp) == TB_MEASURE_NONE) {
+        return;
+    }
+    if (!tbpar_init(&proto, sz, ctxp) || nthreads <= 1 || sz < 2 * TB_PAR_MIN_CHUNK
+        || ctxp->max_lines != 0 || ctxp->max_columns != 0
+        || tbpar_run(&proto, sz, ctxp, nthreads, tbpar_buf_worker) != 0) {
+        text_bounds_buf(buf, sz, ctxp);
+    }
+}
+
+/*
+ * Measure the first sz bytes of an open file, serially, with pread().
+ */
+static int
+tbpar_fd_serial(int fd, size_t sz, textbox_t *ctxp)
+{
+    tbscan_t scan;
+    char *buf;
+    off_t off;
+    ssize_t rsz;
+    int err;
+
+    buf = malloc(TB_PAR_BLOCK);
+    if (buf == NULL) {
+        return (ENOMEM);
+    }
+    err = 0;
+    off = 0;
+    text_bounds_start(&scan, ctxp);
+    while ((size_t)off < sz) {
+        rsz = pread(fd, buf, sz - off < TB_PAR_BLOCK ? sz - off : TB_PAR_BLOCK, off);
+        if (rsz < 0 && errno == EINTR) {
+            continue;
+        }
+        if (rsz <= 0) {
+            err = (rsz < 0) ? errno : EIO;
+            break;
+        }
+        text_bounds_feed(&scan, buf, rsz);
+        off += rsz;
+    }
+    if (err == 0) {
+        text_bounds_finish(&scan, ctxp);
+    }
+    free(buf);
+    return (err);
+}
+
+/*
+ * Measure the first sz bytes of an open file, using up to nthreads
+ * threads, each reading its own part of the file with pread().
+ *
+ * Return 0 on success, or an errno value.
+ */
+int
+text_bounds_fd_parallel(int fd, size_t sz, textbox_t *ctxp, uint_t nthreads)
+{
+    struct tbpar_job proto = { 0 };
+
+    proto.fd = fd;
+    if (tb_measure(ctxp) == TB_MEASURE_NONE) {
+        return (0);
+    }
+    if (!tbpar_init(&proto, sz, ctxp)) {
+        return (tbpar_fd_serial(fd, sz, ctxp));
+    }
+    if (nthreads < 1) {
+        nthreads = 1;
+    }
+    return (tbpar_run(&proto, sz, ctxp, nthreads, tbpar_fd_worker));
+}
@@ -0,0 +1,288 @@
+/*
+ * Filename: textbounds-stats.c
+ * Library: libtextbounds
+ * Brief: Where the time went, over all the files measured.
+ *
+ * Description:
+ *   Each file measured with .stats comes back with its own .fstat:
+ *   time spent opening, reading and measuring, bytes read,
+ *   and system calls.  Here, they are added up, and the latency
+ *   of each file goes into a histogram -- the same one that
+ *   is used for line widths, only counting nanoseconds -- so memory
+ *   is fixed, however many files there are.  The slowest few files
+ *   are kept in a min-heap, with copies of their names.
+ *
+ *   Files are added one at a time, by whoever reports results,
+ *   so there is no locking.
+ *
+ * Copyright (C) 2019 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE 1
+
+#include <textbounds.h>
+#include <textbounds_int.h>
+#include <stdlib.h>
+    // Import calloc(), malloc(), free(), qsort()
+#include <string.h>
+    // Import strdup(), strcmp(), memcpy()
+#include <sys/resource.h>
+    // Import getrusage()
+
+struct tbslow {
+    uint64_t ns;
+    char     *fname;
+};
+
+struct tbstats {
+    size_t   files;
+    size_t   errors;
+    uint64_t open_ns;
+    uint64_t read_ns;
+    uint64_t measure_ns;
+    uint64_t format_ns;
+    uint64_t bytes;
+    uint64_t syscalls;
+    tbhist_t *latency;      // Of each file, in nanoseconds
+    size_t   nslowest;
+    size_t   nslow;         // In the heap, so far
+    struct tbslow *slow;    // Min-heap: the fastest of the slowest first
+};
+
+tbstats_t *
+text_bounds_stats_new(size_t nslowest)
+{
+    struct tbstats *stats;
+
+    stats = calloc(1, sizeof (*stats));
+    if (stats == NULL) {
+        return (NULL);
+    }
+    stats->latency = text_bounds_hist_new();
+    stats->slow = calloc(nslowest + 1, sizeof (struct tbslow));
+    if (stats->latency == NULL || stats->slow == NULL) {
+        text_bounds_stats_free(stats);
+        return (NULL);
+    }
+    stats->nslowest = nslowest;
+    return (stats);
+}
+
+void
+text_bounds_stats_free(tbstats_t *stats)
+{
+    size_t i;
+
+    if (stats == NULL) {
+        return;
+    }
+    for (i = 0; i < stats->nslow; ++i) {
+        free(stats->slow[i].fname);
+    }
+    free(stats->slow);
+    text_bounds_hist_free(stats->latency);
+    free(stats);
+}
+
+static void
+slow_sift_down(struct tbslow *heap, size_t n, size_t i)
+{
+    struct tbslow tmp;
+    size_t least;
+    size_t c;
+
+    for (;;) {
+        least = i;
+        for (c = 2 * i + 1; c <= 2 * i + 2 && c < n; ++c) {
+            if (heap[c].ns < heap[least].ns) {
+                least = c;
+            }
+        }
+        if (least == i) {
+            return;
+        }
+        tmp = heap[i];
+        heap[i] = heap[least];
+        heap[least] = tmp;
+        i = least;
+    }
+}
+
+static void
+slow_sift_up(struct tbslow *heap, size_t i)
+{
+    struct tbslow tmp;
+    size_t parent;
+
+    while (i > 0) {
+        parent = (i - 1) / 2;
+        if (heap[parent].ns <= heap[i].ns) {
+            return;
+        }
+        tmp = heap[i];
+        heap[i] = heap[parent];
+        heap[parent] = tmp;
+        i = parent;
+    }
+}
+
+/*
+ * Keep fname, if it is one of the slowest so far.
+ * Names are copied only when they get in, which is seldom,
+ * once the heap is full.
+ */
+static void
+slow_add(struct tbstats *stats, const char *fname, uint64_t ns)
+{
+    char *copy;
+
+    if (stats->nslowest == 0 || fname == NULL) {
+        return;
+    }
+    if (stats->nslow == stats->nslowest && ns <= stats->slow[0].ns) {
+        return;
+    }
+    copy = strdup(fname);
+    if (copy == NULL) {
+        return;
+    }
+    if (stats->nslow < stats->nslowest) {
+        stats->slow[stats->nslow].ns = ns;
+        stats->slow[stats->nslow].fname = copy;
+        slow_sift_up(stats->slow, stats->nslow);
+        ++stats->nslow;
+        return;
+    }
+    free(stats->slow[0].fname);
+    stats->slow[0].ns = ns;
+    stats->slow[0].fname = copy;
+    slow_sift_down(stats->slow, stats->nslow, 0);
+}
+
+void
+text_bounds_stats_add(tbstats_t *stats, const char *fname, const struct tbfstat *fs, int err)
+{
+    uint64_t ns;
+
+    ns = fs->open_ns + fs->read_ns + fs->measure_ns;
+    ++stats->files;
+    if (err != 0) {
+        ++stats->errors;
+    }
+    stats->open_ns += fs->open_ns;
+    stats->read_ns += fs->read_ns;
+    stats->measure_ns += fs->measure_ns;
+    stats->bytes += fs->bytes;
+    stats->syscalls += fs->syscalls;
+    tbhist_add(stats->latency, ns);
+    slow_add(stats, fname, ns);
+}
+
+void
+text_bounds_stats_format(tbstats_t *stats, uint64_t ns)
+{
+    stats->format_ns += ns;
+}
+
+/*
+ * A time, to 3 significant digits, in units that suit it.
+ */
+static const char *
+fmt_ns(char *buf, size_t sz, uint64_t ns)
+{
+    if (ns < 1000) {
+        snprintf(buf, sz, "%u ns", (uint_t)ns);
+    }
+    else if (ns < 1000000) {
+        snprintf(buf, sz, "%.3g us", ns / 1e3);
+    }
+    else if (ns < 1000000000) {
+        snprintf(buf, sz, "%.3g ms", ns / 1e6);
+    }
+    else {
+        snprintf(buf, sz, "%.3f s", ns / 1e9);
+    }
+    return (buf);
+}
+
+static int
+cmp_slow_desc(const void *a, const void *b)
+{
+    const struct tbslow *sa = (const struct tbslow *)a;
+    const struct tbslow *sb = (const struct tbslow *)b;
+
+    if (sa->ns != sb->ns) {
+        return (sa->ns > sb->ns ? -1 : 1);
+    }
+    return (strcmp(sa->fname, sb->fname));
+}
+
+void
+text_bounds_stats_show(const tbstats_t *stats, FILE *f, const char *prefix,
+    uint64_t wall_ns, uint64_t writes)
+{
+    struct rusage ru;
+    struct tbslow *slow;
+    double secs;
+    char b1[32];
+    char b2[32];
+    char b3[32];
+    char b4[32];
+    size_t i;
+
+    secs = (wall_ns > 0) ? wall_ns / 1e9 : 1e-9;
+    fprintf(f, "%s: %zu files, %zu failed, %.1f MB, in %s\n",
+        prefix, stats->files, stats->errors, stats->bytes / 1e6,
+        fmt_ns(b1, sizeof (b1), wall_ns));
+    fprintf(f, "%s: throughput: %.1f MB/s, %.0f files/s\n",
+        prefix, stats->bytes / 1e6 / secs, stats->files / secs);
+    fprintf(f, "%s: time, summed over files: open %s, read %s, measure %s, format %s\n",
+        prefix,
+        fmt_ns(b1, sizeof (b1), stats->open_ns),
+        fmt_ns(b2, sizeof (b2), stats->read_ns),
+        fmt_ns(b3, sizeof (b3), stats->measure_ns),
+        fmt_ns(b4, sizeof (b4), stats->format_ns));
+    fprintf(f, "%s: syscalls: %llu, %.1f per file; and %llu to write output\n",
+        prefix, (unsigned long long)stats->syscalls,
+        stats->files > 0 ? (double)stats->syscalls / stats->files : 0.0,
+        (unsigned long long)writes);
+    if (getrusage(RUSAGE_SELF, &ru) == 0) {
+        // ru_maxrss is in kilobytes, on Linux
+        fprintf(f, "%s: peak RSS: %.1f MB\n", prefix, ru.ru_maxrss / 1024.0);
+    }
+    if (stats->files == 0) {
+        return;
+    }
+    fprintf(f, "%s: latency: p50 %s, p99 %s, max %s\n",
+        prefix,
+        fmt_ns(b1, sizeof (b1), text_bounds_hist_quantile(stats->latency, 0.50)),
+        fmt_ns(b2, sizeof (b2), text_bounds_hist_quantile(stats->latency, 0.99)),
+        fmt_ns(b3, sizeof (b3), stats->latency->max));
+
+    // Slowest first; the heap itself is left as it is.
+    slow = malloc(stats->nslow * sizeof (*slow) + 1);
+    if (slow == NULL) {
+        return;
+    }
+    memcpy(slow, stats->slow, stats->nslow * sizeof (*slow));
+    qsort(slow, stats->nslow, sizeof (*slow), cmp_slow_desc);
+    for (i = 0; i < stats->nslow; ++i) {
+        fprintf(f, "%s: slowest: %s '%s'\n",
+            prefix, fmt_ns(b1, sizeof (b1), slow[i].ns), slow[i].fname);
+    }
+    free(slow);
+}
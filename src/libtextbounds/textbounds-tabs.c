@@ -0,0 +1,134 @@
+/*
+ * Filename: textbounds-tabs.c
+ * Library: libtextbounds
+ * Brief: Make tab stops from a specification, like that of expand -t.
+ *
+ * Copyright (C) 2019 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <textbounds.h>
+#include <textbounds_int.h>
+#include <errno.h>
+    // Import errno, EINVAL, ENOMEM
+#include <stdlib.h>
+    // Import strtoul(), calloc(), free()
+
+/*
+ * No tab stop beyond this column.  Keeps the lookup table sane.
+ */
+#define TB_TABS_MAX  (64 * 1024)
+
+/*
+ * Parse one column number, followed by ',' or the end.
+ * Return the position after it, or NULL if it is not valid.
+ */
+static const char *
+parse_stop(const char *s, size_t *colp)
+{
+    unsigned long col;
+    char *end;
+
+    if (*s < '0' || *s > '9') {
+        return (NULL);
+    }
+    errno = 0;
+    col = strtoul(s, &end, 10);
+    if (errno != 0 || col > TB_TABS_MAX || (*end != ',' && *end != '\0')) {
+        return (NULL);
+    }
+    *colp = col;
+    return (*end == ',' ? end + 1 : end);
+}
+
+tbtabs_t *
+text_bounds_tabs(const char *spec)
+{
+    struct tbtabs *tabs;
+    const char *s;
+    size_t prev;
+    size_t stop;
+    size_t col;
+
+    tabs = calloc(1, sizeof (*tabs));
+    if (tabs == NULL) {
+        errno = ENOMEM;
+        return (NULL);
+    }
+
+    s = parse_stop(spec, &stop);
+    if (s != NULL && *s == '\0' && (s == spec || s[-1] != ',')) {
+        // A single number: regular tab stops
+        if (stop == 0) {
+            goto invalid;
+        }
+        tabs->width = stop;
+        if (stop == 8) {
+            tabs->kind = TB_TABS_8;
+        }
+        else if ((stop & (stop - 1)) == 0) {
+            tabs->kind = TB_TABS_POW2;
+        }
+        else {
+            tabs->kind = TB_TABS_REGULAR;
+        }
+        return (tabs);
+    }
+
+    // A list: first find the last tab stop, and check the order.
+    if (*spec == '\0') {
+        goto invalid;
+    }
+    prev = 0;
+    for (s = spec; *s != '\0'; prev = stop) {
+        s = parse_stop(s, &stop);
+        if (s == NULL || stop <= prev || (s[-1] == ',' && *s == '\0')) {
+            goto invalid;
+        }
+    }
+    tabs->kind = TB_TABS_LIST;
+    tabs->last = prev;
+    tabs->next = calloc(tabs->last, sizeof (size_t));
+    if (tabs->next == NULL) {
+        free(tabs);
+        errno = ENOMEM;
+        return (NULL);
+    }
+
+    // Then fill in the lookup table, one stretch between stops at a time.
+    col = 0;
+    for (s = spec; *s != '\0'; ) {
+        s = parse_stop(s, &stop);
+        for (; col < stop; ++col) {
+            tabs->next[col] = stop;
+        }
+    }
+    return (tabs);
+
+invalid:
+    free(tabs);
+    errno = EINVAL;
+    return (NULL);
+}
+
+void
+text_bounds_tabs_free(tbtabs_t *tabs)
+{
+    if (tabs != NULL) {
+        free(tabs->next);
+        free(tabs);
+    }
+}
@@ -0,0 +1,704 @@
+/*
+ * Filename: textbounds-uring.c
+ * Library: libtextbounds
+ * Brief: Measure a list of files using io_uring for all the I/O.
+ *
+ * Description:
+ *   When most files are small, the time goes to open(), read()
+ *   and close() system calls, not to measuring.  Here, a ring is kept
+ *   full of openat, statx, read and close requests for many files
+ *   at once, and they are all submitted with one system call.
+ *   Each file is measured as its reads complete.
+ *
+ *   Once both the size and the file descriptor of a file are known,
+ *   if the file is bigger than one read, the kernel is told that we
+ *   will need all of it (readahead), while other files are measured.
+ *
+ *   The raw system calls are used, so there is no dependency
+ *   on liburing.  If io_uring is not available, or does not support
+ *   all the operations that we need, we say so, and the caller
+ *   falls back to the synchronous path.
+ *
+ * Copyright (C) 2019 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE 1
+
+#include <textbounds.h>
+#include <textbounds_int.h>
+
+#if defined(__linux__)
+#include <linux/io_uring.h>
+#endif
+
+/*
+ * The opcodes are an enum, so test for a feature flag that arrived
+ * in the same kernel release as IORING_OP_STATX, or just after it.
+ */
+#if defined(__linux__) && defined(IORING_FEAT_FAST_POLL)
+
+#include <errno.h>
+    // Import errno
+#include <fcntl.h>
+    // Import AT_FDCWD, O_RDONLY, POSIX_FADV_WILLNEED
+#include <stdint.h>
+    // Import type uint64_t
+#include <stdlib.h>
+    // Import calloc(), free()
+#include <string.h>
+    // Import memset(), strcmp()
+#include <sys/mman.h>
+    // Import mmap(), munmap()
+#include <sys/stat.h>
+    // Import struct statx
+#include <sys/syscall.h>
+    // Import __NR_io_uring_setup, ...
+#include <unistd.h>
+    // Import syscall(), close()
+
+/*
+ * Files in flight at once, and the size of each read.
+ */
+#define TB_URING_FILES   64
+#define TB_URING_BUFSIZ  (32 * 1024)
+
+/*
+ * Each file has at most 4 requests in flight; closes have no file.
+ */
+#define TB_URING_ENTRIES (4 * TB_URING_FILES)
+
+enum { OP_OPEN = 1, OP_STATX, OP_READ, OP_FADVISE, OP_CLOSE };
+
+struct tbring {
+    int      fd;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned *sq_array;
+    unsigned sq_local_tail;
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    unsigned cq_entries;
+    struct io_uring_cqe *cqes;
+    void     *sq_map;
+    size_t   sq_map_sz;
+    void     *cq_map;
+    size_t   cq_map_sz;
+    size_t   sqes_sz;
+    unsigned to_submit;
+    unsigned inflight;
+};
+
+struct tbslot {
+    bool     busy;
+    size_t   fnr;           // Index of file in this slot
+    int      fd;            // -1 until open completes
+    int      pending;       // Requests in flight for this file
+    bool     stat_done;
+    bool     regular;
+    uint64_t size;
+    bool     fadvised;
+    bool     finished;      // No more reads needed
+    bool     compressed;    // Left to text_bounds_file()
+    uint64_t off;
+    tbscan_t scan;
+    tbhist_t *shared;       // The file's own .hist, while it has one of ours
+    uint64_t t_start;       // .stats: when the open was queued
+    struct statx stx;
+    char     *buf;
+};
+
+static int
+sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return ((int)syscall(__NR_io_uring_setup, entries, p));
+}
+
+static int
+sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return ((int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0));
+}
+
+static int
+sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+    return ((int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+static void
+tbring_free(struct tbring *ring)
+{
+    if (ring->sqes != NULL && ring->sqes != MAP_FAILED) {
+        munmap(ring->sqes, ring->sqes_sz);
+    }
+    if (ring->cq_map != NULL && ring->cq_map != MAP_FAILED && ring->cq_map != ring->sq_map) {
+        munmap(ring->cq_map, ring->cq_map_sz);
+    }
+    if (ring->sq_map != NULL && ring->sq_map != MAP_FAILED) {
+        munmap(ring->sq_map, ring->sq_map_sz);
+    }
+    if (ring->fd >= 0) {
+        close(ring->fd);
+    }
+}
+
+/*
+ * Does the kernel support every operation that we use?
+ */
+static bool
+tbring_probe(struct tbring *ring)
+{
+    static const int ops[] = {
+        IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ,
+        IORING_OP_FADVISE, IORING_OP_CLOSE
+    };
+    struct io_uring_probe *probe;
+    size_t sz;
+    size_t i;
+    bool ok;
+
+    sz = sizeof (*probe) + 256 * sizeof (struct io_uring_probe_op);
+    probe = calloc(1, sz);
+    if (probe == NULL) {
+        return (false);
+    }
+    ok = (sys_io_uring_register(ring->fd, IORING_REGISTER_PROBE, probe, 256) == 0);
+    for (i = 0; ok && i < sizeof (ops) / sizeof (ops[0]); ++i) {
+        ok = ops[i] <= probe->last_op
+            && (probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED) != 0;
+    }
+    free(probe);
+    return (ok);
+}
+
+static int
+tbring_init(struct tbring *ring, unsigned entries)
+{
+    struct io_uring_params p;
+    char *sq;
+    char *cq;
+
+    memset(ring, 0, sizeof (*ring));
+    memset(&p, 0, sizeof (p));
+    ring->fd = sys_io_uring_setup(entries, &p);
+    if (ring->fd < 0) {
+        return (-1);
+    }
+
+    ring->sq_map_sz = p.sq_off.array + p.sq_entries * sizeof (unsigned);
+    ring->cq_map_sz = p.cq_off.cqes + p.cq_entries * sizeof (struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_map_sz > ring->sq_map_sz) {
+            ring->sq_map_sz = ring->cq_map_sz;
+        }
+    }
+    ring->sq_map = mmap(NULL, ring->sq_map_sz, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_map == MAP_FAILED) {
+        tbring_free(ring);
+        return (-1);
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_map = ring->sq_map;
+    }
+    else {
+        ring->cq_map = mmap(NULL, ring->cq_map_sz, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_map == MAP_FAILED) {
+            tbring_free(ring);
+            return (-1);
+        }
+    }
+    ring->sqes_sz = p.sq_entries * sizeof (struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_sz, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        tbring_free(ring);
+        return (-1);
+    }
+
+    sq = ring->sq_map;
+    cq = ring->cq_map;
+    ring->sq_head = (unsigned *)(sq + p.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    ring->sq_mask = *(unsigned *)(sq + p.sq_off.ring_mask);
+    ring->sq_entries = p.sq_entries;
+    ring->sq_array = (unsigned *)(sq + p.sq_off.array);
+    ring->sq_local_tail = *ring->sq_tail;
+    ring->cq_head = (unsigned *)(cq + p.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    ring->cq_mask = *(unsigned *)(cq + p.cq_off.ring_mask);
+    ring->cq_entries = p.cq_entries;
+    ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    if (!tbring_probe(ring)) {
+        tbring_free(ring);
+        return (-1);
+    }
+    return (0);
+}
+
+static int
+tbring_submit(struct tbring *ring, unsigned wait)
+{
+    int rv;
+
+    __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+    do {
+        rv = sys_io_uring_enter(ring->fd, ring->to_submit, wait,
+            wait ? IORING_ENTER_GETEVENTS : 0);
+    } while (rv < 0 && errno == EINTR);
+    if (rv >= 0) {
+        ring->to_submit -= rv;
+    }
+    return (rv);
+}
+
+/*
+ * Wait until every request that the kernel has been given is complete,
+ * so that nothing more is written to our buffers.  Requests that were
+ * never submitted are dropped.  Closing the ring would not do:
+ * requests already under way may still complete after that.
+ * Return 0, or -1 if the ring cannot even be waited on.
+ */
+static int
+tbring_drain(struct tbring *ring)
+{
+    unsigned head;
+    unsigned tail;
+    int rv;
+
+    ring->inflight -= ring->to_submit;
+    ring->to_submit = 0;
+    while (ring->inflight > 0) {
+        head = *ring->cq_head;
+        tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        if (head != tail) {
+            ring->inflight -= (tail - head < ring->inflight) ? tail - head : ring->inflight;
+            __atomic_store_n(ring->cq_head, tail, __ATOMIC_RELEASE);
+            continue;
+        }
+        do {
+            rv = sys_io_uring_enter(ring->fd, 0, 1, IORING_ENTER_GETEVENTS);
+        } while (rv < 0 && errno == EINTR);
+        if (rv < 0) {
+            return (-1);
+        }
+    }
+    return (0);
+}
+
+static struct io_uring_sqe *
+tbring_get_sqe(struct tbring *ring)
+{
+    struct io_uring_sqe *sqe;
+    unsigned idx;
+
+    if (ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE)
+        >= ring->sq_entries) {
+        tbring_submit(ring, 0);
+    }
+    idx = ring->sq_local_tail & ring->sq_mask;
+    sqe = &ring->sqes[idx];
+    memset(sqe, 0, sizeof (*sqe));
+    ring->sq_array[idx] = idx;
+    ++ring->sq_local_tail;
+    ++ring->to_submit;
+    ++ring->inflight;
+    return (sqe);
+}
+
+static uint64_t
+user_data(size_t slot, int op)
+{
+    return (((uint64_t)slot << 8) | op);
+}
+
+static void
+slot_read(struct tbring *ring, struct tbslot *sp, size_t snr)
+{
+    struct io_uring_sqe *sqe = tbring_get_sqe(ring);
+
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = sp->fd;
+    sqe->addr = (uint64_t)(uintptr_t)sp->buf;
+    sqe->len = TB_URING_BUFSIZ;
+    sqe->off = sp->off;
+    sqe->user_data = user_data(snr, OP_READ);
+    ++sp->pending;
+}
+
+/*
+ * Readahead, once we know the file is open, and bigger than one read.
+ */
+static void
+slot_fadvise(struct tbring *ring, struct tbslot *sp, size_t snr)
+{
+    struct io_uring_sqe *sqe;
+
+    if (sp->fadvised || sp->fd < 0 || !sp->stat_done || sp->finished
+        || sp->size <= TB_URING_BUFSIZ) {
+        return;
+    }
+    sqe = tbring_get_sqe(ring);
+    sqe->opcode = IORING_OP_FADVISE;
+    sqe->fd = sp->fd;
+    sqe->off = 0;
+    sqe->len = 0;
+    sqe->fadvise_advice = POSIX_FADV_WILLNEED;
+    sqe->user_data = user_data(snr, OP_FADVISE);
+    sp->fadvised = true;
+    ++sp->pending;
+}
+
+static void
+slot_start(struct tbring *ring, struct tbslot *sp, size_t snr, tbfile_t *fp, size_t fnr)
+{
+    struct io_uring_sqe *sqe;
+
+    sp->busy = true;
+    sp->fnr = fnr;
+    sp->fd = -1;
+    sp->pending = 0;
+    sp->stat_done = false;
+    sp->regular = false;
+    sp->size = 0;
+    sp->fadvised = false;
+    sp->finished = false;
+    sp->compressed = false;
+    sp->off = 0;
+    if (fp->box.stats) {
+        memset(&fp->box.fstat, 0, sizeof (fp->box.fstat));
+        sp->t_start = tb_clock_ns();
+    }
+    if (tbfile_hist_begin(fp, &sp->shared) != 0) {
+        fp->err = ENOMEM;
+        fp->errop = "read";
+    }
+    text_bounds_start(&sp->scan, &fp->box);
+
+    sqe = tbring_get_sqe(ring);
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uint64_t)(uintptr_t)fp->fname;
+    sqe->open_flags = O_RDONLY;
+    sqe->user_data = user_data(snr, OP_OPEN);
+    ++sp->pending;
+
+    sqe = tbring_get_sqe(ring);
+    sqe->opcode = IORING_OP_STATX;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uint64_t)(uintptr_t)fp->fname;
+    sqe->len = STATX_TYPE | STATX_SIZE;
+    sqe->off = (uint64_t)(uintptr_t)&sp->stx;
+    sqe->user_data = user_data(snr, OP_STATX);
+    ++sp->pending;
+}
+
+/*
+ * Handle one completion.
+ */
+static void
+slot_complete(struct tbring *ring, struct tbslot *sp, size_t snr, int op, int res,
+    tbfile_t *fp)
+{
+    uint64_t t0;
+
+    --sp->pending;
+    if (fp->box.stats) {
+        ++fp->box.fstat.syscalls;
+        if (op == OP_READ && res > 0) {
+            fp->box.fstat.bytes += res;
+        }
+    }
+    switch (op) {
+    case OP_OPEN:
+        if (res < 0) {
+            fp->err = -res;
+            fp->errop = "fopen";
+            sp->finished = true;
+            break;
+        }
+        sp->fd = res;
+        if (sp->scan.measure == TB_MEASURE_NONE) {
+            sp->finished = true;
+            break;
+        }
+        slot_read(ring, sp, snr);
+        slot_fadvise(ring, sp, snr);
+        break;
+    case OP_STATX:
+        sp->stat_done = true;
+        if (res == 0 && S_ISREG(sp->stx.stx_mode)) {
+            sp->regular = true;
+            sp->size = sp->stx.stx_size;
+        }
+        slot_fadvise(ring, sp, snr);
+        break;
+    case OP_READ:
+        if (res < 0) {
+            fp->err = -res;
+            fp->errop = "read";
+            sp->finished = true;
+            break;
+        }
+        if (res == 0) {
+            sp->finished = true;
+            break;
+        }
+        if (sp->off == 0 && fp->box.decompress
+            && tbdecomp_kind(sp->buf, res) != TB_DECOMP_NONE) {
+            // Decoding takes a thread of its own; see below.
+            sp->compressed = true;
+            sp->finished = true;
+            break;
+        }
+        sp->off += res;
+        t0 = fp->box.stats ? tb_clock_ns() : 0;
+        if (!text_bounds_feed(&sp->scan, sp->buf, res)) {
+            // It does not fit; no need to read the rest
+            sp->finished = true;
+        }
+        if (fp->box.stats) {
+            fp->box.fstat.measure_ns += tb_clock_ns() - t0;
+        }
+        if (sp->finished) {
+            break;
+        }
+        // No need for one more read, just to see end-of-file
+        if (sp->stat_done && sp->regular && sp->off >= sp->size) {
+            sp->finished = true;
+            break;
+        }
+        slot_read(ring, sp, snr);
+        break;
+    case OP_FADVISE:
+        break;
+    }
+}
+
+/*
+ * Measure filec files, using io_uring.
+ * The contract is the same as for text_bounds_filev_jobs().
+ *
+ * Return 0, or 2 if any file could not be opened,
+ * or -1 if io_uring cannot be used, in which case nothing has been done.
+ */
+int
+text_bounds_filev_uring(size_t filec, tbfile_t *files, bool ordered,
+    tbfile_report_fn report, void *report_arg)
+{
+    struct tbring ring;
+    struct tbslot *slots;
+    char *bufs;
+    size_t next_file;
+    size_t next_report;
+    size_t nslots;
+    size_t snr;
+    size_t i;
+    bool cancel;
+    bool failed;
+    int rv;
+
+    for (i = 0; i < filec; ++i) {
+        if (strcmp(files[i].fname, "-") == 0 || files[i].box.index != NULL
+            || files[i].box.cache != NULL) {
+            // stdin is already open, and indexes and caches are kept
+            // by text_bounds_file(); leave them to the synchronous path
+            return (-1);
+        }
+    }
+
+    if (tbring_init(&ring, TB_URING_ENTRIES) != 0) {
+        return (-1);
+    }
+
+    nslots = TB_URING_FILES;
+    slots = calloc(nslots, sizeof (struct tbslot));
+    bufs = malloc(nslots * TB_URING_BUFSIZ);
+    if (slots == NULL || bufs == NULL) {
+        free(slots);
+        free(bufs);
+        tbring_free(&ring);
+        return (-1);
+    }
+    for (snr = 0; snr < nslots; ++snr) {
+        slots[snr].buf = bufs + snr * TB_URING_BUFSIZ;
+    }
+
+    for (i = 0; i < filec; ++i) {
+        files[i].done = false;
+        files[i].err = 0;
+        files[i].errop = NULL;
+    }
+
+    rv = 0;
+    cancel = false;
+    failed = false;
+    next_file = 0;
+    next_report = 0;
+    for (;;) {
+        unsigned head;
+        unsigned tail;
+
+        // Fill free slots, so long as the completion queue has room.
+        for (snr = 0; snr < nslots && next_file < filec && !cancel; ++snr) {
+            if (!slots[snr].busy && ring.inflight + 4 <= ring.cq_entries) {
+                slot_start(&ring, &slots[snr], snr, &files[next_file], next_file);
+                ++next_file;
+            }
+        }
+
+        if (ring.inflight == 0) {
+            break;
+        }
+        if (tbring_submit(&ring, 1) < 0 && errno != EAGAIN && errno != EBUSY) {
+            failed = true;
+            break;
+        }
+
+        head = *ring.cq_head;
+        tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) {
+            struct io_uring_cqe *cqe = &ring.cqes[head & ring.cq_mask];
+            struct tbslot *sp;
+            int op;
+
+            --ring.inflight;
+            op = cqe->user_data & 0xff;
+            if (op == OP_CLOSE) {
+                continue;
+            }
+            snr = cqe->user_data >> 8;
+            sp = &slots[snr];
+            slot_complete(&ring, sp, snr, op, cqe->res, &files[sp->fnr]);
+            if (sp->finished && sp->pending == 0) {
+                tbfile_t *fp = &files[sp->fnr];
+
+                if (sp->fd >= 0) {
+                    struct io_uring_sqe *sqe = tbring_get_sqe(&ring);
+
+                    sqe->opcode = IORING_OP_CLOSE;
+                    sqe->fd = sp->fd;
+                    sqe->user_data = user_data(0, OP_CLOSE);
+                }
+                if (sp->compressed) {
+                    tbfile_hist_end(fp, sp->shared, false);
+                    text_bounds_file(fp, 1);
+                }
+                else {
+                    uint64_t t0 = fp->box.stats ? tb_clock_ns() : 0;
+
+                    text_bounds_finish(&sp->scan, &fp->box);
+                    tbfile_hist_end(fp, sp->shared, fp->err == 0);
+                    if (fp->box.stats) {
+                        struct tbfstat *fs = &fp->box.fstat;
+                        uint64_t t1 = tb_clock_ns();
+
+                        // All but measuring was waiting for the ring
+                        fs->measure_ns += t1 - t0;
+                        fs->read_ns = t1 - sp->t_start - fs->measure_ns;
+                        fs->syscalls += (sp->fd >= 0) ? 1 : 0;
+                    }
+                }
+                fp->done = true;
+                sp->busy = false;
+                if (!ordered) {
+                    (*report)(fp, report_arg);
+                    if (fp->err != 0 && strcmp(fp->errop, "fopen") == 0) {
+                        rv = 2;
+                    }
+                }
+            }
+        }
+        __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+
+        // Report, in order, everything that is ready.
+        while (ordered && !cancel && next_report < filec && files[next_report].done) {
+            tbfile_t *fp = &files[next_report];
+
+            (*report)(fp, report_arg);
+            ++next_report;
+            if (fp->err != 0 && strcmp(fp->errop, "fopen") == 0) {
+                // Stop, just like the serial loop; drain what is in flight.
+                cancel = true;
+                rv = 2;
+            }
+        }
+    }
+
+    if (failed) {
+        // The ring is broken.  Finish the job synchronously.
+        for (snr = 0; snr < nslots; ++snr) {
+            if (slots[snr].busy && slots[snr].fd >= 0) {
+                close(slots[snr].fd);
+            }
+            if (slots[snr].busy) {
+                tbfile_hist_end(&files[slots[snr].fnr], slots[snr].shared, false);
+            }
+        }
+        for (i = ordered ? next_report : 0; i < filec && !cancel; ++i) {
+            tbfile_t *fp = &files[i];
+
+            if (!fp->done) {
+                fp->err = 0;
+                fp->errop = NULL;
+                text_bounds_file(fp, 1);
+                fp->done = true;
+                if (!ordered) {
+                    (*report)(fp, report_arg);
+                }
+            }
+            if (ordered) {
+                (*report)(fp, report_arg);
+            }
+            if (fp->err != 0 && strcmp(fp->errop, "fopen") == 0) {
+                cancel = ordered;
+                rv = 2;
+            }
+        }
+    }
+
+    // Reads into bufs, and statx into slots, may still be under way.
+    // If they cannot be waited for, that memory is never freed.
+    if (tbring_drain(&ring) == 0) {
+        free(slots);
+        free(bufs);
+    }
+    tbring_free(&ring);
+    return (rv);
+}
+
+#else
+
+int
+text_bounds_filev_uring(size_t filec, tbfile_t *files, bool ordered,
+    tbfile_report_fn report, void *report_arg)
+{
+    (void)filec;
+    (void)files;
+    (void)ordered;
+    (void)report;
+    (void)report_arg;
+    return (-1);
+}
+
+#endif /* __linux__ && IORING_FEAT_FAST_POLL */
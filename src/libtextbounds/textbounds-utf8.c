@@ -0,0 +1,225 @@
+/*
+ * Filename: textbounds-utf8.c
+ * Library: libtextbounds
+ * Brief: Measure UTF-8 text in terminal display cells.
+ *
+ * Description:
+ *   Most text is ASCII, with the occasional UTF-8 character.
+ *   So, the leading run of ASCII is found with a vectorized check,
+ *   a whole block at a time, and handed to the current scan engine,
+ *   without decoding anything.  Only the bytes from the first
+ *   non-ASCII byte to the next ASCII byte are decoded, one at a time,
+ *   and their widths are looked up in a generated table.
+ *
+ *   A sequence can be split between one span and the next;
+ *   the partial sequence is carried in the scan state.
+ *
+ * Copyright (C) 2019 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <textbounds.h>
+#include <textbounds_int.h>
+
+/*
+ * Look for ASCII this much at a time, so that the text is still
+ * in cache when the scan engine gets to it.
+ */
+#define TB_U8_STEP  (16 * 1024)
+
+/*
+ * One character, of the given width class, at the current column.
+ */
+static inline void
+u8_put(struct tbscan *sp, uint_t wclass)
+{
+    switch (wclass) {
+    case TBW_INVISIBLE:
+        break;
+    case TBW_MARK:
+        if (sp->col > sp->inkcol) {
+            sp->inkcol = sp->col;
+        }
+        break;
+    case TBW_NARROW:
+        sp->col += 1;
+        sp->inkcol = sp->col;
+        break;
+    case TBW_WIDE:
+        sp->col += 2;
+        sp->inkcol = sp->col;
+        break;
+    }
+}
+
+/*
+ * Bytes that are not valid UTF-8 take one cell each.
+ */
+static inline void
+u8_bad(struct tbscan *sp, uint_t nbytes)
+{
+    sp->col += nbytes;
+    sp->inkcol = sp->col;
+}
+
+/*
+ * The length of the sequence being decoded, lead byte and all.
+ */
+static inline uint_t
+u8_len(const struct tbscan *sp)
+{
+    if (sp->u8min == 0x80) {
+        return (2);
+    }
+    return (sp->u8min == 0x800 ? 3 : 4);
+}
+
+void
+tbscan_u8flush(struct tbscan *sp)
+{
+    if (sp->u8need != 0) {
+        u8_bad(sp, u8_len(sp) - sp->u8need);
+        sp->u8need = 0;
+    }
+}
+
+/*
+ * Decode from p up to the next ASCII byte that is not part of
+ * a sequence, or to end.  Return where decoding stopped.
+ */
+static const unsigned char *
+u8_decode(struct tbscan *sp, const unsigned char *p, const unsigned char *end)
+{
+    uint_t c;
+    uint_t cp;
+
+    for (; p < end; ++p) {
+        c = *p;
+        if (sp->u8need != 0) {
+            if ((c & 0xc0) != 0x80) {
+                // Cut short; what there was of it is not valid
+                tbscan_u8flush(sp);
+                if (c < 0x80) {
+                    break;
+                }
+            }
+            else {
+                sp->u8cp = (sp->u8cp << 6) | (c & 0x3f);
+                if (--sp->u8need == 0) {
+                    cp = sp->u8cp;
+                    if (cp < sp->u8min || cp > 0x10ffff
+                        || (cp >= 0xd800 && cp <= 0xdfff)) {
+                        // Overlong, out of range, or a surrogate
+                        u8_bad(sp, u8_len(sp));
+                    }
+                    else {
+                        u8_put(sp, tbw_class(cp));
+                    }
+                }
+                continue;
+            }
+        }
+
+        if (c < 0x80) {
+            break;
+        }
+        if (c >= 0xc2 && c <= 0xdf) {
+            sp->u8need = 1;
+            sp->u8cp = c & 0x1f;
+            sp->u8min = 0x80;
+        }
+        else if (c >= 0xe0 && c <= 0xef) {
+            sp->u8need = 2;
+            sp->u8cp = c & 0x0f;
+            sp->u8min = 0x800;
+        }
+        else if (c >= 0xf0 && c <= 0xf4) {
+            sp->u8need = 3;
+            sp->u8cp = c & 0x07;
+            sp->u8min = 0x10000;
+        }
+        else {
+            // Stray continuation byte, or never valid
+            u8_bad(sp, 1);
+        }
+    }
+    return (p);
+}
+
+void
+tbscan_utf8(struct tbscan *sp, const unsigned char *buf, size_t sz, bool tws)
+{
+    const unsigned char *p;
+    const unsigned char *q;
+    const unsigned char *end;
+    size_t len;
+    size_t n;
+
+    p = buf;
+    end = buf + sz;
+    while (p < end) {
+        if (sp->u8need == 0) {
+            len = end - p;
+            if (len > TB_U8_STEP) {
+                len = TB_U8_STEP;
+            }
+            n = (*tbascii_span)(p, len);
+            if (n != 0) {
+                (*tbscan_span)(sp, p, n, tws);
+                p += n;
+                continue;
+            }
+        }
+        // A CR left pending by the engine is not followed by LF
+        tbscan_cr_resolve(sp, *p);
+        q = u8_decode(sp, p, end);
+        sp->off += q - p;
+        p = q;
+    }
+}
+
+/*
+ * Return the length of buf, less any sequence at its end
+ * that is not yet complete.
+ */
+size_t
+tb_u8_complete(const unsigned char *buf, size_t sz)
+{
+    size_t len;
+    size_t i;
+    uint_t c;
+
+    for (i = 1; i <= 3 && i <= sz; ++i) {
+        c = buf[sz - i];
+        if ((c & 0xc0) == 0x80) {
+            continue;
+        }
+        if (c >= 0xc2 && c <= 0xdf) {
+            len = 2;
+        }
+        else if (c >= 0xe0 && c <= 0xef) {
+            len = 3;
+        }
+        else if (c >= 0xf0 && c <= 0xf4) {
+            len = 4;
+        }
+        else {
+            len = 1;
+        }
+        return (len > i ? sz - i : sz);
+    }
+    return (sz);
+}
@@ -0,0 +1,637 @@
+/*
+ * Filename: textbounds-walk.c
+ * Library: libtextbounds
+ * Brief: Measure every file in a directory tree, on several threads.
+ *
+ * Description:
+ *   Each thread has a queue of directories of its own.  It takes
+ *   the directory it pushed last, so that it goes depth first, and lists
+ *   it: subdirectories are pushed onto its queue, and regular files
+ *   are measured right away, opened relative to the directory that
+ *   they are in.  A thread whose queue is empty takes the oldest
+ *   directory from the queue of another thread; that is the one
+ *   nearest the top of its tree, so, likely the most work.
+ *   The walk is over when no directory is queued or being listed.
+ *
+ *   On Linux, directories are listed with getdents64(), many entries
+ *   at a time, and the type of each entry is taken from d_type,
+ *   so that there is no stat() at all, unless the file system
+ *   does not fill in d_type, or a symbolic link is to be followed.
+ *
+ *   Symbolic links are not followed, unless asked for.  If they are,
+ *   each directory is listed only once, however many links lead to it,
+ *   which also keeps a link to a directory above it from looping.
+ *   Trees named on the command line are walked even if they are
+ *   symbolic links themselves, as with find -H.
+ *
+ * Copyright (C) 2019 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE 1
+
+#include <textbounds.h>
+#include <textbounds_int.h>
+#include <dirent.h>
+    // Import type DIR, fdopendir(), readdir(), DT_*
+#include <errno.h>
+    // Import errno, ENOMEM
+#include <fcntl.h>
+    // Import open(), O_DIRECTORY, O_NOFOLLOW, AT_SYMLINK_NOFOLLOW
+#include <pthread.h>
+    // Import pthread_create(), pthread_join(), ...
+#include <stdint.h>
+    // Import type uint64_t
+#include <stdlib.h>
+    // Import malloc(), realloc(), calloc(), free()
+#include <string.h>
+    // Import memcpy(), memmove(), strlen()
+#include <sys/stat.h>
+    // Import stat(), fstat(), fstatat()
+#include <unistd.h>
+    // Import close()
+
+#ifdef __linux__
+#include <sys/syscall.h>
+    // Import SYS_getdents64
+#endif
+
+/*
+ * Directory entries are read this much at a time.
+ */
+#define TB_WALK_DIRBUF  (64 * 1024)
+
+struct tbwalk_dir {
+    dev_t    dev;           // File system the tree started on
+    bool     top;           // Named by the caller; may be a symbolic link
+    char     path[];
+};
+
+struct tbwalk_queue {
+    pthread_mutex_t lock;
+    struct tbwalk_dir **dirs;
+    size_t   head;          // Oldest, taken by other threads
+    size_t   tail;          // One past the newest, taken by the owner
+    size_t   size;
+};
+
+/*
+ * Directories already listed, with TB_WALK_FOLLOW.
+ */
+struct tbwalk_seen {
+    pthread_mutex_t lock;
+    uint64_t *keys;         // Pairs of dev, ino; 0, 0 is empty
+    size_t   nslots;
+    size_t   count;
+};
+
+struct tbwalk {
+    const tbfile_t *proto;
+    uint_t   flags;
+    uint_t   nthreads;
+    struct tbwalk_queue *queues;
+    struct tbwalk_seen seen;
+    size_t   pending;       // Directories queued, or being listed
+    uint_t   idle;          // Threads waiting for a directory
+    pthread_mutex_t lock;   // Held to wait, and to wake, idle threads
+    pthread_cond_t  cond;
+    pthread_mutex_t report_lock;
+    tbfile_report_fn report;
+    void     *report_arg;
+    bool     failed;
+};
+
+struct tbwalker {
+    struct tbwalk *walk;
+    uint_t   id;
+    char     *path;         // Path of the entry at hand
+    size_t   pathsz;
+    char     *buf;          // Directory entries
+};
+
+static struct tbwalk_dir *
+dir_new(const char *path, size_t len, dev_t dev)
+{
+    struct tbwalk_dir *dp;
+
+    dp = malloc(sizeof (*dp) + len + 1);
+    if (dp != NULL) {
+        dp->dev = dev;
+        dp->top = false;
+        memcpy(dp->path, path, len);
+        dp->path[len] = '\0';
+    }
+    return (dp);
+}
+
+static bool
+queue_push(struct tbwalk_queue *qp, struct tbwalk_dir *dp)
+{
+    struct tbwalk_dir **dirs;
+    size_t size;
+
+    pthread_mutex_lock(&qp->lock);
+    if (qp->tail == qp->size && qp->head > 0) {
+        memmove(qp->dirs, qp->dirs + qp->head, (qp->tail - qp->head) * sizeof (qp->dirs[0]));
+        qp->tail -= qp->head;
+        qp->head = 0;
+    }
+    if (qp->tail == qp->size) {
+        size = (qp->size != 0) ? 2 * qp->size : 64;
+        dirs = realloc(qp->dirs, size * sizeof (dirs[0]));
+        if (dirs == NULL) {
+            pthread_mutex_unlock(&qp->lock);
+            return (false);
+        }
+        qp->dirs = dirs;
+        qp->size = size;
+    }
+    qp->dirs[qp->tail++] = dp;
+    pthread_mutex_unlock(&qp->lock);
+    return (true);
+}
+
+/*
+ * Take the newest directory, if own, or the oldest, if not.
+ */
+static struct tbwalk_dir *
+queue_take(struct tbwalk_queue *qp, bool own)
+{
+    struct tbwalk_dir *dp;
+
+    pthread_mutex_lock(&qp->lock);
+    dp = NULL;
+    if (qp->head < qp->tail) {
+        dp = own ? qp->dirs[--qp->tail] : qp->dirs[qp->head++];
+    }
+    pthread_mutex_unlock(&qp->lock);
+    return (dp);
+}
+
+/*
+ * Queue a directory to be listed, and wake a thread to list it,
+ * if any are waiting.
+ */
+static void
+walk_push(struct tbwalker *wp, struct tbwalk_dir *dp)
+{
+    struct tbwalk *w = wp->walk;
+
+    __atomic_add_fetch(&w->pending, 1, __ATOMIC_SEQ_CST);
+    if (!queue_push(&w->queues[wp->id], dp)) {
+        free(dp);
+        __atomic_sub_fetch(&w->pending, 1, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&w->failed, true, __ATOMIC_RELAXED);
+        return;
+    }
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&w->idle, __ATOMIC_SEQ_CST) != 0) {
+        pthread_mutex_lock(&w->lock);
+        pthread_cond_broadcast(&w->cond);
+        pthread_mutex_unlock(&w->lock);
+    }
+}
+
+/*
+ * Take a directory from our own queue, or else from another.
+ */
+static struct tbwalk_dir *
+walk_take(struct tbwalker *wp)
+{
+    struct tbwalk *w = wp->walk;
+    struct tbwalk_dir *dp;
+    uint_t i;
+
+    dp = queue_take(&w->queues[wp->id], true);
+    for (i = 1; dp == NULL && i < w->nthreads; ++i) {
+        dp = queue_take(&w->queues[(wp->id + i) % w->nthreads], false);
+    }
+    return (dp);
+}
+
+static bool
+walk_any(struct tbwalk *w)
+{
+    struct tbwalk_queue *qp;
+    bool any;
+    uint_t i;
+
+    any = false;
+    for (i = 0; i < w->nthreads && !any; ++i) {
+        qp = &w->queues[i];
+        pthread_mutex_lock(&qp->lock);
+        any = (qp->head < qp->tail);
+        pthread_mutex_unlock(&qp->lock);
+    }
+    return (any);
+}
+
+/*
+ * Wait until there is a directory to take, or the walk is over.
+ * Return false if it is over.
+ */
+static bool
+walk_wait(struct tbwalk *w)
+{
+    bool more;
+
+    pthread_mutex_lock(&w->lock);
+    __atomic_add_fetch(&w->idle, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&w->pending, __ATOMIC_SEQ_CST) != 0 && !walk_any(w)) {
+        pthread_cond_wait(&w->cond, &w->lock);
+    }
+    __atomic_sub_fetch(&w->idle, 1, __ATOMIC_SEQ_CST);
+    more = (__atomic_load_n(&w->pending, __ATOMIC_SEQ_CST) != 0);
+    pthread_mutex_unlock(&w->lock);
+    return (more);
+}
+
+/*
+ * A directory has been listed.
+ */
+static void
+walk_done(struct tbwalk *w)
+{
+    if (__atomic_sub_fetch(&w->pending, 1, __ATOMIC_SEQ_CST) == 0) {
+        pthread_mutex_lock(&w->lock);
+        pthread_cond_broadcast(&w->cond);
+        pthread_mutex_unlock(&w->lock);
+    }
+}
+
+/*
+ * With TB_WALK_FOLLOW: is this the first time this directory is seen?
+ */
+static bool
+seen_first(struct tbwalk_seen *sp, const struct stat *st)
+{
+    uint64_t dev = (uint64_t)st->st_dev;
+    uint64_t ino = (uint64_t)st->st_ino;
+    uint64_t *keys;
+    size_t nslots;
+    size_t i;
+    size_t j;
+    bool first;
+
+    pthread_mutex_lock(&sp->lock);
+    if (2 * (sp->count + 1) > sp->nslots) {
+        nslots = (sp->nslots != 0) ? 2 * sp->nslots : 1024;
+        keys = calloc(2 * nslots, sizeof (keys[0]));
+        if (keys == NULL) {
+            pthread_mutex_unlock(&sp->lock);
+            return (true);
+        }
+        for (i = 0; i < sp->nslots; ++i) {
+            if (sp->keys[2 * i] == 0 && sp->keys[2 * i + 1] == 0) {
+                continue;
+            }
+            j = tb_fnv1a_u64(tb_fnv1a_u64(TB_FNV_BASIS, sp->keys[2 * i]),
+                    sp->keys[2 * i + 1]) & (nslots - 1);
+            while (keys[2 * j] != 0 || keys[2 * j + 1] != 0) {
+                j = (j + 1) & (nslots - 1);
+            }
+            keys[2 * j] = sp->keys[2 * i];
+            keys[2 * j + 1] = sp->keys[2 * i + 1];
+        }
+        free(sp->keys);
+        sp->keys = keys;
+        sp->nslots = nslots;
+    }
+    i = tb_fnv1a_u64(tb_fnv1a_u64(TB_FNV_BASIS, dev), ino) & (sp->nslots - 1);
+    first = true;
+    while (sp->keys[2 * i] != 0 || sp->keys[2 * i + 1] != 0) {
+        if (sp->keys[2 * i] == dev && sp->keys[2 * i + 1] == ino) {
+            first = false;
+            break;
+        }
+        i = (i + 1) & (sp->nslots - 1);
+    }
+    if (first) {
+        sp->keys[2 * i] = dev;
+        sp->keys[2 * i + 1] = ino;
+        ++sp->count;
+    }
+    pthread_mutex_unlock(&sp->lock);
+    return (first);
+}
+
+static void
+walk_report(struct tbwalk *w, tbfile_t *fp)
+{
+    pthread_mutex_lock(&w->report_lock);
+    if (fp->err != 0) {
+        __atomic_store_n(&w->failed, true, __ATOMIC_RELAXED);
+    }
+    (*w->report)(fp, w->report_arg);
+    pthread_mutex_unlock(&w->report_lock);
+}
+
+/*
+ * Report a directory that could not be listed.
+ */
+static void
+walk_error(struct tbwalk *w, const char *path, int err, const char *op)
+{
+    tbfile_t f = *w->proto;
+
+    f.fname = path;
+    f.err = err;
+    f.errop = op;
+    walk_report(w, &f);
+}
+
+/*
+ * Set wp->path to dir/name.
+ */
+static bool
+walk_path(struct tbwalker *wp, const char *dir, const char *name)
+{
+    size_t dlen = strlen(dir);
+    size_t nlen = strlen(name);
+    size_t sz;
+    char *path;
+
+    sz = dlen + 1 + nlen + 1;
+    if (sz > wp->pathsz) {
+        path = realloc(wp->path, sz + 256);
+        if (path == NULL) {
+            return (false);
+        }
+        wp->path = path;
+        wp->pathsz = sz + 256;
+    }
+    memcpy(wp->path, dir, dlen);
+    if (dlen == 0 || dir[dlen - 1] != '/') {
+        wp->path[dlen++] = '/';
+    }
+    memcpy(wp->path + dlen, name, nlen + 1);
+    return (true);
+}
+
+/*
+ * One entry of a directory.
+ */
+static void
+walk_entry(struct tbwalker *wp, const struct tbwalk_dir *dp, int dfd,
+    const char *name, unsigned char type)
+{
+    struct tbwalk *w = wp->walk;
+    struct tbwalk_dir *sub;
+    struct stat st;
+    tbfile_t f;
+
+    if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+        return;
+    }
+    if (type == DT_UNKNOWN) {
+        if (fstatat(dfd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+            return;
+        }
+        type = S_ISREG(st.st_mode) ? DT_REG : S_ISDIR(st.st_mode) ? DT_DIR
+            : S_ISLNK(st.st_mode) ? DT_LNK : DT_UNKNOWN;
+    }
+    if (type == DT_LNK) {
+        if ((w->flags & TB_WALK_FOLLOW) == 0 || fstatat(dfd, name, &st, 0) != 0) {
+            return;
+        }
+        type = S_ISREG(st.st_mode) ? DT_REG : S_ISDIR(st.st_mode) ? DT_DIR : DT_UNKNOWN;
+    }
+    if (type != DT_REG && type != DT_DIR) {
+        return;
+    }
+    if (!walk_path(wp, dp->path, name)) {
+        __atomic_store_n(&w->failed, true, __ATOMIC_RELAXED);
+        return;
+    }
+
+    if (type == DT_DIR) {
+        sub = dir_new(wp->path, strlen(wp->path), dp->dev);
+        if (sub == NULL) {
+            __atomic_store_n(&w->failed, true, __ATOMIC_RELAXED);
+            return;
+        }
+        walk_push(wp, sub);
+        return;
+    }
+
+    f = *w->proto;
+    f.fname = wp->path;
+    f.err = 0;
+    f.errop = NULL;
+    tbfile_at(dfd, name, &f, 1);
+    walk_report(w, &f);
+}
+
+/*
+ * List a directory.
+ */
+static void
+walk_list(struct tbwalker *wp, const struct tbwalk_dir *dp)
+{
+    struct tbwalk *w = wp->walk;
+    struct stat st;
+    int flags;
+    int dfd;
+
+    flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+    if ((w->flags & TB_WALK_FOLLOW) == 0 && !dp->top) {
+        flags |= O_NOFOLLOW;
+    }
+    dfd = open(dp->path, flags);
+    if (dfd < 0) {
+        walk_error(w, dp->path, errno, "opendir");
+        return;
+    }
+    if ((w->flags & (TB_WALK_FOLLOW | TB_WALK_XDEV)) != 0 && fstat(dfd, &st) == 0) {
+        if (((w->flags & TB_WALK_XDEV) != 0 && st.st_dev != dp->dev)
+            || ((w->flags & TB_WALK_FOLLOW) != 0 && !seen_first(&w->seen, &st))) {
+            close(dfd);
+            return;
+        }
+    }
+
+#ifdef __linux__
+    {
+        struct tbdirent64 {
+            uint64_t d_ino;
+            int64_t  d_off;
+            unsigned short d_reclen;
+            unsigned char  d_type;
+            char     d_name[];
+        } *de;
+        long nread;
+        long pos;
+
+        for (;;) {
+            nread = syscall(SYS_getdents64, dfd, wp->buf, TB_WALK_DIRBUF);
+            if (nread < 0) {
+                walk_error(w, dp->path, errno, "readdir");
+                break;
+            }
+            if (nread == 0) {
+                break;
+            }
+            for (pos = 0; pos < nread; pos += de->d_reclen) {
+                de = (struct tbdirent64 *)(wp->buf + pos);
+                walk_entry(wp, dp, dfd, de->d_name, de->d_type);
+            }
+        }
+        close(dfd);
+    }
+#else
+    {
+        struct dirent *de;
+        DIR *dir;
+
+        dir = fdopendir(dfd);
+        if (dir == NULL) {
+            walk_error(w, dp->path, errno, "opendir");
+            close(dfd);
+            return;
+        }
+        while ((de = readdir(dir)) != NULL) {
+            walk_entry(wp, dp, dirfd(dir), de->d_name, de->d_type);
+        }
+        closedir(dir);
+    }
+#endif
+}
+
+static void *
+walk_thread(void *arg)
+{
+    struct tbwalker *wp = (struct tbwalker *)arg;
+    struct tbwalk_dir *dp;
+
+    for (;;) {
+        dp = walk_take(wp);
+        if (dp == NULL) {
+            if (!walk_wait(wp->walk)) {
+                break;
+            }
+            continue;
+        }
+        walk_list(wp, dp);
+        free(dp);
+        walk_done(wp->walk);
+    }
+    return (NULL);
+}
+
+/*
+ * Measure every regular file in the trees under paths.
+ * See textbounds.h.
+ */
+int
+text_bounds_walk(size_t pathc, char **paths, const tbfile_t *proto,
+    uint_t njobs, uint_t flags, tbfile_report_fn report, void *report_arg)
+{
+    struct tbwalk w;
+    struct tbwalker *walkers;
+    pthread_t *threads;
+    struct tbwalk_dir *dp;
+    struct stat st;
+    tbfile_t f;
+    uint_t nstarted;
+    uint_t i;
+    size_t pnr;
+
+    memset(&w, 0, sizeof (w));
+    w.proto = proto;
+    w.flags = flags;
+    w.nthreads = (njobs != 0) ? njobs : 1;
+    w.report = report;
+    w.report_arg = report_arg;
+    pthread_mutex_init(&w.lock, NULL);
+    pthread_cond_init(&w.cond, NULL);
+    pthread_mutex_init(&w.report_lock, NULL);
+    pthread_mutex_init(&w.seen.lock, NULL);
+
+    w.queues = calloc(w.nthreads, sizeof (w.queues[0]));
+    walkers = calloc(w.nthreads, sizeof (walkers[0]));
+    threads = calloc(w.nthreads, sizeof (threads[0]));
+    if (w.queues == NULL || walkers == NULL || threads == NULL) {
+        free(w.queues);
+        free(walkers);
+        free(threads);
+        return (2);
+    }
+    for (i = 0; i < w.nthreads; ++i) {
+        pthread_mutex_init(&w.queues[i].lock, NULL);
+        walkers[i].walk = &w;
+        walkers[i].id = i;
+    }
+
+    // Files are measured here and now; trees are spread over the queues.
+    for (pnr = 0; pnr < pathc; ++pnr) {
+        if (stat(paths[pnr], &st) != 0 || !S_ISDIR(st.st_mode)) {
+            f = *proto;
+            f.fname = paths[pnr];
+            f.err = 0;
+            f.errop = NULL;
+            text_bounds_file(&f, 1);
+            walk_report(&w, &f);
+            continue;
+        }
+        dp = dir_new(paths[pnr], strlen(paths[pnr]), st.st_dev);
+        if (dp == NULL || !queue_push(&w.queues[pnr % w.nthreads], dp)) {
+            free(dp);
+            w.failed = true;
+            continue;
+        }
+        dp->top = true;
+        ++w.pending;
+    }
+
+    nstarted = 0;
+    for (i = 0; i < w.nthreads; ++i) {
+        walkers[i].buf = malloc(TB_WALK_DIRBUF);
+        if (walkers[i].buf == NULL
+            || pthread_create(&threads[i], NULL, walk_thread, &walkers[i]) != 0) {
+            break;
+        }
+        ++nstarted;
+    }
+    if (nstarted == 0 && walkers[0].buf != NULL) {
+        // Not even one thread; walk right here
+        walk_thread(&walkers[0]);
+    }
+    // Any thread can take from any queue, so however many started will do.
+    for (i = 0; i < nstarted; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (i = 0; i < w.nthreads; ++i) {
+        // Left over only if there was not memory enough to walk at all
+        while ((dp = queue_take(&w.queues[i], true)) != NULL) {
+            free(dp);
+            w.failed = true;
+        }
+        pthread_mutex_destroy(&w.queues[i].lock);
+        free(w.queues[i].dirs);
+        free(walkers[i].path);
+        free(walkers[i].buf);
+    }
+    pthread_mutex_destroy(&w.seen.lock);
+    pthread_mutex_destroy(&w.report_lock);
+    pthread_cond_destroy(&w.cond);
+    pthread_mutex_destroy(&w.lock);
+    free(w.seen.keys);
+    free(w.queues);
+    free(walkers);
+    free(threads);
+    return (w.failed ? 2 : 0);
+}
@@ -0,0 +1,106 @@
+#!/usr/bin/env python3
+#
+# Filename: textbounds-width-gen.py
+# Brief: Generate textbounds-width.c, the table of terminal display
+#        widths of Unicode characters, from Python's unicodedata.
+#
+# Usage: python3 textbounds-width-gen.py > textbounds-width.c
+#
+# Copyright (C) 2019 Guy Shaw
+# Written by Guy Shaw <gshaw@acm.org>
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as
+# published by the Free Software Foundation; either version 3 of the
+# License, or (at your option) any later version.
+#
+
+import sys
+import unicodedata
+
+# Width classes; these must agree with TBW_* in textbounds_int.h
+TBW_INVISIBLE = 0   # zero width, not ink: format controls
+TBW_MARK      = 1   # zero width, ink: combining marks
+TBW_NARROW    = 2   # one cell
+TBW_WIDE      = 3   # two cells
+
+BLOCK = 256
+NCODES = 0x110000
+
+
+def width_class(cp):
+    ch = chr(cp)
+    cat = unicodedata.category(ch)
+    if cat in ('Mn', 'Me'):
+        return TBW_MARK
+    # Hangul Jamo medial vowels and final consonants join the syllable
+    if 0x1160 <= cp <= 0x11FF or 0xD7B0 <= cp <= 0xD7FF:
+        return TBW_MARK
+    # Emoji skin tone modifiers combine with the emoji before them
+    if 0x1F3FB <= cp <= 0x1F3FF:
+        return TBW_MARK
+    # Soft hyphen is shown by terminals, unlike other format controls
+    if cat == 'Cf' and cp != 0x00AD:
+        return TBW_INVISIBLE
+    if unicodedata.east_asian_width(ch) in ('W', 'F'):
+        return TBW_WIDE
+    # Unassigned code points in the CJK ideograph planes are wide, too
+    if 0x20000 <= cp <= 0x2FFFD or 0x30000 <= cp <= 0x3FFFD:
+        return TBW_WIDE
+    return TBW_NARROW
+
+
+def pack(classes):
+    out = bytearray()
+    for i in range(0, len(classes), 4):
+        b = 0
+        for j in range(4):
+            b |= classes[i + j] << (2 * j)
+        out.append(b)
+    return bytes(out)
+
+
+def main():
+    blocks = []
+    index = {}
+    stage1 = []
+    for base in range(0, NCODES, BLOCK):
+        packed = pack([width_class(cp) for cp in range(base, base + BLOCK)])
+        if packed not in index:
+            index[packed] = len(blocks)
+            blocks.append(packed)
+        stage1.append(index[packed])
+    if len(blocks) > 256:
+        sys.exit('too many distinct blocks for a byte index: %d' % len(blocks))
+
+    w = sys.stdout.write
+    w('/*\n')
+    w(' * Filename: textbounds-width.c\n')
+    w(' * Library: libtextbounds\n')
+    w(' * Brief: Terminal display width of every Unicode code point.\n')
+    w(' *\n')
+    w(' * Generated by textbounds-width-gen.py, from Unicode %s.\n'
+      % unicodedata.unidata_version)
+    w(' * Do not edit; run "make width-table" instead.\n')
+    w(' *\n')
+    w(' * Two stages: tbw_stage1[cp >> 8] selects a block of 256 code points,\n')
+    w(' * in tbw_stage2, where each code point has a 2-bit width class.\n')
+    w(' * %d distinct blocks, %d bytes in all.\n'
+      % (len(blocks), len(stage1) + BLOCK // 4 * len(blocks)))
+    w(' */\n\n')
+    w('#include <textbounds.h>\n')
+    w('#include <textbounds_int.h>\n\n')
+    w('const unsigned char tbw_stage1[%d] = {\n' % len(stage1))
+    for i in range(0, len(stage1), 16):
+        w('    ' + ', '.join('%3d' % x for x in stage1[i:i + 16]) + ',\n')
+    w('};\n\n')
+    w('const unsigned char tbw_stage2[%d][%d] = {\n' % (len(blocks), BLOCK // 4))
+    for blk in blocks:
+        w('    {\n')
+        for i in range(0, len(blk), 16):
+            w('        ' + ', '.join('0x%02x' % x for x in blk[i:i + 16]) + ',\n')
+        w('    },\n')
+    w('};\n')
+
+
+main()
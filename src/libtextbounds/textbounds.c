@@ -21,17 +21,235 @@
  */
 
 #include <textbounds.h>
+#include <textbounds_int.h>
 #include <stdio.h>
     // Import constant EOF
+#include <stdbool.h>
+    // Import type bool
+#include <string.h>
+    // Import memchr()
 #include <unistd.h>
     // Import type size_t
 
+/*
+ * With limits, text is fed to the engine this much at a time,
+ * so that measurement stops soon after the text is known not to fit.
+ */
+#define TB_FIT_STEP  (4 * 1024)
+
+void
+text_bounds_start(tbscan_t *sp, const textbox_t *ctxp)
+{
+    sp->lnr = ctxp->lines;
+    sp->col = 0;
+    sp->inkcol = 0;
+    sp->maxcol = ctxp->columns;
+    sp->maxlnr = ctxp->widest_line;
+    sp->maxoff = ctxp->widest_offset;
+    sp->off = 0;
+    sp->linestart = 0;
+    sp->tws = ctxp->tws;
+    sp->utf8 = ctxp->utf8;
+    sp->tabs = ctxp->tabs;
+    sp->eol = ctxp->eol;
+    sp->cr = false;
+    sp->u8need = 0;
+    sp->u8cp = 0;
+    sp->u8min = 0;
+    sp->measure = tb_measure(ctxp);
+    sp->hist = ctxp->hist;
+    sp->max_lines = ctxp->max_lines;
+    sp->max_columns = ctxp->max_columns;
+    sp->overflow = false;
+}
+
+/*
+ * If the first LF comes right after a CR, lines end with CRLF.
+ * If there is no LF at all, but there is a CR, lines end with CR.
+ * Otherwise, lines end with LF.
+ */
+void
+tbscan_eol_detect(tbscan_t *sp, const char *buf, size_t sz)
+{
+    const char *lf;
+
+    if (sz > TB_EOL_PEEK) {
+        sz = TB_EOL_PEEK;
+    }
+    lf = memchr(buf, '\n', sz);
+    if (lf != NULL) {
+        sp->eol = (lf > buf && lf[-1] == '\r') ? TB_EOL_CRLF : TB_EOL_LF;
+    }
+    else {
+        sp->eol = (memchr(buf, '\r', sz) != NULL) ? TB_EOL_CR : TB_EOL_LF;
+    }
+}
+
+/*
+ * Run only as much of an engine as the results call for.
+ * Lines alone need only a count of newlines.
+ */
+static void
+tbscan_run(tbscan_t *sp, const char *buf, size_t sz)
+{
+    switch (sp->measure) {
+    case TB_MEASURE_NONE:
+        break;
+    case TB_MEASURE_LINES:
+        (*tbcount_span)(sp, (const unsigned char *)buf, sz, sp->tws);
+        break;
+    default:
+        (*tbscan_engine(sp->utf8))(sp, (const unsigned char *)buf, sz, sp->tws);
+        break;
+    }
+}
+
+/*
+ * Is the text so far already too tall or too wide?
+ * Lines and widths only ever grow, so once it is, it stays that way.
+ */
+static bool
+tbscan_overflow(const tbscan_t *sp)
+{
+    size_t lnr;
+    size_t width;
+
+    if (sp->max_lines != 0 && (sp->measure & TB_MEASURE_LINES) != 0) {
+        lnr = sp->lnr + tbscan_in_line(sp);
+        if (lnr > sp->max_lines) {
+            return (true);
+        }
+    }
+    if (sp->max_columns != 0 && (sp->measure & TB_MEASURE_COLUMNS) != 0) {
+        width = sp->tws ? sp->col : sp->inkcol;
+        if (width > sp->max_columns || sp->maxcol > sp->max_columns) {
+            return (true);
+        }
+    }
+    return (false);
+}
+
+bool
+text_bounds_feed(tbscan_t *sp, const char *buf, size_t sz)
+{
+    size_t len;
+
+    if (sp->eol == TB_EOL_AUTO && sz > 0) {
+        tbscan_eol_detect(sp, buf, sz);
+    }
+    if (sp->max_lines == 0 && sp->max_columns == 0) {
+        tbscan_run(sp, buf, sz);
+        return (true);
+    }
+
+    while (sz > 0 && !sp->overflow) {
+        len = sz < TB_FIT_STEP ? sz : TB_FIT_STEP;
+        tbscan_run(sp, buf, len);
+        sp->overflow = tbscan_overflow(sp);
+        buf += len;
+        sz -= len;
+    }
+    return (!sp->overflow);
+}
+
+/*
+ * End of text.  A final line that is not terminated by a newline
+ * still counts as a line.
+ */
 void
-text_bounds(textbox_t *ctxp) {
-    size_t lnr = 0;
+text_bounds_finish(const tbscan_t *sp, textbox_t *ctxp)
+{
+    tbscan_t end;
+    size_t lnr;
+    size_t maxcol;
+    size_t maxlnr;
+    off_t maxoff;
+    size_t width;
+
+    // The text ends here, so does any sequence that is still incomplete,
+    // and a CR at the very end is not followed by LF.
+    if (sp->u8need != 0 || sp->cr) {
+        end = *sp;
+        tbscan_u8flush(&end);
+        tbscan_cr_resolve(&end, '\0');
+        sp = &end;
+    }
+
+    lnr = sp->lnr;
+    if (tbscan_in_line(sp)) {
+        ++lnr;
+    }
+    maxcol = sp->maxcol;
+    maxlnr = sp->maxlnr;
+    maxoff = sp->maxoff;
+    width = sp->tws ? sp->col : sp->inkcol;
+    if (width > maxcol) {
+        maxcol = width;
+        maxlnr = lnr;
+        maxoff = sp->linestart;
+    }
+
+    if ((sp->measure & TB_MEASURE_LINES) != 0) {
+        ctxp->lines = lnr;
+    }
+    if ((sp->measure & TB_MEASURE_COLUMNS) != 0) {
+        ctxp->columns = maxcol;
+        ctxp->widest_line = maxlnr;
+        ctxp->widest_offset = maxoff;
+    }
+    if (sp->hist != NULL) {
+        if (tbscan_in_line(sp)) {
+            tbhist_add(sp->hist, width);
+        }
+        text_bounds_hist_dist(sp->hist, &ctxp->dist);
+    }
+    ctxp->overflow = sp->overflow || tbscan_overflow(sp);
+}
+
+static void
+text_bounds_getbuf(textbox_t *ctxp)
+{
+    tbscan_t scan;
+    const char *buf;
+    size_t sz;
+
+    text_bounds_start(&scan, ctxp);
+    while ((sz = (*ctxp->getbuf)(ctxp->getbuf_arg, &buf)) != 0) {
+        if (!text_bounds_feed(&scan, buf, sz)) {
+            break;
+        }
+    }
+    text_bounds_finish(&scan, ctxp);
+}
+
+/*
+ * Measure the text in a single buffer in memory.
+ * The end of the buffer is the end of the text.
+ */
+void
+text_bounds_buf(const char *buf, size_t sz, textbox_t *ctxp)
+{
+    tbscan_t scan;
+
+    text_bounds_start(&scan, ctxp);
+    text_bounds_feed(&scan, buf, sz);
+    text_bounds_finish(&scan, ctxp);
+}
+
+/*
+ * Compatibility path: one call to .getchr() per character.
+ */
+static void
+text_bounds_getchr(textbox_t *ctxp) {
+    size_t lnr = ctxp->lines;
     size_t col = 0;       /* last column - even if just whitespace */
     size_t inkcol = 0;    /* last non-whitespace column */
-    size_t maxcol = 0;
+    size_t maxcol = ctxp->columns;
+    size_t maxlnr = ctxp->widest_line;
+    off_t maxoff = ctxp->widest_offset;
+    off_t off = 0;
+    off_t linestart = 0;
+    size_t width;
     int c;
 
     do {
@@ -42,20 +260,18 @@ text_bounds(textbox_t *ctxp) {
                 if (c == '\n' || col > 0) {
                     ++lnr;
                 }
-                if (ctxp->tws) {
-                    if (col > maxcol) {
-                        maxcol = col;
-                    }
-                }
-                else {
-                    if (inkcol > maxcol) {
-                        maxcol = inkcol;
-                    }
+                width = ctxp->tws ? col : inkcol;
+                if (width > maxcol) {
+                    maxcol = width;
+                    maxlnr = lnr;
+                    maxoff = linestart;
                 }
                 col = inkcol = 0;
+                linestart = off + 1;
                 break;
             case '\t':
-                col = (col + 8) & ~7;
+                col = tbtabs_next(ctxp->tabs, tbtabs_kind(ctxp->tabs),
+                    tbtabs_width(ctxp->tabs), col);
                 break;
             case ' ':
                 ++col;
@@ -64,8 +280,54 @@ text_bounds(textbox_t *ctxp) {
                 ++col;
                 inkcol = col;
         }
+        ++off;
     } while (c != EOF);
 
     ctxp->lines   = lnr;
     ctxp->columns = maxcol;
+    ctxp->widest_line = maxlnr;
+    ctxp->widest_offset = maxoff;
+    ctxp->overflow = (ctxp->max_lines != 0 && lnr > ctxp->max_lines)
+        || (ctxp->max_columns != 0 && maxcol > ctxp->max_columns);
+}
+
+/*
+ * .getchr, for anything that the compatibility path does not do:
+ * UTF-8, other line endings, histograms, limits, and measuring
+ * less than everything.  Characters are collected into a buffer,
+ * and fed a buffer at a time; with limits, no more are asked for
+ * once the text is known not to fit.
+ */
+static void
+text_bounds_getchr_buf(textbox_t *ctxp)
+{
+    char buf[4096];
+    tbscan_t scan;
+    size_t sz;
+    int c;
+
+    text_bounds_start(&scan, ctxp);
+    do {
+        sz = 0;
+        while (sz < sizeof (buf) && (c = (*ctxp->getchr)(ctxp->getchr_arg)) != EOF) {
+            buf[sz++] = c;
+        }
+    } while (sz != 0 && text_bounds_feed(&scan, buf, sz) && sz == sizeof (buf));
+    text_bounds_finish(&scan, ctxp);
+}
+
+void
+text_bounds(textbox_t *ctxp)
+{
+    if (ctxp->getbuf != NULL) {
+        text_bounds_getbuf(ctxp);
+    }
+    else if (ctxp->utf8 || ctxp->eol != TB_EOL_LF || ctxp->hist != NULL
+        || ctxp->max_lines != 0 || ctxp->max_columns != 0
+        || tb_measure(ctxp) != TB_MEASURE_ALL) {
+        text_bounds_getchr_buf(ctxp);
+    }
+    else {
+        text_bounds_getchr(ctxp);
+    }
 }
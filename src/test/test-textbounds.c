@@ -5,14 +5,23 @@
 #include <stdio.h>
     // Import constant EOF
     // Import printf()
+#include <stdint.h>
+    // Import type intmax_t, uintmax_t
 #include <stdlib.h>
     // Import exit()
 #include <string.h>
-    // Import strlen()
+    // Import strlen(), memcpy(), memset(), strerror(), strstr()
+#include <errno.h>
+    // Import errno, ENOTSUP
+#include <fcntl.h>
+    // Import open()
+#include <sys/stat.h>
+    // Import stat(), mkdir()
+#include <sys/time.h>
+    // Import gettimeofday(), utimes()
 #include <unistd.h>
     // Import type size_t
-
-extern int text_bounds(textbox_t *);
+    // Import rmdir(), truncate(), unlink(), pipe(), write(), lseek(), symlink(), pread()
 
 const char *program_path;
 const char *program_name;
@@ -27,6 +36,17 @@ typedef struct text_iterator text_iterator_t;
 
 static text_iterator_t test;
 
+static const char *samples[] = {
+    "This is a test\none\ntwo\nthree\n",
+    "",
+    "\n\n\n",
+    "no newline at end",
+    "trailing white space   \t\nx\n",
+    "\ttab\t\tstops\n  \t \n1234567\tx\n12345678\ty",
+    "   \n\t\n",
+    NULL
+};
+
 static int
 textbox_getchr(text_iterator_t *it)
 {
@@ -42,10 +62,1818 @@ textbox_getchr(text_iterator_t *it)
     return (chr);
 }
 
+/*
+ * Deliver text in small spans, so that span boundaries
+ * fall in the middle of lines.
+ */
+static size_t
+textbox_getbuf(text_iterator_t *it, const char **bufp)
+{
+    size_t sz;
+
+    sz = it->siz - it->idx;
+    if (sz > 3) {
+        sz = 3;
+    }
+    *bufp = it->text + it->idx;
+    it->idx += sz;
+    return (sz);
+}
+
+/*
+ * Measure the same text using .getchr, .getbuf and text_bounds_buf(),
+ * with and without trailing white space.  They must all agree.
+ */
+static int
+check_sample(const char *text)
+{
+    textbox_t ref;
+    textbox_t box;
+    text_iterator_t it;
+    int tws;
+    int err;
+
+    err = 0;
+    for (tws = 0; tws <= 1; ++tws) {
+        ref = (textbox_t) { 0 };
+        ref.tws = tws;
+        it.text = (char *)text;
+        it.siz = strlen(text);
+        it.idx = 0;
+        ref.getchr = (int (*)(void *))textbox_getchr;
+        ref.getchr_arg = (void *)&it;
+        text_bounds(&ref);
+
+        box = (textbox_t) { 0 };
+        box.tws = tws;
+        it.idx = 0;
+        box.getbuf = (size_t (*)(void *, const char **))textbox_getbuf;
+        box.getbuf_arg = (void *)&it;
+        text_bounds(&box);
+        if (box.lines != ref.lines || box.columns != ref.columns) {
+            printf("FAIL getbuf tws=%d: %zux%zu, expected %zux%zu\n",
+                tws, box.columns, box.lines, ref.columns, ref.lines);
+            ++err;
+        }
+
+        box = (textbox_t) { 0 };
+        box.tws = tws;
+        text_bounds_buf(text, strlen(text), &box);
+        if (box.lines != ref.lines || box.columns != ref.columns) {
+            printf("FAIL buf tws=%d: %zux%zu, expected %zux%zu\n",
+                tws, box.columns, box.lines, ref.columns, ref.lines);
+            ++err;
+        }
+    }
+    return (err);
+}
+
+/*
+ * Do a and b agree on where the widest line is?
+ */
+static bool
+same_widest(const textbox_t *a, const textbox_t *b)
+{
+    return (a->widest_line == b->widest_line && a->widest_offset == b->widest_offset);
+}
+
+/*
+ * Feed the same text through a stream, split at random places,
+ * and peek at the results along the way.
+ * The final results must match ref.
+ */
+static int
+check_stream(const char *text, size_t sz, const textbox_t *ref)
+{
+    tbscan_t scan;
+    textbox_t box;
+    size_t pos;
+    size_t len;
+
+    box = (textbox_t) { 0 };
+    box.tws = ref->tws;
+    text_bounds_start(&scan, &box);
+    for (pos = 0; pos < sz; pos += len) {
+        len = rand() % 80;
+        if (len > sz - pos) {
+            len = sz - pos;
+        }
+        text_bounds_feed(&scan, text + pos, len);
+        text_bounds_finish(&scan, &box);
+    }
+    text_bounds_finish(&scan, &box);
+    if (box.lines != ref->lines || box.columns != ref->columns || !same_widest(&box, ref)) {
+        printf("FAIL stream tws=%d size=%zu: %zux%zu, expected %zux%zu\n",
+            ref->tws, sz, box.columns, box.lines, ref->columns, ref->lines);
+        return (1);
+    }
+    return (0);
+}
+
+/*
+ * Every scan engine must give exactly the same results as .getchr,
+ * on random text that is dense in newlines, tabs and spaces.
+ */
+static int
+check_engines(void)
+{
+    static const char alphabet[] = "\n\t  abc\x7f";
+    static char text[4096 + 1];
+    textbox_t ref;
+    textbox_t box;
+    text_iterator_t it;
+    const char *engine;
+    size_t eidx;
+    size_t sz;
+    size_t i;
+    int round;
+    int tws;
+    int err;
+
+    err = 0;
+    srand(1);
+    for (round = 0; round < 200; ++round) {
+        sz = rand() % (sizeof (text) - 1);
+        for (i = 0; i < sz; ++i) {
+            // Sometimes long lines, sometimes many short ones
+            text[i] = alphabet[rand() % (round & 1 ? 4 : sizeof (alphabet) - 1)];
+            if (round % 4 == 0 && text[i] == '\n') {
+                text[i] = 'z';
+            }
+        }
+        text[sz] = '\0';
+
+        for (tws = 0; tws <= 1; ++tws) {
+            ref = (textbox_t) { 0 };
+            ref.tws = tws;
+            it.text = text;
+            it.siz = sz;
+            it.idx = 0;
+            ref.getchr = (int (*)(void *))textbox_getchr;
+            ref.getchr_arg = (void *)&it;
+            text_bounds(&ref);
+
+            if (check_stream(text, sz, &ref) != 0) {
+                ++err;
+            }
+
+            for (eidx = 0; (engine = text_bounds_engine_list(eidx)) != NULL; ++eidx) {
+                text_bounds_set_engine(engine);
+                box = (textbox_t) { 0 };
+                box.tws = tws;
+                text_bounds_buf(text, sz, &box);
+                if (box.lines != ref.lines || box.columns != ref.columns
+                    || !same_widest(&box, &ref)) {
+                    printf("FAIL engine=%s tws=%d size=%zu: %zux%zu, expected %zux%zu\n",
+                        engine, tws, sz,
+                        box.columns, box.lines, ref.columns, ref.lines);
+                    ++err;
+                }
+
+                // Lines only: columns are left alone
+                box = (textbox_t) { 0 };
+                box.tws = tws;
+                box.measure = TB_MEASURE_LINES;
+                box.columns = 12345;
+                text_bounds_buf(text, sz, &box);
+                if (box.lines != ref.lines || box.columns != 12345) {
+                    printf("FAIL count engine=%s size=%zu: %zux%zu, expected 12345x%zu\n",
+                        engine, sz, box.columns, box.lines, ref.lines);
+                    ++err;
+                }
+            }
+        }
+    }
+    return (err);
+}
+
+/*
+ * Measuring on several threads must give exactly the same results
+ * as measuring serially, wherever the chunk boundaries happen to fall.
+ */
+static int
+check_parallel(void)
+{
+    static const char alphabet[] = "\n\t  abc";
+    static char text[1024 * 1024 + 100];
+    textbox_t ref;
+    textbox_t box;
+    uint_t nthreads;
+    size_t sz;
+    size_t i;
+    int round;
+    int tws;
+    int err;
+
+    err = 0;
+    for (round = 0; round < 12; ++round) {
+        sz = sizeof (text) - rand() % 100;
+        for (i = 0; i < sz; ++i) {
+            text[i] = alphabet[rand() % (sizeof (alphabet) - 1)];
+            // Sometimes, no newlines at all; sometimes, few
+            if (text[i] == '\n' && (round % 3 == 0 || (round % 3 == 1 && rand() % 1000 != 0))) {
+                text[i] = 'z';
+            }
+        }
+
+        for (tws = 0; tws <= 1; ++tws) {
+            ref = (textbox_t) { 0 };
+            ref.tws = tws;
+            text_bounds_buf(text, sz, &ref);
+            for (nthreads = 2; nthreads <= 16; nthreads += 7) {
+                box = (textbox_t) { 0 };
+                box.tws = tws;
+                text_bounds_buf_parallel(text, sz, &box, nthreads);
+                if (box.lines != ref.lines || box.columns != ref.columns
+                    || !same_widest(&box, &ref)) {
+                    printf("FAIL parallel threads=%u tws=%d size=%zu: %zux%zu, expected %zux%zu\n",
+                        nthreads, tws, sz,
+                        box.columns, box.lines, ref.columns, ref.lines);
+                    ++err;
+                }
+
+                box = (textbox_t) { 0 };
+                box.measure = TB_MEASURE_LINES;
+                text_bounds_buf_parallel(text, sz, &box, nthreads);
+                if (box.lines != ref.lines || box.columns != 0) {
+                    printf("FAIL parallel count threads=%u size=%zu: %zux%zu, expected 0x%zu\n",
+                        nthreads, sz, box.columns, box.lines, ref.lines);
+                    ++err;
+                }
+            }
+        }
+    }
+    return (err);
+}
+
+/*
+ * UTF-8, on several threads: a zero-width mark right after a tab,
+ * or right at the start of a chunk, is ink at relative column 0.
+ * Lines are long, and marks dense, so that chunk boundaries
+ * often fall just before a mark.  Only a few lines cross a chunk
+ * boundary, so the width of every line is compared, not just the widest.
+ */
+static int
+check_parallel_marks_one(const char *text, size_t sz, tbtabs_t *tabs, const char *what)
+{
+    textbox_t ref;
+    textbox_t box;
+    uint_t nthreads;
+    int err;
+
+    ref = (textbox_t) { 0 };
+    ref.utf8 = true;
+    ref.tabs = tabs;
+    ref.hist = text_bounds_hist_new();
+    text_bounds_buf(text, sz, &ref);
+    err = 0;
+    for (nthreads = 2; nthreads <= 7; ++nthreads) {
+        box = (textbox_t) { 0 };
+        box.utf8 = true;
+        box.tabs = tabs;
+        box.hist = text_bounds_hist_new();
+        text_bounds_buf_parallel(text, sz, &box, nthreads);
+        if (box.lines != ref.lines || box.columns != ref.columns
+            || !same_widest(&box, &ref) || box.dist.mean != ref.dist.mean) {
+            printf("FAIL parallel marks %s threads=%u size=%zu: %zux%zu mean=%g,"
+                " expected %zux%zu mean=%g\n",
+                what, nthreads, sz, box.columns, box.lines, box.dist.mean,
+                ref.columns, ref.lines, ref.dist.mean);
+            ++err;
+        }
+        text_bounds_hist_free(box.hist);
+    }
+    text_bounds_hist_free(ref.hist);
+    return (err);
+}
+
+static int
+check_parallel_marks(void)
+{
+    static const char *const pieces[] = { "\t\xcc\x81", "\t\xcc\x81", "a", "\xe4\xb8\xad", " ", "\n" };
+    static char text[512 * 1024 + 16];
+    tbtabs_t *tabs;
+    size_t sz;
+    size_t len;
+    size_t k;
+    int round;
+    int err;
+
+    tabs = text_bounds_tabs("4");
+    err = 0;
+    for (round = 0; round < 8; ++round) {
+        sz = 0;
+        while (sz < sizeof (text) - 16 - round) {
+            k = rand() % (sizeof (pieces) / sizeof (pieces[0]));
+            // Few newlines: most chunk boundaries fall inside a line
+            if (pieces[k][0] == '\n' && rand() % 64 != 0) {
+                continue;
+            }
+            len = strlen(pieces[k]);
+            memcpy(text + sz, pieces[k], len);
+            sz += len;
+        }
+        err += check_parallel_marks_one(text, sz, NULL, "random");
+        err += check_parallel_marks_one(text, sz, tabs, "random tabs=4");
+    }
+
+    // Every line ends with a tab, then a mark; the mark sets its width.
+    for (round = 0; round < 6; ++round) {
+        sz = 0;
+        while (sz < sizeof (text) - 16 - round) {
+            memcpy(text + sz, "ab\t\xcc\x81\n", 6);
+            sz += 6;
+        }
+        err += check_parallel_marks_one(text, sz, NULL, "tab-mark");
+        err += check_parallel_marks_one(text + round, sz - round, tabs, "tab-mark tabs=4");
+    }
+    text_bounds_tabs_free(tabs);
+    return (err);
+}
+
+/*
+ * With limits, measurement must say whether the text fits,
+ * exactly at the limits, and must stop early when it does not.
+ */
+static int
+check_fits(void)
+{
+    static char text[20000 * 4 + 200];
+    textbox_t ref;
+    textbox_t box;
+    tbscan_t scan;
+    size_t sz;
+    size_t i;
+    int err;
+
+    // A wide line, near the top, then many short ones
+    sz = 0;
+    for (i = 0; i < 20000; ++i) {
+        if (i == 2) {
+            memset(text + sz, 'x', 150);
+            sz += 150;
+            text[sz++] = '\n';
+        }
+        memcpy(text + sz, "abc\n", 4);
+        sz += 4;
+    }
+    ref = (textbox_t) { 0 };
+    text_bounds_buf(text, sz, &ref);
+
+    err = 0;
+    box = (textbox_t) { 0 };
+    box.max_columns = ref.columns;
+    box.max_lines = ref.lines;
+    text_bounds_buf(text, sz, &box);
+    if (box.overflow || box.lines != ref.lines || box.columns != ref.columns) {
+        printf("FAIL fits %zux%zu: overflow=%d, %zux%zu\n",
+            ref.columns, ref.lines, box.overflow, box.columns, box.lines);
+        ++err;
+    }
+
+    box = (textbox_t) { 0 };
+    box.max_lines = ref.lines - 1;
+    text_bounds_buf(text, sz, &box);
+    if (!box.overflow) {
+        printf("FAIL fits x%zu: expected overflow\n", ref.lines - 1);
+        ++err;
+    }
+
+    box = (textbox_t) { 0 };
+    box.max_columns = 80;
+    text_bounds_start(&scan, &box);
+    if (text_bounds_feed(&scan, text, sz) || scan.lnr > 1000) {
+        printf("FAIL fits 80x: did not stop early, at line %zu\n", scan.lnr);
+        ++err;
+    }
+    text_bounds_finish(&scan, &box);
+    if (!box.overflow) {
+        printf("FAIL fits 80x: expected overflow\n");
+        ++err;
+    }
+
+    // The same, one character at a time, through .getchr
+    test.text = text;
+    test.siz = sz;
+    test.idx = 0;
+    box = (textbox_t) { 0 };
+    box.getchr = (int (*)(void *))textbox_getchr;
+    box.getchr_arg = (void *)&test;
+    box.max_columns = 80;
+    box.measure = TB_MEASURE_COLUMNS;
+    text_bounds(&box);
+    if (!box.overflow || test.idx > 10000) {
+        printf("FAIL fits 80x getchr: overflow=%d, read %zu of %zu\n",
+            box.overflow, test.idx, sz);
+        ++err;
+    }
+    return (err);
+}
+
+/*
+ * UTF-8 text is measured in display cells.  Results must not depend
+ * on where the text is split, nor on how many threads measure it.
+ */
+static int
+check_utf8(void)
+{
+    static const struct {
+        const char *text;
+        size_t columns;
+    } cases[] = {
+        { "abc",                        3 },
+        { "caf\xc3\xa9",                 4 },    // precomposed
+        { "cafe\xcc\x81",                4 },    // combining acute
+        { "\xe4\xb8\xad\xe6\x96\x87",       4 },    // two CJK ideographs
+        { "\xef\xbd\x88i",                3 },    // fullwidth h
+        { "\xf0\x9f\x98\x80!",            3 },    // emoji
+        { "a\xe2\x80\x8b",               1 },    // zero width space
+        { "\xff\x80z",                   3 },    // invalid bytes
+        { "\xe4\xb8",                    2 },    // truncated
+        { "\xe4\xb8z",                   3 },    // cut short
+        { "\xc0\xaf",                    2 },    // overlong
+        { "\xe0\x80\xaf",                3 },    // overlong, from a valid lead
+        { "\xf4\x90\x80\x80",            4 },    // out of range
+        { "\xe4\xb8\xad \t",              2 },    // trailing white space
+        { "\xed\xa0\x80",                 3 },    // surrogate
+        { "\xe2\x80\x8b\xcc\x81",         0 },    // only zero width, still a line
+        { NULL, 0 }
+    };
+    static char big[512 * 1024];
+    textbox_t ref;
+    textbox_t box;
+    tbscan_t scan;
+    size_t sz;
+    size_t i;
+    size_t k;
+    int err;
+
+    err = 0;
+    for (i = 0; cases[i].text != NULL; ++i) {
+        sz = strlen(cases[i].text);
+        box = (textbox_t) { 0 };
+        box.utf8 = true;
+        text_bounds_buf(cases[i].text, sz, &box);
+        if (box.columns != cases[i].columns || box.lines != 1) {
+            printf("FAIL utf8 case %zu: %zux%zu, expected %zux1\n",
+                i, box.columns, box.lines, cases[i].columns);
+            ++err;
+        }
+
+        // Split in two, everywhere
+        for (k = 0; k <= sz; ++k) {
+            box = (textbox_t) { 0 };
+            box.utf8 = true;
+            text_bounds_start(&scan, &box);
+            text_bounds_feed(&scan, cases[i].text, k);
+            text_bounds_feed(&scan, cases[i].text + k, sz - k);
+            text_bounds_finish(&scan, &box);
+            if (box.columns != cases[i].columns) {
+                printf("FAIL utf8 case %zu split at %zu: %zu columns, expected %zu\n",
+                    i, k, box.columns, cases[i].columns);
+                ++err;
+            }
+        }
+    }
+
+    // Random mixed text, serial and on threads
+    sz = 0;
+    while (sz + 8 < sizeof (big)) {
+        i = rand() % (sizeof (cases) / sizeof (cases[0]) - 1);
+        if (rand() % 4 == 0) {
+            big[sz++] = '\n';
+        }
+        memcpy(big + sz, cases[i].text, strlen(cases[i].text));
+        sz += strlen(cases[i].text);
+    }
+    ref = (textbox_t) { 0 };
+    ref.utf8 = true;
+    text_bounds_buf(big, sz, &ref);
+    for (k = 2; k <= 16; k += 7) {
+        box = (textbox_t) { 0 };
+        box.utf8 = true;
+        text_bounds_buf_parallel(big, sz, &box, k);
+        if (box.lines != ref.lines || box.columns != ref.columns) {
+            printf("FAIL utf8 parallel threads=%zu: %zux%zu, expected %zux%zu\n",
+                k, box.columns, box.lines, ref.columns, ref.lines);
+            ++err;
+        }
+    }
+    return (err);
+}
+
+/*
+ * Tab stops, regular and irregular, serial and on threads.
+ */
+static int
+check_tabs(void)
+{
+    static const struct {
+        const char *spec;
+        size_t columns;     // of "a\tb\n\tx\tyy\n", as by expand -t
+    } cases[] = {
+        { "8",          18 },
+        { "4",          10 },
+        { "3",           8 },
+        { "1",           5 },
+        { "2,5,9",       7 },
+        { "4,8",        10 },
+        { NULL, 0 }
+    };
+    static const char *const bad_specs[] = { "", "0", "4,3", "4,", ",4", "x", NULL };
+    static const char text[] = "a\tb\n\tx\tyy\n";
+    static char big[1024 * 1024];
+    tbtabs_t *tabs;
+    textbox_t ref;
+    textbox_t box;
+    size_t i;
+    int err;
+
+    err = 0;
+    for (i = 0; bad_specs[i] != NULL; ++i) {
+        tabs = text_bounds_tabs(bad_specs[i]);
+        if (tabs != NULL) {
+            printf("FAIL tabs '%s': should not be valid\n", bad_specs[i]);
+            text_bounds_tabs_free(tabs);
+            ++err;
+        }
+    }
+
+    for (i = 0; i < sizeof (big); ++i) {
+        big[i] = "\t\t abc\n"[rand() % (i % 3 == 0 ? 8 : 7)];
+    }
+
+    for (i = 0; cases[i].spec != NULL; ++i) {
+        tabs = text_bounds_tabs(cases[i].spec);
+        if (tabs == NULL) {
+            printf("FAIL tabs '%s': not valid\n", cases[i].spec);
+            ++err;
+            continue;
+        }
+        box = (textbox_t) { 0 };
+        box.tabs = tabs;
+        text_bounds_buf(text, strlen(text), &box);
+        if (box.columns != cases[i].columns) {
+            printf("FAIL tabs '%s': %zu columns, expected %zu\n",
+                cases[i].spec, box.columns, cases[i].columns);
+            ++err;
+        }
+
+        ref = (textbox_t) { 0 };
+        ref.tabs = tabs;
+        text_bounds_buf(big, sizeof (big), &ref);
+        box = (textbox_t) { 0 };
+        box.tabs = tabs;
+        text_bounds_buf_parallel(big, sizeof (big), &box, 7);
+        if (box.lines != ref.lines || box.columns != ref.columns) {
+            printf("FAIL tabs '%s' parallel: %zux%zu, expected %zux%zu\n",
+                cases[i].spec, box.columns, box.lines, ref.columns, ref.lines);
+            ++err;
+        }
+        text_bounds_tabs_free(tabs);
+    }
+    return (err);
+}
+
+/*
+ * Text with some other line ending measures the same as the text
+ * with LF in its place: a CRLF becomes LF, and with CR or NUL,
+ * that byte and LF trade places.  Return the new size.
+ */
+static size_t
+eol_to_lf(char *dst, const char *src, size_t sz, uint_t eol)
+{
+    size_t len;
+    size_t i;
+
+    len = 0;
+    for (i = 0; i < sz; ++i) {
+        if (eol == TB_EOL_CRLF && src[i] == '\r' && i + 1 < sz && src[i + 1] == '\n') {
+            continue;
+        }
+        if (eol == TB_EOL_CR || eol == TB_EOL_NUL) {
+            if (src[i] == '\n') {
+                dst[len++] = (eol == TB_EOL_CR) ? '\r' : '\0';
+                continue;
+            }
+            if (src[i] == ((eol == TB_EOL_CR) ? '\r' : '\0')) {
+                dst[len++] = '\n';
+                continue;
+            }
+        }
+        dst[len++] = src[i];
+    }
+    return (len);
+}
+
+static int
+check_eol(void)
+{
+    static const struct {
+        uint_t eol;
+        size_t columns;
+        size_t lines;
+    } cases[] = {
+        { TB_EOL_LF,    5, 4 },
+        { TB_EOL_CRLF,  4, 4 },
+        { TB_EOL_CR,    4, 4 },
+        { TB_EOL_NUL,  16, 1 },
+        { TB_EOL_AUTO,  4, 4 },
+    };
+    static const char text[] = "ab\r\ncd  \r\n\r\nxyz\r";
+    static const char alphabet[] = "\r\n\r\n\r \ta\0";
+    static char big[1024 * 1024];
+    static char lf[sizeof (big)];
+    const char *engine;
+    tbscan_t scan;
+    textbox_t ref;
+    textbox_t box;
+    size_t eidx;
+    size_t lfsz;
+    size_t split;
+    size_t sz;
+    size_t i;
+    uint_t eol;
+    int round;
+    int err;
+
+    err = 0;
+    for (i = 0; i < sizeof (cases) / sizeof (cases[0]); ++i) {
+        box = (textbox_t) { 0 };
+        box.eol = cases[i].eol;
+        text_bounds_buf(text, sizeof (text) - 1, &box);
+        if (box.columns != cases[i].columns || box.lines != cases[i].lines) {
+            printf("FAIL eol=%u: %zux%zu, expected %zux%zu\n", cases[i].eol,
+                box.columns, box.lines, cases[i].columns, cases[i].lines);
+            ++err;
+        }
+    }
+
+    // Every engine, with the text split in two anywhere,
+    // even between the CR and LF of a CRLF
+    srand(3);
+    for (round = 0; round < 100; ++round) {
+        sz = rand() % 300;
+        for (i = 0; i < sz; ++i) {
+            big[i] = alphabet[rand() % (round & 1 ? 5 : sizeof (alphabet) - 1)];
+        }
+        split = (sz == 0) ? 0 : rand() % sz;
+        for (eol = TB_EOL_CRLF; eol <= TB_EOL_NUL; ++eol) {
+            lfsz = eol_to_lf(lf, big, sz, eol);
+            ref = (textbox_t) { 0 };
+            text_bounds_set_engine("scalar");
+            text_bounds_buf(lf, lfsz, &ref);
+            for (eidx = 0; (engine = text_bounds_engine_list(eidx)) != NULL; ++eidx) {
+                text_bounds_set_engine(engine);
+                box = (textbox_t) { 0 };
+                box.eol = eol;
+                text_bounds_start(&scan, &box);
+                text_bounds_feed(&scan, big, split);
+                text_bounds_feed(&scan, big + split, sz - split);
+                text_bounds_finish(&scan, &box);
+                if (box.lines != ref.lines || box.columns != ref.columns) {
+                    printf("FAIL eol=%u engine=%s size=%zu split=%zu: %zux%zu, expected %zux%zu\n",
+                        eol, engine, sz, split,
+                        box.columns, box.lines, ref.columns, ref.lines);
+                    ++err;
+                }
+            }
+        }
+    }
+
+    // Chunk boundaries between threads: the same as measuring serially
+    for (i = 0; i < sizeof (big); ++i) {
+        big[i] = alphabet[rand() % (i % 3 == 0 ? 5 : sizeof (alphabet) - 1)];
+    }
+    for (eol = TB_EOL_CRLF; eol <= TB_EOL_AUTO; ++eol) {
+        ref = (textbox_t) { 0 };
+        ref.eol = eol;
+        text_bounds_buf(big, sizeof (big), &ref);
+        box = (textbox_t) { 0 };
+        box.eol = eol;
+        text_bounds_buf_parallel(big, sizeof (big), &box, 7);
+        if (box.lines != ref.lines || box.columns != ref.columns) {
+            printf("FAIL eol=%u parallel: %zux%zu, expected %zux%zu\n",
+                eol, box.columns, box.lines, ref.columns, ref.lines);
+            ++err;
+        }
+    }
+    return (err);
+}
+
+/*
+ * Are two histograms the same, bin for bin?
+ */
+static bool
+same_hist(const tbhist_t *a, const tbhist_t *b)
+{
+    size_t ia = 0;
+    size_t ib = 0;
+    size_t alo, ahi, acount;
+    size_t blo, bhi, bcount;
+    bool amore;
+    bool bmore;
+
+    for (;;) {
+        amore = text_bounds_hist_bin(a, &ia, &alo, &ahi, &acount);
+        bmore = text_bounds_hist_bin(b, &ib, &blo, &bhi, &bcount);
+        if (amore != bmore) {
+            return (false);
+        }
+        if (!amore) {
+            return (true);
+        }
+        if (alo != blo || ahi != bhi || acount != bcount) {
+            return (false);
+        }
+    }
+}
+
+static int
+check_hist(void)
+{
+    // Widths 0 through 9, once each
+    static const char text[] =
+        "\n1\n22\n333\n4444\n55555\n666666\n7777777\n88888888\n999999999\n";
+    static char big[1024 * 1024];
+    tbhist_t *hist;
+    tbhist_t *part;
+    textbox_t box;
+    size_t half;
+    size_t w;
+    size_t i;
+    int err;
+
+    err = 0;
+    hist = text_bounds_hist_new();
+    part = text_bounds_hist_new();
+
+    box = (textbox_t) { 0 };
+    box.hist = hist;
+    text_bounds_buf(text, sizeof (text) - 1, &box);
+    if (box.dist.lines != 10 || box.dist.p50 != 4 || box.dist.p90 != 8
+        || box.dist.p999 != 9 || box.dist.mean != 4.5 || box.dist.max != 9) {
+        printf("FAIL hist: %zu lines, p50=%zu p90=%zu p999=%zu mean=%g max=%zu\n",
+            box.dist.lines, box.dist.p50, box.dist.p90, box.dist.p999,
+            box.dist.mean, box.dist.max);
+        ++err;
+    }
+
+    // Wide lines are bucketed, but within 1/64th
+    for (w = 5000; w < sizeof (big); w = w * 3 / 2) {
+        memset(big, 'x', w);
+        text_bounds_hist_clear(hist);
+        box = (textbox_t) { 0 };
+        box.hist = hist;
+        text_bounds_buf(big, w, &box);
+        for (i = 1; i <= 3; ++i) {
+            text_bounds_buf(big, w - i * w / 100, &box);
+        }
+        if (box.dist.max != w || box.dist.p50 > box.dist.p99
+            || (box.dist.p50 - box.dist.p50 / 64 > w - 2 * w / 100)
+            || (box.dist.p50 + box.dist.p50 / 64 < w - 2 * w / 100)) {
+            printf("FAIL hist w=%zu: max=%zu p50=%zu p99=%zu\n",
+                w, box.dist.max, box.dist.p50, box.dist.p99);
+            ++err;
+        }
+    }
+
+    for (i = 0; i < sizeof (big); ++i) {
+        big[i] = "\t  abc\n"[rand() % (i % 5 == 0 ? 7 : 6)];
+    }
+
+    // The same, whether on one thread or several ...
+    text_bounds_hist_clear(hist);
+    box = (textbox_t) { 0 };
+    box.hist = hist;
+    text_bounds_buf(big, sizeof (big), &box);
+    text_bounds_hist_clear(part);
+    box = (textbox_t) { 0 };
+    box.hist = part;
+    text_bounds_buf_parallel(big, sizeof (big), &box, 7);
+    if (!same_hist(hist, part)) {
+        printf("FAIL hist parallel\n");
+        ++err;
+    }
+
+    // ... or measured in two parts, split after a newline, and merged.
+    half = (char *)memchr(big + sizeof (big) / 2, '\n', sizeof (big) / 2) + 1 - big;
+    text_bounds_hist_clear(part);
+    box = (textbox_t) { 0 };
+    box.hist = part;
+    text_bounds_buf(big, half, &box);
+    box.hist = text_bounds_hist_new();
+    text_bounds_buf(big + half, sizeof (big) - half, &box);
+    text_bounds_hist_merge(part, box.hist);
+    text_bounds_hist_free(box.hist);
+    if (!same_hist(hist, part)) {
+        printf("FAIL hist merge\n");
+        ++err;
+    }
+
+    text_bounds_hist_free(part);
+    text_bounds_hist_free(hist);
+    return (err);
+}
+
+/*
+ * Where the widest line is: the first of the widest, counting lines
+ * from 1 and offsets from 0, whichever way the text is measured.
+ */
+static int
+check_widest(void)
+{
+    static const char text[] = "ab\n\txy\n  \n123456789a\nxyz";
+    static const char *alphabet[] = { "\r\n", "\n", "\t", " ", "a", "\xc3\xa9", "\xe4\xb8\x80" };
+    static char big[256 * 1024];
+    textbox_t ref;
+    textbox_t box;
+    const char *engine;
+    const char *s;
+    size_t eidx;
+    size_t sz;
+    size_t len;
+    int err;
+
+    err = 0;
+    box = (textbox_t) { 0 };
+    text_bounds_buf(text, sizeof (text) - 1, &box);
+    if (box.columns != 10 || box.widest_line != 2 || box.widest_offset != 3) {
+        printf("FAIL widest: %zu columns, line %zu, offset %jd\n",
+            box.columns, box.widest_line, (intmax_t)box.widest_offset);
+        ++err;
+    }
+
+    // UTF-8 and CRLF: offsets are in bytes, not cells
+    sz = 0;
+    while (sz < sizeof (big) - 4) {
+        s = alphabet[rand() % (sizeof (alphabet) / sizeof (alphabet[0]))];
+        len = strlen(s);
+        if (s[0] == '\n' && rand() % 8 != 0) {
+            continue;
+        }
+        memcpy(big + sz, s, len);
+        sz += len;
+    }
+    ref = (textbox_t) { 0 };
+    ref.utf8 = true;
+    ref.eol = TB_EOL_CRLF;
+    text_bounds_buf(big, sz, &ref);
+    for (eidx = 0; (engine = text_bounds_engine_list(eidx)) != NULL; ++eidx) {
+        text_bounds_set_engine(engine);
+        box = (textbox_t) { 0 };
+        box.utf8 = true;
+        box.eol = TB_EOL_CRLF;
+        text_bounds_buf(big, sz, &box);
+        if (box.columns != ref.columns || !same_widest(&box, &ref)) {
+            printf("FAIL widest engine=%s: line %zu, offset %jd, expected line %zu, offset %jd\n",
+                engine, box.widest_line, (intmax_t)box.widest_offset,
+                ref.widest_line, (intmax_t)ref.widest_offset);
+            ++err;
+        }
+        box = (textbox_t) { 0 };
+        box.utf8 = true;
+        box.eol = TB_EOL_CRLF;
+        text_bounds_buf_parallel(big, sz, &box, 5);
+        if (box.columns != ref.columns || !same_widest(&box, &ref)) {
+            printf("FAIL widest parallel engine=%s: line %zu, offset %jd, expected line %zu, offset %jd\n",
+                engine, box.widest_line, (intmax_t)box.widest_offset,
+                ref.widest_line, (intmax_t)ref.widest_offset);
+            ++err;
+        }
+    }
+    return (err);
+}
+
+/*
+ * With an index, only what has been appended is measured,
+ * and the results are the same as measuring the whole file;
+ * a file that was truncated is measured from the start.
+ */
+static int
+check_index(void)
+{
+    char dir[] = "/tmp/test-textbounds-XXXXXX";
+    char name[64];
+    char idxdir[64];
+    char idxname[128];
+    tbfile_t ref;
+    tbfile_t one;
+    struct stat st;
+    size_t i;
+    int round;
+    FILE *f;
+    int err;
+
+    if (mkdtemp(dir) == NULL) {
+        return (0);
+    }
+    snprintf(name, sizeof (name), "%s/log", dir);
+    snprintf(idxdir, sizeof (idxdir), "%s/index", dir);
+
+    err = 0;
+    for (round = 0; round < 6; ++round) {
+        f = fopen(name, round == 4 ? "w" : "a");
+        if (f == NULL) {
+            break;
+        }
+        // Lines, and sometimes a line still being written
+        for (i = 0; i < 20000 + (size_t)round * 50000; ++i) {
+            putc("\n\tab c"[rand() % 6], f);
+        }
+        fclose(f);
+
+        ref = (tbfile_t) { .fname = name };
+        text_bounds_file(&ref, 1);
+        one = (tbfile_t) { .fname = name };
+        one.box.index = idxdir;
+        text_bounds_file(&one, 1 + round % 2);
+        if (one.err != 0 || one.box.lines != ref.box.lines
+            || one.box.columns != ref.box.columns || !same_widest(&one.box, &ref.box)) {
+            printf("FAIL index round %d: %zux%zu, expected %zux%zu\n", round,
+                one.box.columns, one.box.lines, ref.box.columns, ref.box.lines);
+            ++err;
+        }
+    }
+
+    // The start of the file is not read again
+    f = fopen(name, "r+");
+    if (f != NULL) {
+        for (i = 0; i < 500; ++i) {
+            putc('z', f);
+        }
+        fclose(f);
+        one = (tbfile_t) { .fname = name };
+        one.box.index = idxdir;
+        text_bounds_file(&one, 1);
+        if (one.box.columns != ref.box.columns) {
+            printf("FAIL index: measured from the start\n");
+            ++err;
+        }
+    }
+
+    if (stat(name, &st) == 0) {
+        snprintf(idxname, sizeof (idxname), "%s/%jx-%jx", idxdir,
+            (uintmax_t)st.st_dev, (uintmax_t)st.st_ino);
+        unlink(idxname);
+    }
+    unlink(name);
+    rmdir(idxdir);
+    rmdir(dir);
+    return (err);
+}
+
+/*
+ * Following a file as it grows, in pieces that split lines, CRLFs
+ * and UTF-8 sequences, must give the same results as measuring
+ * the whole file; so must following it through truncation and rotation.
+ */
+static int
+check_follow(void)
+{
+    static const char *alphabet[] = { "\r\n", "\n", "\t", " ", "a", "\xc3\xa9", "\xe4\xb8\x80" };
+    char dir[] = "/tmp/test-textbounds-XXXXXX";
+    char name[64];
+    char old[64];
+    tbfile_t ref;
+    tbfile_t one;
+    tbfollow_t *fw;
+    const char *s;
+    size_t i;
+    size_t len;
+    int round;
+    FILE *f;
+    int err;
+
+    if (mkdtemp(dir) == NULL) {
+        return (0);
+    }
+    snprintf(name, sizeof (name), "%s/log", dir);
+    snprintf(old, sizeof (old), "%s/log.1", dir);
+    f = fopen(name, "w");
+    if (f == NULL) {
+        rmdir(dir);
+        return (0);
+    }
+    fclose(f);
+
+    err = 0;
+    one = (tbfile_t) { .fname = name };
+    one.box.utf8 = true;
+    one.box.eol = TB_EOL_CRLF;
+    fw = text_bounds_follow_new(1, &one);
+    for (round = 0; round < 40; ++round) {
+        if (round == 20) {
+            // Truncated ...
+            truncate(name, 0);
+        }
+        if (round == 30) {
+            // ... or rotated
+            rename(name, old);
+        }
+        f = fopen(name, "a");
+        if (f == NULL) {
+            break;
+        }
+        for (i = 0; i < (size_t)rand() % 3000; ++i) {
+            s = alphabet[rand() % (sizeof (alphabet) / sizeof (alphabet[0]))];
+            len = strlen(s);
+            // Sometimes, stop in the middle of a sequence
+            if (i % 1000 == 999 && len > 1) {
+                len = 1;
+            }
+            fwrite(s, 1, len, f);
+        }
+        fclose(f);
+
+        text_bounds_follow_poll(fw, 0, NULL, NULL);
+        ref = (tbfile_t) { .fname = name };
+        ref.box.utf8 = true;
+        ref.box.eol = TB_EOL_CRLF;
+        text_bounds_file(&ref, 1);
+        if (one.err != 0 || one.box.lines != ref.box.lines
+            || one.box.columns != ref.box.columns || !same_widest(&one.box, &ref.box)) {
+            printf("FAIL follow round %d: %zux%zu, expected %zux%zu\n", round,
+                one.box.columns, one.box.lines, ref.box.columns, ref.box.lines);
+            ++err;
+        }
+    }
+    text_bounds_follow_free(fw);
+
+    unlink(name);
+    unlink(old);
+    rmdir(dir);
+    return (err);
+}
+
+static void
+count_report(tbfile_t *fp, void *arg)
+{
+    (void)fp;
+    ++*(size_t *)arg;
+}
+
+/*
+ * Compressed text measures the same as the text it decodes to,
+ * from a file or from a pipe, and several gzip members in a row
+ * are one text.  Formats that were not built in are skipped.
+ */
+static const char gz_text[] =
+    "The quick brown fox\njumps\tover\nthe lazy dog, again and again and again\n";
+
+static const char gz_data[] =
+    "\x1f\x8b\x08\x00\x00\x00\x00\x00\x02\x03\x0b\xc9\x48\x55\x28\x2c"
+    "\xcd\x4c\xce\x56\x48\x2a\xca\x2f\xcf\x53\x48\xcb\xaf\xe0\xca\x2a"
+    "\xcd\x2d\x28\xe6\xcc\x2f\x4b\x2d\xe2\x2a\x01\x4a\xe7\x24\x56\x55"
+    "\x2a\xa4\xe4\xa7\xeb\x28\x24\xa6\x27\x66\xe6\x29\x24\xe6\xa5\xa0"
+    "\xb3\xb8\x00\xf6\x40\xc3\x96\x47\x00\x00\x00";
+
+static const char xz_data[] =
+    "\xfd\x37\x7a\x58\x5a\x00\x00\x04\xe6\xd6\xb4\x46\x02\x00\x21\x01"
+    "\x16\x00\x00\x00\x74\x2f\xe5\xa3\xe0\x00\x46\x00\x3c\x5d\x00\x2a"
+    "\x1a\x08\xa2\x03\x25\x66\xf1\x4b\x78\xc5\xa2\x05\xff\x2e\xe6\xd9"
+    "\xd2\x20\x1a\xab\x00\x54\xd0\x19\x5f\x72\x08\x55\x2a\x1d\x1f\x06"
+    "\x26\xeb\x2a\x1e\x99\x1f\x92\xf6\x66\x41\x6d\xae\x2a\x40\x31\xb7"
+    "\x2b\x11\x04\x69\x71\xe1\x51\x36\x59\x64\x0a\x00\x04\xb8\x31\x30"
+    "\x70\x72\xd2\x23\x00\x01\x58\x47\x44\xb6\x5c\xba\x1f\xb6\xf3\x7d"
+    "\x01\x00\x00\x00\x00\x04\x59\x5a";
+
+/*
+ * Measure sz bytes of data, repeated n times, from a file (or a pipe);
+ * it should measure the same as gz_text, repeated n times.
+ * Return 0 if it does, or if the format was not built in.
+ */
+static int
+check_decompress_one(const char *what, const char *data, size_t sz, int n,
+    bool pipe_it, const char *fname)
+{
+    textbox_t ref = { 0 };
+    textbox_t box = { 0 };
+    int fds[2];
+    int fd;
+    int i;
+    int err;
+
+    for (i = 0; i < n; ++i) {
+        text_bounds_buf(gz_text, sizeof (gz_text) - 1, &ref);
+    }
+    if (pipe_it) {
+        if (pipe(fds) != 0) {
+            return (0);
+        }
+        for (i = 0; i < n; ++i) {
+            if (write(fds[1], data, sz) != (ssize_t)sz) {
+                break;
+            }
+        }
+        close(fds[1]);
+        fd = fds[0];
+    }
+    else {
+        fd = open(fname, O_RDWR | O_CREAT | O_TRUNC, 0666);
+        if (fd < 0) {
+            return (0);
+        }
+        for (i = 0; i < n; ++i) {
+            if (write(fd, data, sz) != (ssize_t)sz) {
+                break;
+            }
+        }
+        lseek(fd, 0, SEEK_SET);
+    }
+    box.decompress = true;
+    err = text_bounds_fd(fd, &box, 1);
+    close(fd);
+    if (err == ENOTSUP) {
+        return (0);
+    }
+    if (err != 0 || box.lines != ref.lines || box.columns != ref.columns
+        || !same_widest(&box, &ref) || box.zstat.format == NULL
+        || strcmp(box.zstat.format, what) != 0
+        || box.zstat.in != (off_t)(n * sz)
+        || box.zstat.out != (off_t)(n * (sizeof (gz_text) - 1))) {
+        printf("FAIL decompress %s x%d%s: err=%d %zux%zu, expected %zux%zu\n",
+            what, n, pipe_it ? " from a pipe" : "", err,
+            box.columns, box.lines, ref.columns, ref.lines);
+        return (1);
+    }
+    return (0);
+}
+
+/*
+ * Zero bytes after the last gzip member are padding, not an error;
+ * anything else there still is.
+ */
+static int
+check_decompress_padded(const char *fname)
+{
+    static const char zeros[512];
+    textbox_t ref = { 0 };
+    textbox_t box = { 0 };
+    int fd;
+    int err;
+    int rv;
+
+    text_bounds_buf(gz_text, sizeof (gz_text) - 1, &ref);
+    fd = open(fname, O_RDWR | O_TRUNC);
+    if (fd < 0) {
+        return (0);
+    }
+    rv = 0;
+    if (write(fd, gz_data, sizeof (gz_data) - 1) == sizeof (gz_data) - 1
+        && write(fd, zeros, sizeof (zeros)) == sizeof (zeros)) {
+        lseek(fd, 0, SEEK_SET);
+        box.decompress = true;
+        err = text_bounds_fd(fd, &box, 1);
+        if (err == ENOTSUP) {
+            close(fd);
+            return (0);
+        }
+        if (err != 0 || box.lines != ref.lines || box.columns != ref.columns) {
+            printf("FAIL decompress: gzip padded with zeros: err=%d\n", err);
+            rv = 1;
+        }
+        if (write(fd, "x", 1) == 1) {
+            lseek(fd, 0, SEEK_SET);
+            box = (textbox_t) { 0 };
+            box.decompress = true;
+            if (text_bounds_fd(fd, &box, 1) == 0) {
+                printf("FAIL decompress: gzip with trailing garbage measured\n");
+                rv = 1;
+            }
+        }
+    }
+    close(fd);
+    return (rv);
+}
+
+static int
+check_decompress(void)
+{
+    char name[] = "/tmp/test-textbounds-XXXXXX";
+    textbox_t box = { 0 };
+    int fd;
+    int err;
+
+    fd = mkstemp(name);
+    if (fd < 0) {
+        return (0);
+    }
+    close(fd);
+
+    err = 0;
+    err += check_decompress_one("gzip", gz_data, sizeof (gz_data) - 1, 1, false, name);
+    err += check_decompress_one("gzip", gz_data, sizeof (gz_data) - 1, 3, false, name);
+    err += check_decompress_one("gzip", gz_data, sizeof (gz_data) - 1, 2, true, name);
+    err += check_decompress_padded(name);
+    err += check_decompress_one("xz", xz_data, sizeof (xz_data) - 1, 1, false, name);
+    err += check_decompress_one("xz", xz_data, sizeof (xz_data) - 1, 2, true, name);
+
+    // Cut short, it is an error; not asked to, it is just bytes.
+    fd = open(name, O_RDWR | O_TRUNC);
+    if (fd >= 0) {
+        if (write(fd, gz_data, 40) == 40) {
+            lseek(fd, 0, SEEK_SET);
+            box.decompress = true;
+            if (text_bounds_fd(fd, &box, 1) == 0) {
+                printf("FAIL decompress: truncated gzip measured %zux%zu\n",
+                    box.columns, box.lines);
+                ++err;
+            }
+            lseek(fd, 0, SEEK_SET);
+            box = (textbox_t) { 0 };
+            if (text_bounds_fd(fd, &box, 1) != 0 || box.zstat.format != NULL) {
+                printf("FAIL decompress: decoded, though not asked to\n");
+                ++err;
+            }
+        }
+        close(fd);
+    }
+    unlink(name);
+    return (err);
+}
+
+/*
+ * With a cache, results must be the same as without, for files
+ * that have not changed, and for files that have; with enough files
+ * to make the cache grow, and measured on several threads at once.
+ */
+static int
+check_cache(void)
+{
+    enum { NFILES = 3000 };
+    char dir[] = "/tmp/test-textbounds-XXXXXX";
+    char cachename[64];
+    static char names[NFILES][64];
+    static tbfile_t files[NFILES];
+    struct timeval tv[2];
+    tbcache_t *cache;
+    tbfile_t ref;
+    size_t nreports;
+    size_t i;
+    size_t j;
+    int round;
+    FILE *f;
+    int err;
+
+    if (mkdtemp(dir) == NULL) {
+        return (0);
+    }
+    snprintf(cachename, sizeof (cachename), "%s/cache", dir);
+    // Not modified just now, or they would not be cached
+    gettimeofday(&tv[0], NULL);
+    tv[0].tv_sec -= 3600;
+    tv[1] = tv[0];
+    for (i = 0; i < NFILES; ++i) {
+        snprintf(names[i], sizeof (names[i]), "%s/f%zu", dir, i);
+        f = fopen(names[i], "w");
+        if (f == NULL) {
+            continue;
+        }
+        for (j = rand() % 200; j > 0; --j) {
+            putc("\n\tab c"[rand() % 6], f);
+        }
+        fclose(f);
+        utimes(names[i], tv);
+    }
+
+    err = 0;
+    for (round = 0; round < 3; ++round) {
+        cache = text_bounds_cache_open(cachename);
+        if (cache == NULL) {
+            printf("FAIL cache: open: %s\n", strerror(errno));
+            ++err;
+            break;
+        }
+        if (round == 2) {
+            // Change some files
+            for (i = 0; i < NFILES; i += 7) {
+                f = fopen(names[i], "a");
+                if (f != NULL) {
+                    fputs("a much longer line, this time\n", f);
+                    fclose(f);
+                }
+                utimes(names[i], tv);
+            }
+        }
+        for (i = 0; i < NFILES; ++i) {
+            files[i] = (tbfile_t) { .fname = names[i] };
+            files[i].box.cache = cache;
+        }
+        nreports = 0;
+        text_bounds_filev_jobs(NFILES, files, 3, 1, true, count_report, &nreports);
+        for (i = 0; i < NFILES; ++i) {
+            ref = (tbfile_t) { .fname = names[i] };
+            text_bounds_file(&ref, 1);
+            if (files[i].err != 0 || files[i].box.lines != ref.box.lines
+                || files[i].box.columns != ref.box.columns
+                || !same_widest(&files[i].box, &ref.box)) {
+                printf("FAIL cache round %d %s: %zux%zu, expected %zux%zu\n", round,
+                    names[i], files[i].box.columns, files[i].box.lines,
+                    ref.box.columns, ref.box.lines);
+                ++err;
+                break;
+            }
+        }
+        text_bounds_cache_close(cache);
+    }
+
+    for (i = 0; i < NFILES; ++i) {
+        unlink(names[i]);
+    }
+    unlink(cachename);
+    rmdir(dir);
+    return (err);
+}
+
+/*
+ * Walking a tree finds every regular file in it, once, however many
+ * threads walk it; symbolic links are followed only if asked,
+ * and a link to a directory above does not loop.
+ */
+struct walk_count {
+    size_t files;
+    size_t lines;
+    size_t errors;
+};
+
+static void
+walk_report(tbfile_t *fp, void *arg)
+{
+    struct walk_count *wc = (struct walk_count *)arg;
+
+    if (fp->err != 0) {
+        ++wc->errors;
+        return;
+    }
+    ++wc->files;
+    wc->lines += fp->box.lines;
+}
+
+static int
+check_walk(void)
+{
+    char dir[] = "/tmp/test-textbounds-XXXXXX";
+    char name[128];
+    char *paths[1];
+    struct walk_count wc;
+    size_t files;
+    size_t lines;
+    tbfile_t proto;
+    int i;
+    int j;
+    int k;
+    int n;
+    int round;
+    FILE *f;
+    int err;
+
+    if (mkdtemp(dir) == NULL) {
+        return (0);
+    }
+    files = 0;
+    lines = 0;
+    for (i = 0; i < 4; ++i) {
+        snprintf(name, sizeof (name), "%s/d%d", dir, i);
+        mkdir(name, 0777);
+        for (j = 0; j < 4; ++j) {
+            snprintf(name, sizeof (name), "%s/d%d/e%d", dir, i, j);
+            mkdir(name, 0777);
+            for (k = 0; k < 3 + i + j; ++k) {
+                snprintf(name, sizeof (name), "%s/d%d/e%d/f%d", dir, i, j, k);
+                f = fopen(name, "w");
+                if (f == NULL) {
+                    continue;
+                }
+                for (n = 0; n < i + j + k; ++n) {
+                    fputs("abc\n", f);
+                }
+                fclose(f);
+                ++files;
+                lines += i + j + k;
+            }
+        }
+    }
+    snprintf(name, sizeof (name), "%s/loop", dir);
+    err = symlink(".", name);
+    snprintf(name, sizeof (name), "%s/link", dir);
+    err += symlink("d3/e3/f0", name);
+    if (err != 0) {
+        return (0);
+    }
+
+    err = 0;
+    paths[0] = dir;
+    for (round = 0; round < 4; ++round) {
+        memset(&wc, 0, sizeof (wc));
+        proto = (tbfile_t) { .fname = NULL };
+        text_bounds_walk(1, paths, &proto, 1 + 3 * (round % 2),
+            (round < 2) ? 0 : TB_WALK_FOLLOW, walk_report, &wc);
+        // Followed, the link to d3/e3/f0 is one more file, of 6 lines
+        if (wc.errors != 0 || wc.files != files + (round >= 2)
+            || wc.lines != lines + 6 * (round >= 2)) {
+            printf("FAIL walk round %d: %zu files, %zu lines, %zu errors;"
+                " expected %zu files, %zu lines\n", round, wc.files, wc.lines,
+                wc.errors, files + (round >= 2), lines + 6 * (round >= 2));
+            ++err;
+        }
+    }
+
+    for (i = 0; i < 4; ++i) {
+        for (j = 0; j < 4; ++j) {
+            for (k = 0; k < 3 + i + j; ++k) {
+                snprintf(name, sizeof (name), "%s/d%d/e%d/f%d", dir, i, j, k);
+                unlink(name);
+            }
+            snprintf(name, sizeof (name), "%s/d%d/e%d", dir, i, j);
+            rmdir(name);
+        }
+        snprintf(name, sizeof (name), "%s/d%d", dir, i);
+        rmdir(name);
+    }
+    snprintf(name, sizeof (name), "%s/loop", dir);
+    unlink(name);
+    snprintf(name, sizeof (name), "%s/link", dir);
+    unlink(name);
+    rmdir(dir);
+    return (err);
+}
+
+/*
+ * Measuring a list of files with io_uring must give the same results
+ * as measuring them one at a time, whatever the mix of sizes.
+ * Skipped if io_uring is not available.
+ */
+static int
+check_uring(void)
+{
+    static const size_t sizes[] = { 0, 1, 100, 4095, 32768, 32769, 100000, 300000 };
+    enum { NFILES = 40 };
+    char dir[] = "/tmp/test-textbounds-XXXXXX";
+    char names[NFILES][64];
+    tbfile_t files[NFILES];
+    textbox_t ref;
+    size_t nreports;
+    size_t sz;
+    size_t i;
+    size_t j;
+    FILE *f;
+    int rv;
+    int err;
+
+    if (mkdtemp(dir) == NULL) {
+        return (0);
+    }
+    for (i = 0; i < NFILES; ++i) {
+        snprintf(names[i], sizeof (names[i]), "%s/f%zu", dir, i);
+        files[i] = (tbfile_t) { .fname = names[i] };
+        f = fopen(names[i], "w");
+        if (f == NULL) {
+            continue;
+        }
+        sz = sizes[i % (sizeof (sizes) / sizeof (sizes[0]))];
+        for (j = 0; j < sz; ++j) {
+            putc("\n\tab c"[rand() % 6], f);
+        }
+        fclose(f);
+    }
+
+    err = 0;
+    nreports = 0;
+    rv = text_bounds_filev_uring(NFILES, files, true, count_report, &nreports);
+    if (rv >= 0) {
+        if (rv != 0 || nreports != NFILES) {
+            printf("FAIL uring: rv=%d, %zu reports, expected %d\n", rv, nreports, NFILES);
+            ++err;
+        }
+        for (i = 0; i < NFILES; ++i) {
+            tbfile_t one = { .fname = names[i] };
+
+            text_bounds_file(&one, 1);
+            ref = one.box;
+            if (files[i].err != 0
+                || files[i].box.lines != ref.lines
+                || files[i].box.columns != ref.columns) {
+                printf("FAIL uring %s: %zux%zu err=%d, expected %zux%zu\n",
+                    names[i], files[i].box.columns, files[i].box.lines,
+                    files[i].err, ref.columns, ref.lines);
+                ++err;
+            }
+        }
+    }
+
+    for (i = 0; i < NFILES; ++i) {
+        unlink(names[i]);
+    }
+    rmdir(dir);
+    return (err);
+}
+
+/*
+ * A compiled format must show just what the format string says,
+ * through a buffer that is written out many times over,
+ * and around names too long to be worth copying into it.
+ */
+static int
+check_format_one(const char *str, const char *fname, const textbox_t *box,
+    const char *want)
+{
+    char name[] = "/tmp/test-textbounds-XXXXXX";
+    char got[256];
+    tbformat_t *fmt;
+    tbout_t *out;
+    ssize_t rsz;
+    int fd;
+    int err;
+
+    fd = mkstemp(name);
+    if (fd < 0) {
+        return (0);
+    }
+    unlink(name);
+    fmt = text_bounds_format_compile(str);
+    out = text_bounds_out_new(fd);
+    text_bounds_out_format(out, fmt, fname, box);
+    err = 0;
+    if (text_bounds_out_free(out) != 0) {
+        printf("FAIL format '%s': %s\n", str, strerror(errno));
+        ++err;
+    }
+    text_bounds_format_free(fmt);
+    rsz = pread(fd, got, sizeof (got) - 1, 0);
+    got[rsz > 0 ? rsz : 0] = '\0';
+    if (err == 0 && strcmp(got, want) != 0) {
+        printf("FAIL format '%s': got '%s', want '%s'\n", str, got, want);
+        ++err;
+    }
+    close(fd);
+    return (err);
+}
+
+static int
+check_format(void)
+{
+    char name[] = "/tmp/test-textbounds-XXXXXX";
+    textbox_t box = { 0 };
+    tbformat_t *fmt;
+    tbout_t *out;
+    char *want;
+    char *got;
+    char *longname;
+    size_t longsz;
+    size_t wantsz;
+    size_t i;
+    ssize_t rsz;
+    int fd;
+    int err;
+
+    box.lines = 3;
+    box.columns = 17;
+    box.widest_line = 2;
+    box.widest_offset = (off_t)1234567890123LL;
+    box.dist.mean = 12.25;
+    box.dist.p50 = 9;
+    box.dist.p999 = 100000;
+
+    err = 0;
+    err += check_format_one("%cx%l", "a", &box, "17x3\n");
+    err += check_format_one("%f %l %c", "a b", &box, "a b 3 17\n");
+    err += check_format_one("", "a", &box, "\n");
+    err += check_format_one("%L@%o 100%%", "a", &box, "2@1234567890123 100%\n");
+    err += check_format_one("%{mean} %{p50} %{p999}", "a", &box, "12.2 9 100000\n");
+    err += check_format_one("%q %{p1} %{p9", "a", &box,
+        "{%q=ERROR} {%{p1}=ERROR} {%{p9=ERROR}\n");
+    err += check_format_one("x%", "a", &box, "x{%=ERROR}\n");
+    fmt = text_bounds_format_compile("%f");
+    if (text_bounds_format_measure(fmt) != TB_MEASURE_NONE) {
+        printf("FAIL format: '%%f' measures something\n");
+        ++err;
+    }
+    text_bounds_format_free(fmt);
+
+    // Many results, with a name longer than the buffer every so often
+    fd = mkstemp(name);
+    if (fd < 0) {
+        return (err);
+    }
+    unlink(name);
+    longsz = 300 * 1024;
+    longname = malloc(longsz + 1);
+    want = malloc(100000 * 64 + 4 * longsz);
+    got = malloc(100000 * 64 + 4 * longsz);
+    if (longname == NULL || want == NULL || got == NULL) {
+        free(longname);
+        free(want);
+        free(got);
+        close(fd);
+        return (err);
+    }
+    memset(longname, 'n', longsz);
+    longname[longsz] = '\0';
+    fmt = text_bounds_format_compile("%f:%l %c");
+    out = text_bounds_out_new(fd);
+    wantsz = 0;
+    for (i = 0; i < 100000; ++i) {
+        box.lines = i;
+        box.columns = (size_t)i * 7919 * 7919 * 7919;
+        if (i % 25000 == 1) {
+            text_bounds_out_format(out, fmt, longname, &box);
+            memcpy(want + wantsz, longname, longsz);
+            wantsz += longsz;
+            wantsz += sprintf(want + wantsz, ":%zu %zu\n", box.lines, box.columns);
+        }
+        else {
+            text_bounds_out_format(out, fmt, "f", &box);
+            wantsz += sprintf(want + wantsz, "f:%zu %zu\n", box.lines, box.columns);
+        }
+    }
+    if (text_bounds_out_free(out) != 0) {
+        printf("FAIL format: %s\n", strerror(errno));
+        ++err;
+    }
+    text_bounds_format_free(fmt);
+    rsz = pread(fd, got, wantsz + 1, 0);
+    if (rsz != (ssize_t)wantsz || memcmp(got, want, wantsz) != 0) {
+        printf("FAIL format: %zd bytes of many results; want %zu\n", rsz, wantsz);
+        ++err;
+    }
+    close(fd);
+    free(longname);
+    free(want);
+    free(got);
+    return (err);
+}
+
+/*
+ * Records for programs to read: names escaped, as JSON and CSV
+ * need them to be, and binary records just where they should be.
+ */
+static int
+check_output_one(uint_t kind, const char *fname, const textbox_t *box, int ferr,
+    const char *want, size_t wantsz)
+{
+    char name[] = "/tmp/test-textbounds-XXXXXX";
+    char got[512];
+    tbout_t *out;
+    tbout_t *paths;
+    ssize_t rsz;
+    int fd;
+    int err;
+
+    fd = mkstemp(name);
+    if (fd < 0) {
+        return (0);
+    }
+    unlink(name);
+    out = text_bounds_out_new(fd);
+    paths = text_bounds_out_new(fd);
+    text_bounds_out_begin(out, kind);
+    text_bounds_out_record(out, kind, paths, fname, box, ferr);
+    err = 0;
+    if (text_bounds_out_free(out) != 0) {
+        printf("FAIL output %u: %s\n", kind, strerror(errno));
+        ++err;
+    }
+    // Binary records first, then the path table
+    text_bounds_out_free(paths);
+    rsz = pread(fd, got, sizeof (got), 0);
+    if (err == 0 && (rsz != (ssize_t)wantsz || memcmp(got, want, wantsz) != 0)) {
+        printf("FAIL output %u: '%s': got %zd bytes '%.*s'\n", kind, fname,
+            rsz, (int)(rsz > 0 ? rsz : 0), got);
+        ++err;
+    }
+    close(fd);
+    return (err);
+}
+
+static int
+check_output(void)
+{
+    static const char jsonl[] =
+        "{\"file\":\"a\\\"b\\\\c\\u000a\u00fc\",\"lines\":3,\"columns\":17,"
+        "\"widest_line\":2,\"widest_offset\":40}\n";
+    static const char jsonl_bad[] =
+        "{\"file\":\"x\\ufffdy\",\"file_hex\":\"78ff79\",\"lines\":3,\"columns\":17,"
+        "\"widest_line\":2,\"widest_offset\":40,\"error\":\"No such file or directory\"}\n";
+    static const char csv[] =
+        "file,lines,columns,widest_line,widest_offset,mean,p50,p90,p99,p999,error\n"
+        "\"a,\"\"b\"\"\",3,17,2,40,,,,,,\n";
+    unsigned char binary[16 + 96 + 3];
+    textbox_t box = { 0 };
+    int err;
+
+    box.lines = 3;
+    box.columns = 17;
+    box.widest_line = 2;
+    box.widest_offset = 40;
+
+    err = 0;
+    err += check_output_one(TB_OUTPUT_JSONL, "a\"b\\c\n\u00fc", &box, 0,
+        jsonl, sizeof (jsonl) - 1);
+    err += check_output_one(TB_OUTPUT_JSONL, "x\xffy", &box, ENOENT,
+        jsonl_bad, sizeof (jsonl_bad) - 1);
+    err += check_output_one(TB_OUTPUT_CSV, "a,\"b\"", &box, 0,
+        csv, sizeof (csv) - 1);
+
+    memset(binary, 0, sizeof (binary));
+    memcpy(binary, "TBOUNDS\0\x60\0\0\0\x01\0\0\0", 16);
+    binary[16 + 8] = 2;         // Length of the name
+    binary[16 + 16] = 3;
+    binary[16 + 24] = 17;
+    binary[16 + 32] = 2;
+    binary[16 + 40] = 40;
+    memcpy(binary + 16 + 96, "ab", 3);
+    err += check_output_one(TB_OUTPUT_BINARY, "ab", &box, 0,
+        (const char *)binary, sizeof (binary));
+    return (err);
+}
+
+/*
+ * --stats: each file counts its bytes and system calls, and only
+ * with .stats; the slowest files come out slowest first.
+ */
+static int
+check_stats(void)
+{
+    char name[] = "/tmp/test-textbounds-XXXXXX";
+    char fname[8];
+    char buf[4096];
+    struct tbfstat fs;
+    tbstats_t *stats;
+    tbfile_t tf;
+    size_t sz;
+    size_t i;
+    int round;
+    FILE *f;
+    int fd;
+    int err;
+
+    fd = mkstemp(name);
+    if (fd < 0) {
+        return (0);
+    }
+    f = fdopen(fd, "w");
+    for (i = 0; i < 20000; ++i) {
+        fputs("0123456789\n", f);
+    }
+    fclose(f);
+
+    err = 0;
+    for (round = 0; round < 2; ++round) {
+        memset(&tf, 0, sizeof (tf));
+        tf.fname = name;
+        tf.box.stats = (round == 1);
+        text_bounds_file(&tf, 1);
+        if (tf.err != 0 || tf.box.lines != 20000) {
+            fprintf(stderr, "check_stats: lines=%zu err=%d\n", tf.box.lines, tf.err);
+            ++err;
+        }
+        if (round == 0 && (tf.box.fstat.bytes != 0 || tf.box.fstat.syscalls != 0)) {
+            fprintf(stderr, "check_stats: counted without .stats\n");
+            ++err;
+        }
+        if (round == 1 && (tf.box.fstat.bytes != 20000 * 11 || tf.box.fstat.syscalls < 3)) {
+            fprintf(stderr, "check_stats: bytes=%llu syscalls=%u\n",
+                (unsigned long long)tf.box.fstat.bytes, tf.box.fstat.syscalls);
+            ++err;
+        }
+    }
+    unlink(name);
+
+    stats = text_bounds_stats_new(2);
+    f = tmpfile();
+    if (stats == NULL || f == NULL) {
+        fprintf(stderr, "check_stats: %s\n", strerror(errno));
+        return (err + 1);
+    }
+    for (i = 1; i <= 5; ++i) {
+        memset(&fs, 0, sizeof (fs));
+        fs.open_ns = 1000000 * i;
+        fs.bytes = 100;
+        snprintf(fname, sizeof (fname), "f%zu", i);
+        text_bounds_stats_add(stats, fname, &fs, i == 3 ? ENOENT : 0);
+    }
+    text_bounds_stats_show(stats, f, "t", 1000000000, 0);
+    text_bounds_stats_free(stats);
+    rewind(f);
+    sz = fread(buf, 1, sizeof (buf) - 1, f);
+    buf[sz] = '\0';
+    fclose(f);
+    if (strstr(buf, "t: 5 files, 1 failed, 0.0 MB") == NULL
+        || strstr(buf, "max 5 ms") == NULL
+        || strstr(buf, "t: slowest: 5 ms 'f5'\nt: slowest: 4 ms 'f4'\n") == NULL
+        || strstr(buf, "'f3'") != NULL) {
+        fprintf(stderr, "check_stats: got:\n%s", buf);
+        ++err;
+    }
+    return (err);
+}
+
 int
 main(int argc, const char * const *argv)
 {
-    textbox_t textbox;
+    textbox_t textbox = { 0 };
+    const char **sp;
     int rv;
 
     (void)argc;
@@ -64,6 +1892,66 @@ main(int argc, const char * const *argv)
 
     text_bounds(&textbox);
     printf("COLUMNS=%zu X LINES=%zu\n", textbox.columns, textbox.lines);
+
+    for (sp = samples; *sp != NULL; ++sp) {
+        if (check_sample(*sp) != 0) {
+            rv = 1;
+        }
+    }
+    if (check_engines() != 0) {
+        rv = 1;
+    }
+    if (check_parallel() != 0) {
+        rv = 1;
+    }
+    if (check_parallel_marks() != 0) {
+        rv = 1;
+    }
+    if (check_tabs() != 0) {
+        rv = 1;
+    }
+    if (check_utf8() != 0) {
+        rv = 1;
+    }
+    if (check_eol() != 0) {
+        rv = 1;
+    }
+    if (check_hist() != 0) {
+        rv = 1;
+    }
+    if (check_widest() != 0) {
+        rv = 1;
+    }
+    if (check_index() != 0) {
+        rv = 1;
+    }
+    if (check_follow() != 0) {
+        rv = 1;
+    }
+    if (check_cache() != 0) {
+        rv = 1;
+    }
+    if (check_decompress() != 0) {
+        rv = 1;
+    }
+    if (check_walk() != 0) {
+        rv = 1;
+    }
+    if (check_fits() != 0) {
+        rv = 1;
+    }
+    if (check_uring() != 0) {
+        rv = 1;
+    }
+    if (check_format() != 0) {
+        rv = 1;
+    }
+    if (check_output() != 0) {
+        rv = 1;
+    }
+    if (check_stats() != 0) {
+        rv = 1;
+    }
     // dbg_printf("main: rv=%d\n", rv);
     return (rv);
     exit(rv);